@@ -0,0 +1,314 @@
+#ifndef ALIGN_H_
+#define ALIGN_H_
+#include "audio.h"
+#include "fft.h"
+
+// Transfers a `.time` file between two rips of the same music. Both files are reduced to
+// Haitsma-Kalker style fingerprints (32 bits per 32ms frame: signs of band-energy differences over
+// time and frequency) and every reference boundary is located in the target by the offset with the
+// fewest differing bits around it. Boundaries are matched one by one, so different leading silence,
+// encoder delay, gaps between tracks and clock drift all come out in the rewritten timestamps.
+bool align_tracks(const char *reference_path, Tracks reference, const char *target_path, const char *output_path, size_t workers);
+
+#define ALIGN_FINGERPRINT_HZ	31.25	// sub-fingerprints per second of audio
+
+// The sub-fingerprints of a whole file, in order; `free` them when done.
+uint32_t *align_fingerprint_file(const char *path, size_t workers, size_t *count);
+
+#endif // ALIGN_H_
+
+#ifdef ALIGN_IMPLEMENTATION
+#undef ALIGN_IMPLEMENTATION
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define ALIGN_SAMPLE_RATE		8000
+#define ALIGN_FFT_SIZE			FFT_SIZE	// 256ms frames
+#define ALIGN_HOP				256			// 32ms between fingerprints
+#define ALIGN_BANDS				33			// 32 bits out of 33 bands
+#define ALIGN_LOW_HZ			300.0f
+#define ALIGN_HIGH_HZ			2000.0f
+#define ALIGN_CHUNK				4096		// fingerprints per job, ~2 minutes
+#define ALIGN_SEEK_POINTS		(1<<12)
+#define ALIGN_BLOCK				256			// fingerprints matched on each side of a boundary, ~8s
+#define ALIGN_SEARCH_GLOBAL		(60 * ALIGN_SAMPLE_RATE / ALIGN_HOP)	// first boundary: ±60s
+#define ALIGN_SEARCH_LOCAL		(5 * ALIGN_SAMPLE_RATE / ALIGN_HOP)		// the rest: ±5s around the previous offset
+#define ALIGN_MAX_BER			0.35f		// bit error rate above which a match is not trusted
+
+_Static_assert(ALIGN_FINGERPRINT_HZ == (double) ALIGN_SAMPLE_RATE / ALIGN_HOP, "ALIGN_FINGERPRINT_HZ is out of date");
+
+typedef struct {
+	Fft fft;
+	uint16_t bands[ALIGN_BANDS + 1];		// bin edges
+} AlignFft;
+
+typedef struct {
+	const char *path;
+	ma_decoder *source;						// owns the seek table
+	const AlignFft *fft;
+	uint32_t *prints;
+	size_t count;
+	size_t chunks;
+	atomic_size_t next;
+	atomic_size_t failed;
+} AlignJob;
+
+static void align_fft_init(AlignFft *fft) {
+	fft_init(&fft->fft);
+	for (uint32_t b = 0; b <= ALIGN_BANDS; b++) {
+		float hz = ALIGN_LOW_HZ * powf(ALIGN_HIGH_HZ / ALIGN_LOW_HZ, (float) b / ALIGN_BANDS);
+		fft->bands[b] = (uint16_t) (hz * ALIGN_FFT_SIZE / ALIGN_SAMPLE_RATE);
+	}
+}
+
+static void align_band_energies(const AlignFft *fft, const float *samples, float *re, float *im, float *energies) {
+	fft_forward(&fft->fft, samples, re, im);
+	for (uint32_t b = 0; b < ALIGN_BANDS; b++) {		// only the bins in a band are unpacked
+		float e = 0.0f;
+		for (uint32_t k = fft->bands[b]; k < fft->bands[b + 1]; k++) e += fft_power(&fft->fft, re, im, k);
+		energies[b] = e;
+	}
+}
+
+// Fingerprints [first, last) need the band energies of the frame before the first as well.
+static bool align_chunk(AlignJob *job, ma_decoder *decoder, float *samples, size_t chunk) {
+	size_t first = chunk * ALIGN_CHUNK;
+	size_t last = first + ALIGN_CHUNK < job->count ? first + ALIGN_CHUNK : job->count;
+	size_t from = first ? first - 1UL : 0UL;
+	ma_uint64 frames = (ma_uint64) (last - from - 1UL) * ALIGN_HOP + ALIGN_FFT_SIZE, read = 0;
+
+	if (ma_decoder_seek_to_pcm_frame(decoder, (ma_uint64) from * ALIGN_HOP) != MA_SUCCESS) return false;
+	ma_decoder_read_pcm_frames(decoder, samples, frames, &read);
+	if (read < frames) memset(samples + read, 0, (size_t) (frames - read) * sizeof(float));
+
+	float re[FFT_BINS], im[FFT_BINS], energies[2][ALIGN_BANDS] = {0};
+	float *prev = energies[0], *curr = energies[1];
+	if (first) align_band_energies(job->fft, samples, re, im, prev);
+	for (size_t n = first; n < last; n++) {
+		align_band_energies(job->fft, samples + (n - from) * ALIGN_HOP, re, im, curr);
+		uint32_t bits = 0;
+		for (uint32_t b = 0; b < ALIGN_BANDS - 1; b++)
+			bits |= (uint32_t) ((curr[b] - curr[b + 1]) - (prev[b] - prev[b + 1]) > 0.0f) << b;
+		job->prints[n] = bits;
+		float *t = prev; prev = curr; curr = t;
+	}
+	return true;
+}
+
+static void *align_worker(void *arg) {
+	AlignJob *job = arg;
+
+	ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 1, ALIGN_SAMPLE_RATE);
+	ma_decoder decoder;
+	ma_result result = ma_decoder_init_file(job->path, &config, &decoder);
+	if (result == MA_SUCCESS) result = audio_decoder_share_seek_table(&decoder, job->source);
+	if (result != MA_SUCCESS) {
+		nob_log(NOB_ERROR, "Fingerprint worker could not open `%s`: %s", job->path, ma_result_description(result));
+		return NULL;
+	}
+
+	float *samples = malloc(sizeof(float) * (ALIGN_CHUNK * ALIGN_HOP + ALIGN_FFT_SIZE));
+	if (!samples) {
+		nob_log(NOB_ERROR, "Fingerprint worker could not allocate its buffer");
+		atomic_fetch_add(&job->failed, 1);
+		ma_decoder_uninit(&decoder);
+		return NULL;
+	}
+	size_t chunk;
+	while ((chunk = atomic_fetch_add(&job->next, 1)) < job->chunks)
+		if (!align_chunk(job, &decoder, samples, chunk)) atomic_fetch_add(&job->failed, 1);
+
+	free(samples);
+	ma_decoder_uninit(&decoder);
+	return NULL;
+}
+
+// Decodes `path` to 8kHz mono and fingerprints it, chunks spread over `workers` threads.
+static uint32_t *align_fingerprint(const char *path, const AlignFft *fft, size_t workers, size_t *count) {
+	ma_decoder source;
+	ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 1, ALIGN_SAMPLE_RATE);
+	config.seekPointCount = ALIGN_SEEK_POINTS;
+	ma_result result = ma_decoder_init_file(path, &config, &source);
+	if (result != MA_SUCCESS) {
+		nob_log(NOB_ERROR, "Could not open `%s`: %s", path, ma_result_description(result));
+		return NULL;
+	}
+
+	ma_uint64 length = 0;
+	AlignJob job = { .path = path, .source = &source, .fft = fft };
+	if (ma_decoder_get_length_in_pcm_frames(&source, &length) != MA_SUCCESS || length < ALIGN_FFT_SIZE) {
+		nob_log(NOB_ERROR, "`%s` is too short to fingerprint", path);
+		ma_decoder_uninit(&source);
+		return NULL;
+	}
+	job.count = (size_t) ((length - ALIGN_FFT_SIZE) / ALIGN_HOP + 1U);
+	job.chunks = (job.count + ALIGN_CHUNK - 1UL) / ALIGN_CHUNK;
+	job.prints = malloc(sizeof(uint32_t) * job.count);
+	if (workers > job.chunks) workers = job.chunks;
+	pthread_t *threads = malloc(sizeof(pthread_t) * workers);
+	if (!job.prints || !threads) {
+		nob_log(NOB_ERROR, "Could not allocate the fingerprint of `%s`", path);
+		free(job.prints);
+		free(threads);
+		ma_decoder_uninit(&source);
+		return NULL;
+	}
+	size_t started = 0UL;
+	for (; started < workers; started++) if (pthread_create(&threads[started], NULL, align_worker, &job) != 0) break;
+	if (started == 0UL) align_worker(&job);
+	for (size_t i = 0UL; i < started; i++) pthread_join(threads[i], NULL);
+	free(threads);
+	ma_decoder_uninit(&source);
+
+	if (atomic_load(&job.next) < job.chunks || atomic_load(&job.failed)) {
+		nob_log(NOB_ERROR, "Could not fingerprint all of `%s`", path);
+		free(job.prints);
+		return NULL;
+	}
+	*count = job.count;
+	return job.prints;
+}
+
+uint32_t *align_fingerprint_file(const char *path, size_t workers, size_t *count) {
+	if (workers == 0UL) workers = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+	AlignFft *fft = malloc(sizeof(AlignFft));
+	if (!fft) {
+		nob_log(NOB_ERROR, "Could not allocate the fingerprint FFT");
+		return NULL;
+	}
+	align_fft_init(fft);
+	uint32_t *prints = align_fingerprint(path, fft, workers, count);
+	free(fft);
+	return prints;
+}
+
+// Fraction of differing bits between reference [at - ALIGN_BLOCK, at + ALIGN_BLOCK) and the target shifted by `offset`.
+static float align_bit_error_rate(const uint32_t *reference, size_t reference_count, const uint32_t *target, size_t target_count, size_t at, long offset) {
+	size_t from = at > ALIGN_BLOCK ? at - ALIGN_BLOCK : 0UL;
+	size_t to = at + ALIGN_BLOCK < reference_count ? at + ALIGN_BLOCK : reference_count;
+	if (offset < 0 && from < (size_t) -offset) from = (size_t) -offset;
+	if ((long) to + offset > (long) target_count) to = (size_t) ((long) target_count - offset);
+	if (to <= from || to - from < ALIGN_BLOCK) return 1.0f;		// not enough overlap to judge
+
+	uint64_t errors = 0;
+	for (size_t i = from; i < to; i++) errors += (uint64_t) __builtin_popcount(reference[i] ^ target[(size_t) ((long) i + offset)]);
+	return errors / (float) ((to - from) * (ALIGN_BANDS - 1));
+}
+
+static long align_search(const uint32_t *reference, size_t reference_count, const uint32_t *target, size_t target_count,
+	size_t at, long around, long reach, float *ber) {
+	long best = around;
+	*ber = 1.0f;
+	for (long offset = around - reach; offset <= around + reach; offset++) {
+		float e = align_bit_error_rate(reference, reference_count, target, target_count, at, offset);
+		if (e < *ber) {
+			*ber = e;
+			best = offset;
+		}
+	}
+	return best;
+}
+
+bool align_tracks(const char *reference_path, Tracks reference, const char *target_path, const char *output_path, size_t workers) {
+	if (reference.count == 0UL) return false;
+	if (workers == 0UL) workers = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+
+	bool result = true;
+	uint64_t start_ns = stats_now_ns();
+	AlignFft *fft = malloc(sizeof(AlignFft));
+	size_t reference_count = 0UL, target_count = 0UL;
+	uint32_t *reference_prints = NULL, *target_prints = NULL;
+	long *offsets = NULL;
+	Nob_StringBuilder out = {0};
+	Arena a = {0};
+	if (!fft) {
+		nob_log(NOB_ERROR, "Could not allocate the fingerprint FFT");
+		nob_return_defer(false);
+	}
+	align_fft_init(fft);
+	reference_prints = align_fingerprint(reference_path, fft, workers, &reference_count);
+	target_prints = reference_prints ? align_fingerprint(target_path, fft, workers, &target_count) : NULL;
+	double fingerprint_s = (stats_now_ns() - start_ns) / 1e9;
+	if (!target_prints) nob_return_defer(false);
+
+	// Offsets in fingerprints (target - reference), anchored at the start of every track.
+	offsets = malloc(sizeof(long) * reference.count);
+	if (!offsets) {
+		nob_log(NOB_ERROR, "Could not allocate the offsets of %zu tracks", reference.count);
+		nob_return_defer(false);
+	}
+	float worst = 0.0f;
+	size_t untrusted = 0UL;
+	for (size_t i = 0UL; i < reference.count; i++) {
+		size_t at = (size_t) (track_get(reference, i)->start_us * ALIGN_SAMPLE_RATE / 1000000U / ALIGN_HOP);
+		float ber;
+		long offset = i == 0UL
+			? align_search(reference_prints, reference_count, target_prints, target_count, at, 0, ALIGN_SEARCH_GLOBAL, &ber)
+			: align_search(reference_prints, reference_count, target_prints, target_count, at, offsets[i - 1UL], ALIGN_SEARCH_LOCAL, &ber);
+		if (ber > ALIGN_MAX_BER && i > 0UL) {
+			long wide = align_search(reference_prints, reference_count, target_prints, target_count, at, offsets[i - 1UL], ALIGN_SEARCH_GLOBAL, &ber);
+			if (ber <= ALIGN_MAX_BER) offset = wide;
+		}
+		if (ber > ALIGN_MAX_BER) {
+			nob_log(NOB_WARNING, "Track %zu `%s`: no confident match (%.0f%% bits differ), keeping the previous offset",
+				i + 1UL, track_get(reference, i)->title, ber * 100.0f);
+			offset = i ? offsets[i - 1UL] : offset;
+			untrusted++;
+		}
+		else if (ber > worst) worst = ber;
+		offsets[i] = offset;
+	}
+
+	// Least squares fit of offset against position: the slope is the clock drift between the rips.
+	double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+	for (size_t i = 0UL; i < reference.count; i++) {
+		double x = track_get(reference, i)->start_us / 1e6, y = offsets[i] * (double) ALIGN_HOP / ALIGN_SAMPLE_RATE;
+		sx += x, sy += y, sxx += x * x, sxy += x * y;
+	}
+	double n = (double) reference.count, denominator = n * sxx - sx * sx;
+	double drift_ppm = reference.count > 1UL && denominator != 0.0 ? (n * sxy - sx * sy) / denominator * 1e6 : 0.0;
+
+	uint32_t previous = 0;
+	for (size_t i = 0UL; i < reference.count; i++) {
+		Track *track = track_get(reference, i);
+		double seconds = track->start_us / 1e6 + offsets[i] * (double) ALIGN_HOP / ALIGN_SAMPLE_RATE;
+		uint32_t start = seconds > 0.0 ? (uint32_t) (seconds + 0.5) : 0U;
+		if (i > 0UL && start <= previous) start = previous + 1U;
+		previous = start;
+		nob_sb_append_cstr(&out, time_from_seconds(&a, start));
+		nob_sb_append_cstr(&out, "\t");
+		nob_sb_append_cstr(&out, track->title);
+		nob_sb_append_cstr(&out, "\n");
+	}
+	if (!nob_write_entire_file(output_path, out.items, out.count)) nob_return_defer(false);
+
+	double offset_s = sy / n;
+	nob_log(NOB_INFO, "Fingerprinted %zu + %zu frames in %.2fs with %zu workers", reference_count, target_count, fingerprint_s, workers);
+	nob_log(untrusted ? NOB_WARNING : NOB_INFO, "Aligned %zu/%zu tracks of `%s` to `%s`: mean offset %+.3fs, drift %+.1fppm, worst match %.0f%% bits differ, wrote `%s`",
+		reference.count - untrusted, reference.count, target_path, reference_path, offset_s, drift_ppm, worst * 100.0f, output_path);
+
+defer:
+	free(offsets);
+	free(reference_prints);
+	free(target_prints);
+	free(fft);
+	nob_sb_free(&out);
+	arena_free(&a);
+	return result;
+}
+
+#undef ALIGN_SAMPLE_RATE
+#undef ALIGN_FFT_SIZE
+#undef ALIGN_HOP
+#undef ALIGN_BANDS
+#undef ALIGN_LOW_HZ
+#undef ALIGN_HIGH_HZ
+#undef ALIGN_CHUNK
+#undef ALIGN_SEEK_POINTS
+#undef ALIGN_BLOCK
+#undef ALIGN_SEARCH_GLOBAL
+#undef ALIGN_SEARCH_LOCAL
+#undef ALIGN_MAX_BER
+#endif // ALIGN_IMPLEMENTATION
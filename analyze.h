@@ -0,0 +1,429 @@
+#ifndef ANALYZE_H_
+#define ANALYZE_H_
+#include "audio.h"
+
+// Finds track boundaries in a long recording by looking for gaps of silence, and writes a candidate
+// `.time` file with placeholder titles. The file is cut into chunks analysed in parallel, each worker
+// with its own decoder sharing one seek table, reducing every window to its mean square and peak.
+typedef struct {
+	float silence_db;		// windows below this RMS (dBFS) are silent
+	float min_gap;			// seconds of silence separating two tracks
+	size_t workers;			// 0 for one per core
+	float refine_window;	// seconds searched on each side of a boundary by `analyze_refine_tracks`
+} AnalyzeConfig;
+
+#define ANALYZE_CONFIG_DEFAULT ((AnalyzeConfig) { .silence_db = -50.0f, .min_gap = 1.5f, .workers = 0, .refine_window = 3.0f })
+
+bool analyze_tracks(const char *music_path, const char *output_path, AnalyzeConfig config);
+
+// Moves every boundary of a loaded collection to where sound resumes after the silent gap nearest to it,
+// decoding only `refine_window` seconds around each one. Results are cached next to the `.time` file
+// (`<timestamp_path>.refined`), keyed on both files' size and nanosecond mtime, so later loads just read them back.
+bool analyze_refine_tracks(MusicCollection *music, const char *timestamp_path, AnalyzeConfig config);
+
+#endif // ANALYZE_H_
+
+#ifdef ANALYZE_IMPLEMENTATION
+#undef ANALYZE_IMPLEMENTATION
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ANALYZE_WINDOWS_PER_SECOND	50			// 20ms windows
+#define ANALYZE_CHUNK_WINDOWS		(1<<11)		// ~41s of audio per job
+#define ANALYZE_READ_WINDOWS		64			// windows decoded per read
+#define ANALYZE_SEEK_POINTS			(1<<12)
+#define ANALYZE_LANES				8
+#define ANALYZE_CREST_DB			20.0f		// a silent window may still have clicks this far above its RMS
+#define ANALYZE_REFINE_PER_SECOND	200			// 5ms windows around boundaries
+#define ANALYZE_REFINE_MIN_RUN		20			// windows, 100ms: shorter dips are not a gap
+#define ANALYZE_CACHE_MAGIC			"mstamp-refine 1"
+
+typedef float AnalyzeVec __attribute__((vector_size(ANALYZE_LANES * sizeof(float))));
+typedef int32_t AnalyzeMask __attribute__((vector_size(ANALYZE_LANES * sizeof(int32_t))));
+
+typedef struct {
+	const char *music_path;
+	ma_decoder *source;			// owns the seek table
+	ma_uint32 channels;
+	ma_uint32 window;			// frames per window
+	size_t windows;
+	size_t chunks;
+	float *mean_square;			// per window, over all channels
+	float *peak_square;
+	atomic_size_t next;
+	atomic_size_t failed;
+} AnalyzeJob;
+
+// Sum of squares and largest square over `count` samples. Written with vector extensions so the
+// compiler emits SSE/AVX/NEON for whatever the target has, 8 lanes at a time.
+static void analyze_energy(const float *samples, size_t count, float *sum, float *peak) {
+	AnalyzeVec acc = {0}, max = {0};
+	size_t i = 0UL;
+	for (; i + ANALYZE_LANES <= count; i += ANALYZE_LANES) {
+		AnalyzeVec v;
+		memcpy(&v, samples + i, sizeof(v));
+		AnalyzeVec sq = v * v;
+		acc += sq;
+		AnalyzeMask greater = sq > max;
+		max = (AnalyzeVec) (((AnalyzeMask) sq & greater) | ((AnalyzeMask) max & ~greater));
+	}
+
+	float s = 0.0f, m = 0.0f;
+	for (int lane = 0; lane < ANALYZE_LANES; lane++) {
+		s += acc[lane];
+		if (max[lane] > m) m = max[lane];
+	}
+	for (; i < count; i++) {
+		float sq = samples[i] * samples[i];
+		s += sq;
+		if (sq > m) m = sq;
+	}
+	*sum = s;
+	*peak = m;
+}
+
+typedef struct {
+	float mean_square;
+	float peak_square;
+} AnalyzeSilence;
+
+static AnalyzeSilence analyze_silence(float silence_db) {
+	return (AnalyzeSilence) {
+		.mean_square = powf(10.0f, silence_db / 10.0f),
+		.peak_square = powf(10.0f, (silence_db + ANALYZE_CREST_DB) / 10.0f),
+	};
+}
+
+static inline bool analyze_is_silent(float mean_square, float peak_square, AnalyzeSilence silence) {
+	return mean_square < silence.mean_square && peak_square < silence.peak_square;
+}
+
+static bool analyze_chunk(AnalyzeJob *job, ma_decoder *decoder, float *buffer, size_t chunk) {
+	size_t first = chunk * ANALYZE_CHUNK_WINDOWS;
+	size_t last = first + ANALYZE_CHUNK_WINDOWS < job->windows ? first + ANALYZE_CHUNK_WINDOWS : job->windows;
+	ma_result result = ma_decoder_seek_to_pcm_frame(decoder, (ma_uint64) first * job->window);
+	if (result != MA_SUCCESS) return false;
+
+	for (size_t w = first; w < last; ) {
+		size_t batch = last - w < ANALYZE_READ_WINDOWS ? last - w : ANALYZE_READ_WINDOWS;
+		ma_uint64 read = 0;
+		result = ma_decoder_read_pcm_frames(decoder, buffer, batch * job->window, &read);
+		if (read == 0) return result == MA_AT_END;
+
+		for (size_t i = 0UL; i < batch && i * job->window < read; i++, w++) {
+			ma_uint64 frames = read - i * job->window < job->window ? read - i * job->window : job->window;
+			float sum, peak;
+			analyze_energy(buffer + i * job->window * job->channels, frames * job->channels, &sum, &peak);
+			job->mean_square[w] = sum / (float) (frames * job->channels);
+			job->peak_square[w] = peak;
+		}
+		if (read < batch * job->window) return true;
+	}
+	return true;
+}
+
+static void *analyze_worker(void *arg) {
+	AnalyzeJob *job = arg;
+
+	ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 0, 0);
+	ma_decoder decoder;
+	ma_result result = ma_decoder_init_file(job->music_path, &config, &decoder);
+	if (result == MA_SUCCESS) result = audio_decoder_share_seek_table(&decoder, job->source);
+	if (result != MA_SUCCESS) {
+		nob_log(NOB_ERROR, "Analysis worker could not open `%s`: %s", job->music_path, ma_result_description(result));
+		return NULL;
+	}
+
+	float *buffer = malloc(sizeof(float) * ANALYZE_READ_WINDOWS * job->window * job->channels);
+	if (!buffer) {
+		nob_log(NOB_ERROR, "Analysis worker could not allocate its buffer");
+		atomic_fetch_add(&job->failed, 1);
+		ma_decoder_uninit(&decoder);
+		return NULL;
+	}
+	size_t chunk;
+	while ((chunk = atomic_fetch_add(&job->next, 1)) < job->chunks)
+		if (!analyze_chunk(job, &decoder, buffer, chunk)) atomic_fetch_add(&job->failed, 1);
+
+	free(buffer);
+	ma_decoder_uninit(&decoder);
+	return NULL;
+}
+
+// A new track starts wherever a silent run of at least `min_gap` ends. Leading silence belongs to the
+// first track and trailing silence to the last, so they never start one.
+static void analyze_find_tracks(const AnalyzeJob *job, AnalyzeConfig config, Arena *a, Nob_StringBuilder *out) {
+	AnalyzeSilence silence = analyze_silence(config.silence_db);
+	size_t min_windows = (size_t) (config.min_gap * ANALYZE_WINDOWS_PER_SECOND);
+	if (min_windows == 0UL) min_windows = 1UL;
+
+	size_t count = 0UL, run = 0UL;
+	bool heard = false;
+	nob_sb_append_cstr(out, time_from_seconds(a, 0));
+	nob_sb_append_cstr(out, "\tTrack 1\n");
+	count++;
+	for (size_t w = 0UL; w < job->windows; w++) {
+		if (analyze_is_silent(job->mean_square[w], job->peak_square[w], silence)) {
+			run++;
+			continue;
+		}
+		if (heard && run >= min_windows) {
+			uint32_t seconds = (uint32_t) (w / ANALYZE_WINDOWS_PER_SECOND);		// .time is whole seconds, round early
+			char title[32];
+			snprintf(title, sizeof(title), "\tTrack %zu\n", ++count);
+			nob_sb_append_cstr(out, time_from_seconds(a, seconds));
+			nob_sb_append_cstr(out, title);
+		}
+		heard = true;
+		run = 0UL;
+	}
+}
+
+bool analyze_tracks(const char *music_path, const char *output_path, AnalyzeConfig config) {
+	bool result = true;
+	ma_decoder source;
+	AnalyzeJob job = { .music_path = music_path, .source = &source };
+	pthread_t *threads = NULL;
+	Nob_StringBuilder out = {0};
+	Arena a = {0};
+
+	uint64_t start_ns = stats_now_ns();
+	ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_f32, 0, 0);
+	decoder_config.seekPointCount = ANALYZE_SEEK_POINTS;
+	ma_result ma = ma_decoder_init_file(music_path, &decoder_config, &source);
+	if (ma != MA_SUCCESS) {
+		nob_log(NOB_ERROR, "Could not open `%s`: %s", music_path, ma_result_description(ma));
+		return false;
+	}
+
+	ma_uint32 sample_rate;
+	ma_uint64 length = 0;
+	ma_data_source_get_data_format(&source, NULL, &job.channels, &sample_rate, NULL, 0);
+	if ((ma = ma_decoder_get_length_in_pcm_frames(&source, &length)) != MA_SUCCESS || length == 0) {
+		nob_log(NOB_ERROR, "Could not get the length of `%s`: %s", music_path, ma_result_description(ma));
+		nob_return_defer(false);
+	}
+	job.window = sample_rate / ANALYZE_WINDOWS_PER_SECOND;
+	job.windows = (size_t) ((length + job.window - 1) / job.window);
+	job.chunks = (job.windows + ANALYZE_CHUNK_WINDOWS - 1) / ANALYZE_CHUNK_WINDOWS;
+	job.mean_square = calloc(job.windows, sizeof(float));
+	job.peak_square = calloc(job.windows, sizeof(float));
+
+	size_t workers = config.workers ? config.workers : (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers > job.chunks) workers = job.chunks;
+	threads = malloc(sizeof(pthread_t) * workers);
+	if (!job.mean_square || !job.peak_square || !threads) {
+		nob_log(NOB_ERROR, "Could not allocate the analysis of `%s` (%zu windows)", music_path, job.windows);
+		nob_return_defer(false);
+	}
+	size_t started = 0UL;
+	for (; started < workers; started++) if (pthread_create(&threads[started], NULL, analyze_worker, &job) != 0) break;
+	if (started == 0UL) analyze_worker(&job);
+	for (size_t i = 0UL; i < started; i++) pthread_join(threads[i], NULL);
+	if (atomic_load(&job.next) < job.chunks || atomic_load(&job.failed)) {
+		nob_log(NOB_ERROR, "Could not analyse all of `%s`", music_path);
+		nob_return_defer(false);
+	}
+
+	analyze_find_tracks(&job, config, &a, &out);
+	if (!nob_write_entire_file(output_path, out.items, out.count)) nob_return_defer(false);
+
+	double seconds = (stats_now_ns() - start_ns) / 1e9;
+	double audio_seconds = length / (double) sample_rate;
+	size_t tracks = 0UL;
+	for (size_t i = 0UL; i < out.count; i++) tracks += out.items[i] == '\n';
+	nob_log(NOB_INFO, "Found %zu tracks in `%s` (%s of audio) with %zu workers in %.2fs = %.0fx realtime, wrote `%s`",
+		tracks, music_path, time_from_seconds(&a, (uint32_t) audio_seconds), started ? started : 1UL,
+		seconds, audio_seconds / (seconds > 0.0 ? seconds : 1e-9), output_path);
+
+defer:
+	free(threads);
+	free(job.mean_square);
+	free(job.peak_square);
+	nob_sb_free(&out);
+	arena_free(&a);
+	ma_decoder_uninit(&source);
+	return result;
+}
+
+typedef struct {
+	ma_decoder decoder;
+	ma_uint32 channels;
+	ma_uint32 sample_rate;
+	ma_uint32 window;			// frames per window
+	size_t windows;				// per boundary
+	float *buffer;
+	float *mean_square;
+	float *peak_square;
+} AnalyzeRefiner;
+
+// Frame where sound resumes after the silent run closest to `nominal`, or `nominal` when there is none.
+static uint64_t analyze_refine_boundary(AnalyzeRefiner *r, uint64_t nominal, uint64_t length, AnalyzeConfig config) {
+	uint64_t reach = (uint64_t) r->windows / 2U * r->window;
+	uint64_t from = nominal > reach ? nominal - reach : 0U;
+	if (ma_decoder_seek_to_pcm_frame(&r->decoder, from) != MA_SUCCESS) return nominal;
+
+	size_t windows = 0UL;
+	while (windows < r->windows && from + (uint64_t) windows * r->window < length) {
+		size_t batch = r->windows - windows < ANALYZE_READ_WINDOWS ? r->windows - windows : ANALYZE_READ_WINDOWS;
+		ma_uint64 read = 0;
+		ma_decoder_read_pcm_frames(&r->decoder, r->buffer, batch * r->window, &read);
+		size_t full = (size_t) (read / r->window);
+		for (size_t i = 0UL; i < full; i++, windows++) {
+			float sum;
+			analyze_energy(r->buffer + i * r->window * r->channels, r->window * r->channels, &sum, &r->peak_square[windows]);
+			r->mean_square[windows] = sum / (float) (r->window * r->channels);
+		}
+		if (full < batch) break;
+	}
+
+	AnalyzeSilence silence = analyze_silence(config.silence_db);
+	uint64_t best = nominal, best_distance = UINT64_MAX;
+	size_t run = 0UL;
+	for (size_t w = 0UL; w < windows; w++) {
+		if (analyze_is_silent(r->mean_square[w], r->peak_square[w], silence)) {
+			run++;
+			continue;
+		}
+		uint64_t frame = from + (uint64_t) w * r->window;
+		uint64_t distance = frame > nominal ? frame - nominal : nominal - frame;
+		if (run >= ANALYZE_REFINE_MIN_RUN && distance < best_distance) {
+			best = frame;
+			best_distance = distance;
+		}
+		run = 0UL;
+	}
+	return best;
+}
+
+static void analyze_cache_key(const char *music_path, const char *timestamp_path, AnalyzeConfig config, char *key, size_t size) {
+	struct stat music = {0}, stamps = {0};
+	stat(music_path, &music);
+	stat(timestamp_path, &stamps);
+	snprintf(key, size, ANALYZE_CACHE_MAGIC " %lld %lld %lld %lld %.3f %.1f", (long long) music.st_size, file_mtime_ns(&music),
+		(long long) stamps.st_size, file_mtime_ns(&stamps), config.refine_window, config.silence_db);
+}
+
+static bool analyze_cache_load(const char *cache_path, const char *key, Tracks tracks) {
+	Nob_StringBuilder sb = {0};
+	if (!nob_file_exists(cache_path) || !nob_read_entire_file(cache_path, &sb)) return false;
+	nob_sb_append_null(&sb);
+
+	// Parsed aside first: a short or truncated cache must leave every boundary as it was.
+	bool ok = false;
+	size_t key_size = strlen(key);
+	char *at = sb.items + key_size;
+	uint64_t *bounds = malloc(sizeof(uint64_t) * 2UL * tracks.count);
+	if (bounds && sb.count > key_size && memcmp(sb.items, key, key_size) == 0 && *at == '\n') {
+		size_t i = 0UL;
+		for (; i < tracks.count; i++) {
+			char *end;
+			bounds[2UL * i] = strtoull(at, &end, 10);
+			if (end == at) break;
+			bounds[2UL * i + 1UL] = strtoull(at = end, &end, 10);
+			if (end == at) break;
+			at = end;
+		}
+		ok = i == tracks.count;
+	}
+	for (size_t i = 0UL; ok && i < tracks.count; i++) {
+		tracks.items[i].start_us = bounds[2UL * i];
+		tracks.items[i].stop_us = bounds[2UL * i + 1UL];
+	}
+	free(bounds);
+	nob_sb_free(&sb);
+	return ok;
+}
+
+static void analyze_cache_save(const char *cache_path, const char *key, Tracks tracks) {
+	Nob_StringBuilder sb = {0};
+	nob_sb_append_cstr(&sb, key);
+	nob_sb_append_cstr(&sb, "\n");
+	for (size_t i = 0UL; i < tracks.count; i++) {
+		char line[64];
+		snprintf(line, sizeof(line), "%llu %llu\n", (unsigned long long) tracks.items[i].start_us, (unsigned long long) tracks.items[i].stop_us);
+		nob_sb_append_cstr(&sb, line);
+	}
+	if (!nob_write_entire_file(cache_path, sb.items, sb.count)) nob_log(NOB_WARNING, "Could not cache refined boundaries in `%s`", cache_path);
+	nob_sb_free(&sb);
+}
+
+bool analyze_refine_tracks(MusicCollection *music, const char *timestamp_path, AnalyzeConfig config) {
+	if (music->tracks.count < 2UL || config.refine_window <= 0.0f) return true;
+
+	char key[256], cache_path[PATH_MAX];
+	snprintf(cache_path, sizeof(cache_path), "%s.refined", timestamp_path);
+	analyze_cache_key(music->path, timestamp_path, config, key, sizeof(key));
+	if (analyze_cache_load(cache_path, key, music->tracks)) {
+		nob_log(NOB_INFO, "Loaded refined boundaries from `%s`", cache_path);
+		return true;
+	}
+
+	uint64_t start_ns = stats_now_ns();
+	AnalyzeRefiner r = {0};
+	ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_f32, 0, 0);
+	ma_result ma = ma_decoder_init_file(music->path, &decoder_config, &r.decoder);
+	if (ma == MA_SUCCESS) ma = audio_decoder_share_seek_table(&r.decoder, &music->decoder);
+	if (ma != MA_SUCCESS) {
+		nob_log(NOB_ERROR, "Could not open `%s` to refine its boundaries: %s", music->path, ma_result_description(ma));
+		ma_decoder_uninit(&r.decoder);
+		return false;
+	}
+	ma_data_source_get_data_format(&r.decoder, NULL, &r.channels, &r.sample_rate, NULL, 0);
+	r.window = r.sample_rate / ANALYZE_REFINE_PER_SECOND;
+	r.windows = 2UL * (size_t) (config.refine_window * ANALYZE_REFINE_PER_SECOND);
+	r.buffer = malloc(sizeof(float) * ANALYZE_READ_WINDOWS * r.window * r.channels);
+	r.mean_square = malloc(sizeof(float) * r.windows);
+	r.peak_square = malloc(sizeof(float) * r.windows);
+	if (!r.buffer || !r.mean_square || !r.peak_square) {
+		nob_log(NOB_ERROR, "Could not allocate the buffers to refine `%s`", music->path);
+		free(r.buffer);
+		free(r.mean_square);
+		free(r.peak_square);
+		ma_decoder_uninit(&r.decoder);
+		return false;
+	}
+
+	uint64_t length = track_stop_frame(track_get_last(music->tracks), r.sample_rate);
+	size_t moved = 0UL;
+	uint64_t furthest_us = 0U;
+	for (size_t i = 1UL; i < music->tracks.count; i++) {
+		Track *prev = track_get(music->tracks, i - 1UL), *track = track_get(music->tracks, i);
+		uint64_t frame = analyze_refine_boundary(&r, track_start_frame(track, r.sample_rate), length, config);
+		uint64_t us = frame * 1000000U / r.sample_rate;
+		if (frame == track_start_frame(track, r.sample_rate)) continue;
+		// Never let a boundary cross its neighbours, whatever the audio around it looks like.
+		if (us <= prev->start_us || (i + 1UL < music->tracks.count && us >= track->stop_us)) continue;
+
+		uint64_t shift = us > track->start_us ? us - track->start_us : track->start_us - us;
+		if (shift > furthest_us) furthest_us = shift;
+		moved++;
+		track->start_us = prev->stop_us = us;
+	}
+
+	double ms = (stats_now_ns() - start_ns) / 1e6;
+	nob_log(NOB_INFO, "Refined boundaries of `%s`: moved %zu/%zu by up to %.0fms in %.1fms (%.2fms per boundary)", music->path,
+		moved, music->tracks.count - 1UL, furthest_us / 1e3, ms, ms / (double) (music->tracks.count - 1UL));
+	analyze_cache_save(cache_path, key, music->tracks);
+
+	free(r.buffer);
+	free(r.mean_square);
+	free(r.peak_square);
+	ma_decoder_uninit(&r.decoder);
+	return true;
+}
+
+#undef ANALYZE_WINDOWS_PER_SECOND
+#undef ANALYZE_CHUNK_WINDOWS
+#undef ANALYZE_READ_WINDOWS
+#undef ANALYZE_SEEK_POINTS
+#undef ANALYZE_LANES
+#undef ANALYZE_CREST_DB
+#undef ANALYZE_REFINE_PER_SECOND
+#undef ANALYZE_REFINE_MIN_RUN
+#undef ANALYZE_CACHE_MAGIC
+#endif // ANALYZE_IMPLEMENTATION
@@ -1,23 +1,152 @@
 #ifndef AUDIO_H_
 #define AUDIO_H_
 #include "tracks.h"
+#include "realtime.h"
+#include "rtcheck.h"
+#include "stats.h"
+#include "trace.h"
+#include "mapvfs.h"
+#include <arena.h>
 #include <miniaudio.h>
 
+// A player: device, decoder config, the ring between the decoder thread and the callback, the selected
+// track, callback stats, tap and sink, and the collections `mstamp_load` opened, in their own arena. An
+// engine keeps all of its state behind the handle, so any number can play side by side in one process.
+// Drive each from one control thread; the callback and the decoder thread are the engine's own.
+typedef struct MstampEngine MstampEngine;
+
+typedef struct {
+	Realtime realtime;		// REALTIME_DEFAULT for none
+	bool headless;			// null backend: the callback is driven at realtime pace with no sound card
+	bool offline;			// decoding only, for rendering to files: no device, ring or decoder thread
+	bool stdio;				// decoders read the file through stdio instead of mapping it (mapvfs.h)
+} MstampEngineConfig;
+#define MSTAMP_ENGINE_CONFIG_DEFAULT ((MstampEngineConfig) { .realtime = REALTIME_DEFAULT })
+
 typedef struct {
+	const char *path;
 	Tracks tracks;
 	ma_decoder decoder;
+	MapVfsFile *file;		// what `decoder` reads through, NULL when the engine reads through stdio
+	MstampEngine *engine;	// whose decoder config it was opened with
 } MusicCollection;
 
+// What `play_callback` hands to the device, to one more consumer called by the callback itself, so it must
+// not block, allocate or fault. `track` is set on the first frames after the output jumps (select, seek,
+// restart), NULL otherwise.
+typedef void (*AudioSink)(const float *frames, size_t count, const Track *track, size_t index, void *user);
+
+ma_result mstamp_engine_create(const MstampEngineConfig *config, MstampEngine **engine);		// paused
+void mstamp_engine_destroy(MstampEngine *engine);
+ma_uint32 mstamp_sample_rate(MstampEngine *engine);
+
+bool mstamp_unpause(MstampEngine *engine);
+bool mstamp_pause(MstampEngine *engine);
+void mstamp_restart(MstampEngine *engine);
+bool mstamp_is_paused(MstampEngine *engine);
+void mstamp_seek(MstampEngine *engine, double seconds);		// relative to what is being heard, clamped to the track
+void mstamp_set_looping(MstampEngine *engine, bool looping);	// of the current track and every one selected after
+bool mstamp_is_looping(MstampEngine *engine);
+size_t mstamp_current_index(MstampEngine *engine);
+bool mstamp_position(MstampEngine *engine, double *seconds, double *length);		// of what is being heard, in the current track
+bool mstamp_track_ended(MstampEngine *engine);				// not looping, and the last frame has been played
+
+CallbackStatsSnapshot mstamp_stats(MstampEngine *engine);
+void mstamp_reset_stats(MstampEngine *engine);
+void mstamp_log_stats(MstampEngine *engine);
+
+ma_result mstamp_decoder_open(MstampEngine *engine, const char *music_path, ma_decoder *decoder);
+ma_result mstamp_decoder_build_seek_table(MstampEngine *engine, ma_decoder *decoder);
+ma_result audio_decoder_share_seek_table(ma_decoder *decoder, ma_decoder *from);
+// Into the engine's arena; unloaded by `mstamp_engine_destroy` unless `mstamp_unload_tracks` came first.
+MusicCollection *mstamp_load(MstampEngine *engine, const char *music_path, const char *timestamp_path);
+bool mstamp_load_tracks(MstampEngine *engine, Arena *a, MusicCollection *music, const char *music_path, const char *timestamp_path);
+void mstamp_unload_tracks(MstampEngine *engine, MusicCollection *music);
+bool mstamp_select_track(MstampEngine *engine, MusicCollection *music, size_t index);		// false for no such track
+bool mstamp_render(MstampEngine *engine, MusicCollection *music, size_t index, const char *output_path);
+
+// The callback copies its output into a ring and never waits on a reader, so one that falls behind just
+// sees its frames overwritten, and `mstamp_tap_read` says so. Enable after creating the engine; returns the
+// device sample rate, 0 on failure. The ring lives as long as the engine.
+ma_uint32 mstamp_tap_enable(MstampEngine *engine, size_t frames);
+bool mstamp_tap_read(MstampEngine *engine, float *out, size_t frames);		// the latest `frames` interleaved frames
+// In order instead, for streaming: up to `frames` after `*position` (frames since the tap was enabled),
+// which it advances. A reader the callback lapped is moved up to what is still there, and `*skipped` says
+// by how much. Returns the frames copied.
+size_t mstamp_tap_read_next(MstampEngine *engine, uint64_t *position, float *out, size_t frames, uint64_t *skipped);
+uint64_t mstamp_tap_position(MstampEngine *engine);		// where a reader starting now is
+// Set it before `mstamp_unpause`; what `user` points to must outlive the engine.
+void mstamp_set_sink(MstampEngine *engine, AudioSink sink, void *user);
+
+// Sample-accurate playback events. The decoder thread notes where in the ring each one falls, the callback
+// stamps it with its output frame and time as that frame goes out and queues it without waiting, and a
+// dispatcher thread of the engine's own calls the handler with it, in order. An event whose frames are
+// dropped by a select, seek or restart before they play never fires.
+typedef enum {
+	MSTAMP_EVENT_TRACK_START,	// the first frame of a selected track
+	MSTAMP_EVENT_TRACK_LOOP,	// the track wrapped around to its first frame
+	MSTAMP_EVENT_TRACK_END,		// its last frame, when not looping
+	MSTAMP_EVENT_SEEK,			// the first frame after a seek or restart
+	MSTAMP_EVENT_MARKER,		// a marker's frame
+} MstampEventKind;
+
+typedef struct {
+	MstampEventKind kind;
+	uint32_t marker;		// MSTAMP_EVENT_MARKER: the id it was added with
+	size_t track;			// index in the collection
+	uint64_t track_frame;	// where it happened, in frames from the track's start
+	uint64_t output_frame;	// the same frame, counted in everything the engine has handed to the device
+	uint64_t time_ns;		// CLOCK_MONOTONIC when the callback handed that frame to the device
+} MstampEvent;
+
+// Runs on the dispatcher thread. It may drive the engine (select, seek, pause), but not set the handler.
+typedef void (*MstampEventHandler)(const MstampEvent *event, void *user);
+// Starts the dispatcher, or stops it with NULL. False if the thread could not start.
+bool mstamp_set_event_handler(MstampEngine *engine, MstampEventHandler handler, void *user);
+// MSTAMP_EVENT_MARKER with `id` when the frame `seconds` into `track` plays; any number per track.
+void mstamp_add_marker(MstampEngine *engine, size_t track, double seconds, uint32_t id);
+void mstamp_clear_markers(MstampEngine *engine);
+uint64_t mstamp_events_dropped(MstampEngine *engine);		// the handler fell a queue behind
+
+#ifndef MSTAMP_LIBRARY
+// The player's own engine, for main.c and the modules around it. `audio_init` also blocks SIGUSR1 in the
+// calling thread and starts a thread that logs the callback stats on it.
+void audio_set_realtime(Realtime rt);
+void audio_set_headless(bool headless);
 ma_result audio_init();
+ma_result audio_init_offline();
 void audio_deinit();
+ma_uint32 audio_sample_rate();
 
 bool audio_unpause();
 bool audio_pause();
 void audio_restart();
+bool audio_is_paused();
+void audio_seek(double seconds);
+void audio_set_looping(bool looping);
+bool audio_is_looping();
+size_t audio_current_index();
+bool audio_position(double *seconds, double *length);
+bool audio_track_ended();
+
+CallbackStatsSnapshot audio_stats();
+void audio_reset_stats();
+void audio_log_stats();
 
-MusicCollection audio_load_tracks(Arena *a, const char *music_path, const char *timestamp_path);
+ma_result audio_decoder_open(const char *music_path, ma_decoder *decoder);
+ma_result audio_decoder_build_seek_table(ma_decoder *decoder);
+bool audio_load_tracks(Arena *a, MusicCollection *music, const char *music_path, const char *timestamp_path);
 void audio_unload_tracks(MusicCollection *music);
-void audio_select_track(MusicCollection *music, size_t index);
+bool audio_select_track(MusicCollection *music, size_t index);
+bool audio_render(MusicCollection *music, size_t index, const char *output_path);
+
+ma_uint32 audio_tap_enable(size_t frames);
+bool audio_tap_read(float *out, size_t frames);
+size_t audio_tap_read_next(uint64_t *position, float *out, size_t frames, uint64_t *skipped);
+uint64_t audio_tap_position();
+void audio_set_sink(AudioSink sink, void *user);
+bool audio_set_event_handler(MstampEventHandler handler, void *user);
+#endif // MSTAMP_LIBRARY
 
 #endif // AUDIO_H_
 
@@ -25,13 +154,142 @@ void audio_select_track(MusicCollection *music, size_t index);
 #undef AUDIO_IMPLEMENTATION
 #define TRACKS_IMPLEMENTATION
 #include "tracks.h"
+#define REALTIME_IMPLEMENTATION
+#include "realtime.h"
+#define RTCHECK_IMPLEMENTATION
+#include "rtcheck.h"
+#define STATS_IMPLEMENTATION
+#include "stats.h"
+#define TRACE_IMPLEMENTATION
+#include "trace.h"
+#define MAPVFS_IMPLEMENTATION
+#include "mapvfs.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#ifdef __APPLE__
+#include <dispatch/dispatch.h>
+typedef dispatch_semaphore_t AudioSemaphore;
+#else
+#include <semaphore.h>
+typedef sem_t AudioSemaphore;
+#endif
 
 void play_callback(ma_device *pDevice, void *pOutput, const void *pInput, ma_uint32 frameCount);
+static void *decoder_thread(void *arg);
+
+#define AUDIO_MARKS		256		// a power of two
+#define AUDIO_EVENTS	256		// a power of two
+#define SELECT_PREFETCH	(1<<20)	// bytes read ahead of the decoder thread on a select
+
+typedef struct {
+	uint64_t ring_frame;		// the frame it falls on
+	MstampEvent event;			// all but the output frame and time, which the callback adds
+} AudioMark;
+
+typedef struct {
+	size_t track;
+	uint64_t frame;
+	uint32_t id;
+} AudioMarker;
+
+// Decoding happens on `decoder_thread`, which keeps `playback_rb` topped up;
+// `play_callback` only copies out of the ring. `decoder_mutex` guards the decoder
+// against the control thread (select/restart), never taken by the callback.
+struct MstampEngine {
+	Realtime realtime;
+	RealtimeStatus realtime_status;
+	bool headless;
+	bool offline;
+	bool stdio;
+	bool context_ready;
+	ma_decoder_config decoder_config;
+	MapVfs vfs;
+#ifdef MSTAMP_RTCHECK
+	ma_allocation_callbacks rtcheck_inner_callbacks;
+#endif
+	ma_context context;
+	ma_device device;
+	Track *current_track;
+	MusicCollection *current_music;
+	size_t current_index;
+	bool current_looping;
+
+	ma_pcm_rb playback_rb;
+	void *playback_buffer;
+	size_t playback_buffer_size;
+	pthread_t decoder_tid;
+	pthread_mutex_t decoder_mutex;
+	atomic_bool decoder_running;
+	atomic_bool decoder_promoted;
+	atomic_bool playback_flush;			// set by control thread, cleared by callback once stale frames are dropped
+	atomic_bool playback_drained;		// a non-looping track has been decoded to its end: silence is no underrun
+	AudioSemaphore decoder_wakeup;
+	CallbackStats callback_stats;
+	atomic_bool first_callback;
+	atomic_bool callback_resumed;		// set on every device start: the gap since the last callback is the pause
+	_Atomic float playback_gain;		// linear, of the selected track; applied by the callback
+	_Atomic(float *) tap_samples;		// published once `tap_capacity` is set
+	size_t tap_capacity;				// frames, a power of two
+	atomic_uint_fast64_t tap_claimed;	// frames the callback has started to write, seqlock style
+	atomic_uint_fast64_t tap_written;	// frames it has finished writing
+	_Atomic(AudioSink) output_sink;		// published after `output_sink_user`
+	void *output_sink_user;
+	bool output_sink_jump;				// the callback's own: a jump not yet handed to the sink with frames
+	size_t output_sink_index;			// the callback's own: the track it last handed to the sink
+	uint64_t output_sink_sequence;		// the callback's own: `sink_sequence` it last read intact
+	// The selected track for the sink, seqlock style: written under `decoder_mutex` with every flush, read
+	// by the callback, which never waits for a writer but leaves the jump pending for the next period.
+	atomic_uint_fast64_t sink_sequence;
+	_Atomic(const Track *) sink_track;
+	atomic_size_t sink_index;
 
-static ma_decoder_config decoder_config = {0};
-static ma_device device = {0};
-static Track *current_track = NULL;
-static MusicCollection *current_music = NULL;
+	// Events: `marks` go from the decoder thread to the callback, `events` from the callback to the
+	// dispatcher, both single producer single consumer. Ring frames count everything ever committed to
+	// `playback_rb` (`ring_written`, decoder thread) and read or dropped from it (`ring_read`, callback).
+	AudioMark marks[AUDIO_MARKS];
+	atomic_size_t marks_head;
+	atomic_size_t marks_tail;
+	MstampEvent events[AUDIO_EVENTS];
+	atomic_size_t events_head;
+	atomic_size_t events_tail;
+	atomic_uint_fast64_t events_dropped;
+	uint64_t ring_written;
+	uint64_t ring_read;
+	uint64_t output_frames;				// the callback's own
+	atomic_bool events_on;				// a handler is set: the decoder thread notes marks
+	bool jump_pending;					// under `decoder_mutex`: the next frames decoded start `jump_kind`
+	MstampEventKind jump_kind;
+	struct {
+		AudioMarker *items;				// sorted by track, then frame
+		size_t count;
+		size_t capacity;
+	} markers;
+	MstampEventHandler event_handler;
+	void *event_user;
+	pthread_t dispatcher_tid;
+	atomic_bool dispatcher_running;
+	AudioSemaphore dispatcher_wakeup;
+
+	Arena arena;
+	struct {
+		MusicCollection **items;
+		size_t count;
+		size_t capacity;
+	} loaded;
+};
+
+#ifdef __APPLE__
+#define audio_semaphore_init(s) ((*(s) = dispatch_semaphore_create(0)) != NULL)
+#define audio_semaphore_post(s) dispatch_semaphore_signal(*(s))
+#define audio_semaphore_wait(s) dispatch_semaphore_wait(*(s), DISPATCH_TIME_FOREVER)
+#define audio_semaphore_destroy(s) dispatch_release(*(s))
+#else
+#define audio_semaphore_init(s) (sem_init((s), 0, 0) == 0)
+#define audio_semaphore_post(s) sem_post(s)
+#define audio_semaphore_wait(s) while (sem_wait(s) != 0 && errno == EINTR)
+#define audio_semaphore_destroy(s) sem_destroy(s)
+#endif
 
 
 
@@ -46,9 +304,105 @@ static MusicCollection *current_music = NULL;
 #define CHANNEL_COUNT	2
 #define SAMPLE_RATE		48000
 #define CHUNK_SIZE		(1<<11)
-ma_result audio_init() {
-	ma_result result;
+#define RING_CHUNKS		4
+
+// Decoder allocations go through here in realtime mode so they get locked too.
+// Pages are never unlocked on free: neighbouring allocations may still share them.
+static void *realtime_malloc(size_t sz, void *user) {
+	void *p = malloc(sz);
+	if (p) realtime_lock_memory(user, p, sz);
+	return p;
+}
+
+static void *realtime_realloc(void *p, size_t sz, void *user) {
+	p = realloc(p, sz);
+	if (p) realtime_lock_memory(user, p, sz);
+	return p;
+}
+
+static void realtime_free(void *p, void *user) {
+	NOB_UNUSED(user);
+	free(p);
+}
+
+#ifdef MSTAMP_RTCHECK
+// Names miniaudio's own allocations in violations, before they reach the wrapped malloc.
+static void *rtcheck_ma_malloc(size_t sz, void *user) {
+	MstampEngine *e = user;
+	rtcheck_assert("ma_malloc");
+	return e->rtcheck_inner_callbacks.onMalloc ? e->rtcheck_inner_callbacks.onMalloc(sz, e->rtcheck_inner_callbacks.pUserData) : malloc(sz);
+}
+
+static void *rtcheck_ma_realloc(void *p, size_t sz, void *user) {
+	MstampEngine *e = user;
+	rtcheck_assert("ma_realloc");
+	return e->rtcheck_inner_callbacks.onRealloc ? e->rtcheck_inner_callbacks.onRealloc(p, sz, e->rtcheck_inner_callbacks.pUserData) : realloc(p, sz);
+}
+
+static void rtcheck_ma_free(void *p, void *user) {
+	MstampEngine *e = user;
+	rtcheck_assert("ma_free");
+	if (e->rtcheck_inner_callbacks.onFree) e->rtcheck_inner_callbacks.onFree(p, e->rtcheck_inner_callbacks.pUserData);
+	else free(p);
+}
+#endif // MSTAMP_RTCHECK
+
+static void audio_decoder_config_init(MstampEngine *e) {
+	e->decoder_config = ma_decoder_config_init(SAMPLE_FORMAT, CHANNEL_COUNT, SAMPLE_RATE);
+	e->decoder_config.seekPointCount = 1<<10;	// seek table to avoid reading from the beggining
+	if (e->realtime.enabled) {
+		e->decoder_config.allocationCallbacks = (ma_allocation_callbacks) {
+			.pUserData = &e->realtime_status,
+			.onMalloc = realtime_malloc,
+			.onRealloc = realtime_realloc,
+			.onFree = realtime_free,
+		};
+	}
+#ifdef MSTAMP_RTCHECK
+	e->rtcheck_inner_callbacks = e->decoder_config.allocationCallbacks;
+	e->decoder_config.allocationCallbacks = (ma_allocation_callbacks) {
+		.pUserData = e,
+		.onMalloc = rtcheck_ma_malloc,
+		.onRealloc = rtcheck_ma_realloc,
+		.onFree = rtcheck_ma_free,
+	};
+#endif
+}
+
+ma_result mstamp_engine_create(const MstampEngineConfig *config, MstampEngine **engine) {
+	ma_result result = MA_SUCCESS;
 	ma_device_config device_config = {0};
+	int err;
+	TraceSpan span;
+
+	// The callback reads the engine on every period: page aligned, so realtime mode can lock just it.
+	long page = sysconf(_SC_PAGESIZE);
+	MstampEngine *e = NULL;
+	*engine = NULL;
+	if (posix_memalign((void **) &e, page, sizeof(MstampEngine)) != 0) return MA_OUT_OF_MEMORY;
+	memset(e, 0, sizeof(*e));
+	*engine = e;
+	e->realtime = config->realtime;
+	e->headless = config->headless;
+	e->offline = config->offline;
+	e->stdio = config->stdio;
+	map_vfs_init(&e->vfs);
+	e->current_looping = true;
+	e->output_sink_jump = true;
+	atomic_init(&e->first_callback, true);
+	atomic_init(&e->callback_resumed, true);
+	atomic_init(&e->playback_gain, 1.0f);
+	pthread_mutex_init(&e->decoder_mutex, NULL);
+	// For the engine's lifetime: the callback may still post it after a handler was cleared.
+	if (!audio_semaphore_init(&e->dispatcher_wakeup)) {
+		pthread_mutex_destroy(&e->decoder_mutex);
+		free(e);
+		*engine = NULL;
+		return MA_ERROR;
+	}
+	if (e->realtime.enabled) realtime_lock_memory(&e->realtime_status, e, sizeof(*e));
+	audio_decoder_config_init(e);
+	if (e->offline) return MA_SUCCESS;
 
 	device_config = ma_device_config_init(ma_device_type_playback);
 	device_config.playback.format = SAMPLE_FORMAT;
@@ -56,69 +410,324 @@ ma_result audio_init() {
 	device_config.sampleRate = SAMPLE_RATE;
 	device_config.periodSizeInFrames = CHUNK_SIZE;
 	device_config.dataCallback = play_callback;
+	device_config.pUserData = e;
 
-	result = ma_device_init(NULL, &device_config, &device);
+	span = trace_begin("device open");
+	if (e->headless) {
+		ma_backend null_backend = ma_backend_null;
+		result = ma_context_init(&null_backend, 1, NULL, &e->context);
+		e->context_ready = result == MA_SUCCESS;
+		if (result == MA_SUCCESS) result = ma_device_init(&e->context, &device_config, &e->device);
+	}
+	else result = ma_device_init(NULL, &device_config, &e->device);
+	trace_end(&span);
 	check_ma_result("Failed to initialize play device");
 
 
 
-	decoder_config = ma_decoder_config_init(SAMPLE_FORMAT, CHANNEL_COUNT, SAMPLE_RATE);
-	decoder_config.seekPointCount = 1<<10;	// seek table to avoid reading from the beggining
+	e->playback_buffer_size = ma_get_bytes_per_frame(SAMPLE_FORMAT, CHANNEL_COUNT) * CHUNK_SIZE * RING_CHUNKS;
+	e->playback_buffer_size = (e->playback_buffer_size + page - 1) / page * page;
+	if (posix_memalign(&e->playback_buffer, page, e->playback_buffer_size) != 0) {
+		e->playback_buffer = NULL;
+		result = MA_OUT_OF_MEMORY;
+		check_ma_result("Failed to allocate playback buffer");
+	}
+	memset(e->playback_buffer, 0, e->playback_buffer_size);
+	if (e->realtime.enabled) realtime_lock_memory(&e->realtime_status, e->playback_buffer, e->playback_buffer_size);
+
+	result = ma_pcm_rb_init(SAMPLE_FORMAT, CHANNEL_COUNT, CHUNK_SIZE * RING_CHUNKS, e->playback_buffer, NULL, &e->playback_rb);
+	check_ma_result("Failed to initialize playback ring buffer");
+
+	if (!audio_semaphore_init(&e->decoder_wakeup)) {
+		result = MA_ERROR;
+		check_ma_result("Failed to create decoder wakeup semaphore");
+	}
+	atomic_store(&e->decoder_running, true);
+	if ((err = pthread_create(&e->decoder_tid, NULL, decoder_thread, e)) != 0) {
+		atomic_store(&e->decoder_running, false);
+		audio_semaphore_destroy(&e->decoder_wakeup);
+		result = ma_result_from_errno(err);
+		check_ma_result("Failed to start decoder thread");
+	}
+	while (!atomic_load(&e->decoder_promoted)) sched_yield();
 
 	return result;
 defer:
-	audio_deinit();
+	mstamp_engine_destroy(e);
+	*engine = NULL;
 	return result;
 }
 #undef SAMPLE_FORMAT
 #undef SAMPLE_RATE
 #undef CHUNK_SIZE
+#undef RING_CHUNKS
 
-void audio_deinit() {
-	ma_device_uninit(&device);
+void mstamp_engine_destroy(MstampEngine *e) {
+	if (!e) return;
+	mstamp_set_event_handler(e, NULL, NULL);
+	while (e->loaded.count) mstamp_unload_tracks(e, e->loaded.items[e->loaded.count - 1UL]);
+	free(e->loaded.items);
+	ma_device_uninit(&e->device);
+	if (e->context_ready) ma_context_uninit(&e->context);
+	audio_semaphore_destroy(&e->dispatcher_wakeup);		// nothing posts it with the device gone
+	if (atomic_load(&e->callback_stats.callbacks)) mstamp_log_stats(e);
+	if (atomic_exchange(&e->decoder_running, false)) {
+		audio_semaphore_post(&e->decoder_wakeup);
+		pthread_join(e->decoder_tid, NULL);
+		audio_semaphore_destroy(&e->decoder_wakeup);
+	}
+	ma_pcm_rb_uninit(&e->playback_rb);
+	float *tap = atomic_exchange(&e->tap_samples, NULL);		// the device is gone, nothing writes it any more
+	if (tap) {
+		if (e->realtime.enabled) munlock(tap, e->tap_capacity * CHANNEL_COUNT * sizeof(float));
+		free(tap);
+	}
+	if (e->playback_buffer) {
+		if (e->realtime.enabled) munlock(e->playback_buffer, e->playback_buffer_size);
+		free(e->playback_buffer);
+	}
+	arena_free(&e->arena);
+	nob_da_free(&e->markers);
+	pthread_mutex_destroy(&e->decoder_mutex);
+	if (e->realtime.enabled) munlock(e, sizeof(*e));
+	free(e);
+}
+
+ma_uint32 mstamp_sample_rate(MstampEngine *e) {
+	return e->offline ? e->decoder_config.sampleRate : e->device.sampleRate;
+}
+
+// Opens the decoder without a seek table; `mstamp_decoder_build_seek_table` adds it afterwards,
+// so the two can be traced and benchmarked on their own.
+ma_result mstamp_decoder_open(MstampEngine *e, const char *music_path, ma_decoder *decoder) {
+	ma_decoder_config config = e->decoder_config;
+	config.seekPointCount = 0;
+	TRACE_SCOPE("ma_decoder_init");
+	if (e->stdio) return ma_decoder_init_file(music_path, &config, decoder);
+	return ma_decoder_init_vfs(&e->vfs, music_path, &config, decoder);
 }
 
-MusicCollection audio_load_tracks(Arena *a, const char *music_path, const char *timestamp_path) {
+// miniaudio only supports seek tables for MP3; this is exactly what ma_mp3_post_init would have done.
+ma_result mstamp_decoder_build_seek_table(MstampEngine *e, ma_decoder *decoder) {
+	if (e->decoder_config.seekPointCount == 0 || decoder->pBackendVTable != &g_ma_decoding_backend_vtable_mp3) return MA_SUCCESS;
+
+	TRACE_SCOPE("seek table");
+	ma_decoding_backend_config backend_config = ma_decoding_backend_config_init(e->decoder_config.format, e->decoder_config.seekPointCount);
+	return ma_mp3_generate_seek_table(decoder->pBackend, &backend_config, &decoder->allocationCallbacks);
+}
+
+// Binds `from`'s seek table to another decoder of the same file instead of rescanning it.
+// The table stays owned by `from`, which must outlive `decoder`.
+ma_result audio_decoder_share_seek_table(ma_decoder *decoder, ma_decoder *from) {
+	if (decoder->pBackendVTable != &g_ma_decoding_backend_vtable_mp3 || from->pBackendVTable != &g_ma_decoding_backend_vtable_mp3) return MA_SUCCESS;
+
+	ma_mp3 *source = from->pBackend;
+	if (source->seekPointCount == 0) return MA_SUCCESS;
+	ma_mp3 *mp3 = decoder->pBackend;
+	return ma_dr_mp3_bind_seek_table(&mp3->dr, source->seekPointCount, source->pSeekPoints) ? MA_SUCCESS : MA_ERROR;
+}
+
+// The decoder keeps pointers to itself, so `music` must stay where it is for as long as it is loaded.
+bool mstamp_load_tracks(MstampEngine *e, Arena *a, MusicCollection *music, const char *music_path, const char *timestamp_path) {
 	ma_result result;
-	MusicCollection music = {0};
+	*music = (MusicCollection) { .engine = e };
+	TraceSpan span;
 
-    if (!tracks_read_from_file(a, timestamp_path, &music.tracks)) nob_return_defer(MA_INVALID_FILE);
+	span = trace_begin("tracks_read_from_file");
+	bool tracks_ok = tracks_read_from_file(a, timestamp_path, &music->tracks);
+	trace_end(&span);
+    if (!tracks_ok) nob_return_defer(MA_INVALID_FILE);
 
-	result = ma_decoder_init_file(music_path, &decoder_config, &music.decoder);
+	music->path = arena_strdup(a, music_path);
+	result = mstamp_decoder_open(e, music_path, &music->decoder);
 	check_ma_result("Failed to load music file `%s`", music_path);
+	if (!e->stdio) music->file = map_vfs_opened();
+	result = mstamp_decoder_build_seek_table(e, &music->decoder);
+	if (result != MA_SUCCESS) ma_decoder_uninit(&music->decoder);
+	check_ma_result("Failed to build seek table for `%s`", music_path);
 
     nob_log(NOB_INFO, "Opened `%s`", strrchr(music_path, '/'));
 	nob_log(NOB_INFO, "Opened `%s`", strrchr(timestamp_path, '/'));
+	realtime_log_status(&e->realtime, &e->realtime_status);
 
 
 
 	ma_uint64 ilength;
 	ma_uint32 sample_rate;
-	ma_data_source_get_length_in_pcm_frames(&music.decoder, &ilength);
-	ma_data_source_get_data_format(&music.decoder, NULL, NULL, &sample_rate, NULL, CHANNEL_COUNT);
-	tracks_set_end_time(music.tracks, ilength / sample_rate);
+	span = trace_begin("length query");
+	ma_data_source_get_length_in_pcm_frames(&music->decoder, &ilength);
+	trace_end(&span);
+	ma_data_source_get_data_format(&music->decoder, NULL, NULL, &sample_rate, NULL, CHANNEL_COUNT);
+	tracks_set_end_time(music->tracks, ilength / sample_rate);
 	
 defer:
-	nob_temp_reset();
+	if (result != MA_SUCCESS) nob_da_free(&music->tracks);
+	return result == MA_SUCCESS;
+}
+
+MusicCollection *mstamp_load(MstampEngine *e, const char *music_path, const char *timestamp_path) {
+	MusicCollection *music = arena_alloc(&e->arena, sizeof(MusicCollection));
+	if (!mstamp_load_tracks(e, &e->arena, music, music_path, timestamp_path)) return NULL;
+	nob_da_append(&e->loaded, music);
 	return music;
 }
 
-void audio_unload_tracks(MusicCollection *music) {
+// Under `decoder_mutex`: the current track is what the sink hears about with the next frames.
+static void audio_publish_track_locked(MstampEngine *e) {
+	uint64_t sequence = atomic_load_explicit(&e->sink_sequence, memory_order_relaxed);
+	atomic_store_explicit(&e->sink_sequence, sequence + 1U, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&e->sink_track, e->current_track, memory_order_relaxed);
+	atomic_store_explicit(&e->sink_index, e->current_index, memory_order_relaxed);
+	atomic_store_explicit(&e->sink_sequence, sequence + 2U, memory_order_release);
+}
+
+void mstamp_unload_tracks(MstampEngine *e, MusicCollection *music) {
+	if (e->current_music == music) mstamp_pause(e);
+	pthread_mutex_lock(&e->decoder_mutex);
+	if (e->current_music == music) {
+		e->current_music = NULL;
+		e->current_track = NULL;
+		audio_publish_track_locked(e);
+	}
+	pthread_mutex_unlock(&e->decoder_mutex);
+
 	ma_decoder_uninit(&music->decoder);
+	music->file = NULL;		// closed with the decoder
 	nob_da_free(&music->tracks);
+	for (size_t i = 0UL; i < e->loaded.count; i++) {
+		if (e->loaded.items[i] != music) continue;
+		e->loaded.items[i] = e->loaded.items[--e->loaded.count];
+		break;
+	}
 }
 
-void audio_select_track(MusicCollection *music, size_t index) {
+// Drops whatever the decoder thread queued for the previous position, and the marks on it; the frames
+// decoded next start a `jump`. Call with `decoder_mutex` held, after moving the decoder.
+static void playback_flush_locked(MstampEngine *e, MstampEventKind jump) {
+	audio_publish_track_locked(e);		// before the flush, so the callback dropping stale frames sees it
+	atomic_store(&e->playback_drained, false);
+	e->jump_pending = true;
+	e->jump_kind = jump;
+	if (ma_device_is_started(&e->device)) atomic_store(&e->playback_flush, true);
+	else {		// no callback to do it
+		ma_pcm_rb_reset(&e->playback_rb);
+		e->ring_read = e->ring_written;
+		atomic_store(&e->marks_head, atomic_load(&e->marks_tail));
+	}
+	audio_semaphore_post(&e->decoder_wakeup);
+}
+
+// Narrows a decoder to one track and rewinds it; shared by playback, rendering and export.
+static void audio_decoder_set_range(ma_decoder *decoder, const Track *track, bool looping) {
 	ma_uint32 sample_rate;
-	ma_data_source_get_data_format(&music->decoder, NULL, NULL, &sample_rate, NULL, CHANNEL_COUNT);
+	ma_data_source_get_data_format(decoder, NULL, NULL, &sample_rate, NULL, 0);
 
-	current_music = music;
-	current_track = track_get(music->tracks, index);
-	ma_data_source_set_range_in_pcm_frames(&music->decoder, current_track->start * sample_rate, current_track->stop * sample_rate);
-	ma_data_source_set_looping(&music->decoder, MA_TRUE);
-    nob_log(NOB_INFO, "Selected song %zu: `%s`", index, current_track->title);
+	ma_data_source_set_range_in_pcm_frames(decoder, track_start_frame(track, sample_rate), track_stop_frame(track, sample_rate));
+	ma_data_source_set_looping(decoder, looping);
+	ma_data_source_seek_to_pcm_frame(decoder, 0);
 }
 
+// Track gain, applied on the way out so ring contents stay untouched and a select takes effect at once.
+typedef float GainVector __attribute__((vector_size(8 * sizeof(float))));
+static inline void audio_apply_gain(float *samples, size_t count, float gain) {
+	GainVector g = {gain, gain, gain, gain, gain, gain, gain, gain};
+	size_t i = 0UL;
+	for (; i + 8UL <= count; i += 8UL) {
+		GainVector v;
+		memcpy(&v, samples + i, sizeof(v));
+		v *= g;
+		memcpy(samples + i, &v, sizeof(v));
+	}
+	for (; i < count; i++) samples[i] *= gain;
+}
+
+static Track *audio_decoder_set_track(MusicCollection *music, size_t index, bool looping) {
+	Track *track = track_get(music->tracks, index);
+	audio_decoder_set_range(&music->decoder, track, looping);
+	return track;
+}
+
+bool mstamp_select_track(MstampEngine *e, MusicCollection *music, size_t index) {
+	if (track_get_inbound(music->tracks, index) == NULL) {
+		nob_log(NOB_ERROR, "No track %zu, the collection has %zu", index, music->tracks.count);
+		return false;
+	}
+	TRACE_SCOPE("select");
+	pthread_mutex_lock(&e->decoder_mutex);
+	e->current_music = music;
+	e->current_index = index;
+	e->current_track = audio_decoder_set_track(music, index, e->current_looping);
+	map_vfs_prefetch(music->file, SELECT_PREFETCH);		// the decoder thread reads from here next
+	atomic_store(&e->playback_gain, powf(10.0f, e->current_track->gain_db / 20.0f));		// before the flush, so no stale frame gets it
+	playback_flush_locked(e, MSTAMP_EVENT_TRACK_START);
+	pthread_mutex_unlock(&e->decoder_mutex);
+    nob_log(NOB_INFO, "Selected song %zu: `%s`", index, e->current_track->title);
+	return true;
+}
+
+#define RENDER_CHUNK	(1<<14)
+// Pulls the track through the decoder as fast as it goes: into a WAV file, or as raw
+// interleaved f32 PCM on stdout when `output_path` is "-". Not for the collection that is playing.
+bool mstamp_render(MstampEngine *e, MusicCollection *music, size_t index, const char *output_path) {
+	bool to_stdout = strcmp(output_path, "-") == 0;
+	ma_encoder encoder;
+	ma_result result = MA_SUCCESS;
+	float *buffer = NULL;
+
+	if (track_get_inbound(music->tracks, index) == NULL) {
+		nob_log(NOB_ERROR, "No track %zu, the collection has %zu", index, music->tracks.count);
+		return false;
+	}
+	Track *track = audio_decoder_set_track(music, index, MA_FALSE);
+
+	if (!to_stdout) {
+		ma_encoder_config config = ma_encoder_config_init(ma_encoding_format_wav, e->decoder_config.format, CHANNEL_COUNT, e->decoder_config.sampleRate);
+		result = ma_encoder_init_file(output_path, &config, &encoder);
+		check_ma_result("Failed to create `%s`", output_path);
+	}
+	if (!(buffer = malloc(RENDER_CHUNK * CHANNEL_COUNT * sizeof(float)))) {
+		if (!to_stdout) ma_encoder_uninit(&encoder);
+		result = MA_OUT_OF_MEMORY;
+		check_ma_result("Failed to allocate the render buffer");
+	}
+
+	uint64_t start_ns = stats_now_ns();
+	ma_uint64 frames = 0, read;
+	float gain = powf(10.0f, track->gain_db / 20.0f);
+	while ((result = ma_data_source_read_pcm_frames(&music->decoder, buffer, RENDER_CHUNK, &read)) == MA_SUCCESS || read > 0) {
+		if (gain != 1.0f) audio_apply_gain(buffer, read * CHANNEL_COUNT, gain);
+		if (to_stdout) {
+			if (fwrite(buffer, ma_get_bytes_per_frame(e->decoder_config.format, CHANNEL_COUNT), read, stdout) != read) {
+				nob_log(NOB_ERROR, "Failed to write PCM to stdout: %s", strerror(errno));
+				result = MA_IO_ERROR;
+				break;
+			}
+		}
+		else if ((result = ma_encoder_write_pcm_frames(&encoder, buffer, read, NULL)) != MA_SUCCESS) break;
+		frames += read;
+		if (read < RENDER_CHUNK) {
+			result = MA_AT_END;
+			break;
+		}
+	}
+	double seconds = (stats_now_ns() - start_ns) / 1e9;
+	if (to_stdout) fflush(stdout);
+	else ma_encoder_uninit(&encoder);
+	if (result == MA_AT_END) result = MA_SUCCESS;
+	check_ma_result("Failed to render `%s`", track->title);
+
+	Arena a = {0};
+	uint32_t audio_seconds = (uint32_t) (frames / e->decoder_config.sampleRate);
+	nob_log(NOB_INFO, "Rendered `%s`: decoded %s in %.2fs = %.0fx realtime", track->title,
+		time_from_seconds(&a, audio_seconds), seconds, frames / (double) e->decoder_config.sampleRate / (seconds > 0.0 ? seconds : 1e-9));
+	arena_free(&a);
+defer:
+	free(buffer);
+	return result == MA_SUCCESS;
+}
+#undef RENDER_CHUNK
+
 
 
 #undef check_ma_result
@@ -130,32 +739,423 @@ void audio_select_track(MusicCollection *music, size_t index) {
 		} \
 	} while (0)
 
-bool audio_unpause() {
-    if (current_track == NULL) return false;
-	check_ma_result(ma_device_start(&device), "Failed to start playback audio device");
+bool mstamp_unpause(MstampEngine *e) {
+    if (e->current_track == NULL) return false;
+	atomic_store(&e->callback_resumed, true);
+	check_ma_result(ma_device_start(&e->device), "Failed to start playback audio device");
 	return true;
 }
 
-bool audio_pause() {
-    if (current_track == NULL) return false;
-	check_ma_result(ma_device_stop(&device), "Failed to stop playback audio device");
+bool mstamp_pause(MstampEngine *e) {
+    if (e->current_track == NULL) return false;
+	check_ma_result(ma_device_stop(&e->device), "Failed to stop playback audio device");
 	return true;
 }
 
-void audio_restart() {
-    if (current_track == NULL || current_music == NULL) return;
-	ma_decoder_seek_to_pcm_frame(&current_music->decoder, 0);
+void mstamp_restart(MstampEngine *e) {
+    if (e->current_track == NULL || e->current_music == NULL) return;
+	pthread_mutex_lock(&e->decoder_mutex);
+	ma_data_source_seek_to_pcm_frame(&e->current_music->decoder, 0);
+	playback_flush_locked(e, MSTAMP_EVENT_SEEK);
+	pthread_mutex_unlock(&e->decoder_mutex);
+}
+
+bool mstamp_is_paused(MstampEngine *e) {
+	return !ma_device_is_started(&e->device);
 }
 
+// The decoder runs ahead of the speakers by whatever sits in the ring.
+static ma_uint64 audio_heard_frame_locked(MstampEngine *e, ma_uint64 *length, ma_uint32 *sample_rate) {
+	ma_uint64 cursor = 0;
+	ma_data_source_get_cursor_in_pcm_frames(&e->current_music->decoder, &cursor);
+	ma_data_source_get_length_in_pcm_frames(&e->current_music->decoder, length);
+	ma_data_source_get_data_format(&e->current_music->decoder, NULL, NULL, sample_rate, NULL, 0);
+	ma_uint64 queued = atomic_load(&e->playback_flush) ? 0 : ma_pcm_rb_available_read(&e->playback_rb);
+	return cursor > queued ? cursor - queued : 0;
+}
 
+void mstamp_seek(MstampEngine *e, double seconds) {
+	if (e->current_track == NULL || e->current_music == NULL) return;
+	pthread_mutex_lock(&e->decoder_mutex);
+	ma_uint64 length;
+	ma_uint32 sample_rate;
+	double target = (double) audio_heard_frame_locked(e, &length, &sample_rate) + seconds * sample_rate;
+	if (target < 0.0) target = 0.0;
+	if (length && target >= (double) length) target = (double) (length - 1);
+	ma_data_source_seek_to_pcm_frame(&e->current_music->decoder, (ma_uint64) target);
+	playback_flush_locked(e, MSTAMP_EVENT_SEEK);
+	pthread_mutex_unlock(&e->decoder_mutex);
+}
+
+void mstamp_set_looping(MstampEngine *e, bool looping) {
+	pthread_mutex_lock(&e->decoder_mutex);
+	e->current_looping = looping;
+	if (looping) atomic_store(&e->playback_drained, false);
+	if (e->current_music) ma_data_source_set_looping(&e->current_music->decoder, looping);
+	audio_semaphore_post(&e->decoder_wakeup);		// a track that had run out may go on again
+	pthread_mutex_unlock(&e->decoder_mutex);
+}
+
+bool mstamp_is_looping(MstampEngine *e) {
+	return e->current_looping;
+}
+
+size_t mstamp_current_index(MstampEngine *e) {
+	return e->current_index;
+}
+
+bool mstamp_position(MstampEngine *e, double *seconds, double *length) {
+	if (e->current_track == NULL || e->current_music == NULL) return false;
+	pthread_mutex_lock(&e->decoder_mutex);
+	ma_uint64 frames;
+	ma_uint32 sample_rate;
+	ma_uint64 heard = audio_heard_frame_locked(e, &frames, &sample_rate);
+	pthread_mutex_unlock(&e->decoder_mutex);
+	*seconds = heard / (double) sample_rate;
+	*length = frames / (double) sample_rate;
+	return true;
+}
+
+bool mstamp_track_ended(MstampEngine *e) {
+	if (e->current_track == NULL || e->current_music == NULL || e->current_looping) return false;
+	pthread_mutex_lock(&e->decoder_mutex);
+	ma_uint64 cursor = 0, length = 0;
+	ma_data_source_get_cursor_in_pcm_frames(&e->current_music->decoder, &cursor);
+	ma_data_source_get_length_in_pcm_frames(&e->current_music->decoder, &length);
+	bool ended = cursor >= length && ma_pcm_rb_available_read(&e->playback_rb) == 0;
+	pthread_mutex_unlock(&e->decoder_mutex);
+	return ended;
+}
+
+
+
+// Decoder thread, `decoder_mutex` held: before the frames are committed, so the callback never reads one
+// without its mark.
+static void audio_mark(MstampEngine *e, uint64_t ring_frame, MstampEventKind kind, uint64_t track_frame, uint32_t marker) {
+	size_t tail = atomic_load_explicit(&e->marks_tail, memory_order_relaxed);
+	if (tail - atomic_load_explicit(&e->marks_head, memory_order_acquire) >= AUDIO_MARKS) {
+		atomic_fetch_add_explicit(&e->events_dropped, 1, memory_order_relaxed);
+		return;
+	}
+	e->marks[tail & (AUDIO_MARKS - 1)] = (AudioMark) {
+		.ring_frame = ring_frame,
+		.event = { .kind = kind, .marker = marker, .track = e->current_index, .track_frame = track_frame },
+	};
+	atomic_store_explicit(&e->marks_tail, tail + 1, memory_order_release);
+}
+
+// Markers of the current track in [from, to), on the ring from `ring_frame`.
+static void audio_mark_markers(MstampEngine *e, uint64_t ring_frame, uint64_t from, uint64_t to) {
+	for (size_t i = 0UL; i < e->markers.count; i++) {
+		AudioMarker *m = &e->markers.items[i];
+		if (m->track == e->current_index && m->frame >= from && m->frame < to) audio_mark(e, ring_frame + (m->frame - from), MSTAMP_EVENT_MARKER, m->frame, m->id);
+	}
+}
+
+// `read` frames just decoded from track frame `before`, in ring order: a jump, markers, a loop and more
+// markers, the end.
+static void audio_mark_read(MstampEngine *e, uint64_t before, uint64_t read) {
+	ma_data_source *source = &e->current_music->decoder;
+	ma_uint64 after = 0, length = 0;
+	ma_data_source_get_cursor_in_pcm_frames(source, &after);
+	ma_data_source_get_length_in_pcm_frames(source, &length);
+	uint64_t ring_frame = e->ring_written;
+	if (e->jump_pending) audio_mark(e, ring_frame, e->jump_kind, before, 0);
+	e->jump_pending = false;
+
+	uint64_t first = after < before + read && length > before ? length - before : read;		// up to the wrap
+	audio_mark_markers(e, ring_frame, before, before + first);
+	if (first < read) {
+		audio_mark(e, ring_frame + first, MSTAMP_EVENT_TRACK_LOOP, 0, 0);
+		audio_mark_markers(e, ring_frame + first, 0, read - first);
+	}
+	else if (!e->current_looping && after >= length) audio_mark(e, ring_frame + read - 1, MSTAMP_EVENT_TRACK_END, after - 1, 0);
+}
+
+static void *decoder_thread(void *arg) {
+	MstampEngine *e = arg;
+	realtime_promote_thread(&e->realtime, &e->realtime_status);
+	atomic_store(&e->decoder_promoted, true);
+
+	while (atomic_load(&e->decoder_running)) {
+		pthread_mutex_lock(&e->decoder_mutex);
+		// Nothing new goes in until the callback has dropped the stale frames.
+		while (e->current_music != NULL && !atomic_load(&e->playback_flush)) {
+			ma_uint32 frames = ma_pcm_rb_available_write(&e->playback_rb);
+			void *buffer;
+			if (frames == 0 || ma_pcm_rb_acquire_write(&e->playback_rb, &frames, &buffer) != MA_SUCCESS) break;
+
+			ma_uint64 framesRead = 0, before = 0;
+			bool events = atomic_load_explicit(&e->events_on, memory_order_relaxed);
+			if (events) ma_data_source_get_cursor_in_pcm_frames(&e->current_music->decoder, &before);
+			ma_data_source_read_pcm_frames(&e->current_music->decoder, buffer, frames, &framesRead);
+			if (framesRead) {
+				if (events) audio_mark_read(e, before, framesRead);
+				else e->jump_pending = false;
+			}
+			// Running out at the end of a track that doesn't loop is how it ends, not a short read.
+			bool drained = false;
+			if (framesRead < frames && !e->current_looping) {
+				ma_uint64 cursor = 0, length = 0;
+				ma_data_source_get_cursor_in_pcm_frames(&e->current_music->decoder, &cursor);
+				ma_data_source_get_length_in_pcm_frames(&e->current_music->decoder, &length);
+				drained = cursor >= length;
+			}
+			if (drained) atomic_store(&e->playback_drained, true);		// before the callback can see the last frames
+			ma_pcm_rb_commit_write(&e->playback_rb, (ma_uint32) framesRead);
+			e->ring_written += framesRead;
+			if (framesRead < frames && !drained) stats_record_short_read(&e->callback_stats);
+			if (framesRead == 0) break;
+		}
+		pthread_mutex_unlock(&e->decoder_mutex);
+
+		audio_semaphore_wait(&e->decoder_wakeup);
+	}
+	return NULL;
+}
+
+CallbackStatsSnapshot mstamp_stats(MstampEngine *e) {
+	return stats_snapshot(&e->callback_stats);
+}
+
+// Only while paused: the callback is the histogram's single writer.
+void mstamp_reset_stats(MstampEngine *e) {
+	if (ma_device_is_started(&e->device)) return;
+	memset(&e->callback_stats, 0, sizeof(e->callback_stats));
+	atomic_store(&e->first_callback, true);
+}
+
+void mstamp_log_stats(MstampEngine *e) {
+	stats_log("Callback", &e->callback_stats);
+}
+
+ma_uint32 mstamp_tap_enable(MstampEngine *e, size_t frames) {
+	if (atomic_load(&e->tap_samples)) return e->device.sampleRate;
+	size_t capacity = 1UL;
+	while (capacity < frames + 2UL * e->device.playback.internalPeriodSizeInFrames) capacity *= 2UL;		// room for a callback mid-write
+	size_t size = capacity * CHANNEL_COUNT * sizeof(float);
+	float *samples = NULL;
+	if (posix_memalign((void **) &samples, (size_t) sysconf(_SC_PAGESIZE), size) != 0) return 0;
+	memset(samples, 0, size);
+	if (e->realtime.enabled) realtime_lock_memory(&e->realtime_status, samples, size);
+	e->tap_capacity = capacity;
+	atomic_store(&e->tap_samples, samples);
+	return e->device.sampleRate;
+}
+
+static inline void audio_tap_write(MstampEngine *e, float *tap, const float *frames, size_t count) {
+	size_t capacity = e->tap_capacity;
+	uint64_t at = atomic_load_explicit(&e->tap_written, memory_order_relaxed);
+	if (count > capacity) frames += (count - capacity) * CHANNEL_COUNT, at += count - capacity, count = capacity;
+	atomic_store_explicit(&e->tap_claimed, at + count, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	size_t offset = (size_t) (at & (capacity - 1UL));
+	size_t first = count < capacity - offset ? count : capacity - offset;
+	memcpy(tap + offset * CHANNEL_COUNT, frames, first * CHANNEL_COUNT * sizeof(float));
+	memcpy(tap, frames + first * CHANNEL_COUNT, (count - first) * CHANNEL_COUNT * sizeof(float));
+	atomic_store_explicit(&e->tap_written, at + count, memory_order_release);
+}
+
+bool mstamp_tap_read(MstampEngine *e, float *out, size_t frames) {
+	float *tap = atomic_load(&e->tap_samples);
+	size_t capacity = e->tap_capacity;
+	if (!tap || frames > capacity) return false;
+	uint64_t end = atomic_load_explicit(&e->tap_written, memory_order_acquire);
+	uint64_t start = end > frames ? end - frames : 0;
+	if (end - start < frames) memset(out, 0, (frames - (end - start)) * CHANNEL_COUNT * sizeof(float));
+	float *to = out + (frames - (end - start)) * CHANNEL_COUNT;
+	for (uint64_t at = start; at < end; ) {
+		size_t offset = (size_t) (at & (capacity - 1UL));
+		size_t count = end - at < capacity - offset ? (size_t) (end - at) : capacity - offset;
+		memcpy(to, tap + offset * CHANNEL_COUNT, count * CHANNEL_COUNT * sizeof(float));
+		to += count * CHANNEL_COUNT, at += count;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&e->tap_claimed, memory_order_relaxed) <= start + capacity;		// else the callback wrapped onto what we copied
+}
+
+size_t mstamp_tap_read_next(MstampEngine *e, uint64_t *position, float *out, size_t frames, uint64_t *skipped) {
+	float *tap = atomic_load(&e->tap_samples);
+	size_t capacity = e->tap_capacity;
+	*skipped = 0;
+	if (!tap) return 0UL;
+	uint64_t end = atomic_load_explicit(&e->tap_written, memory_order_acquire);
+	uint64_t oldest = end > capacity ? end - capacity : 0;
+	if (*position < oldest) *skipped = oldest - *position, *position = oldest;
+	uint64_t start = *position;
+	if (end - start > frames) end = start + frames;
+	for (uint64_t at = start; at < end; ) {
+		size_t offset = (size_t) (at & (capacity - 1UL));
+		size_t count = end - at < capacity - offset ? (size_t) (end - at) : capacity - offset;
+		memcpy(out, tap + offset * CHANNEL_COUNT, count * CHANNEL_COUNT * sizeof(float));
+		out += count * CHANNEL_COUNT, at += count;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	uint64_t claimed = atomic_load_explicit(&e->tap_claimed, memory_order_relaxed);
+	if (claimed > start + capacity) {		// lapped while copying: none of it can be trusted, try again from what survived
+		*skipped += claimed - capacity - start;
+		*position = claimed - capacity;
+		return 0UL;
+	}
+	*position = end;
+	return (size_t) (end - start);
+}
+
+static void *dispatcher_thread(void *arg) {
+	MstampEngine *e = arg;
+	while (atomic_load(&e->dispatcher_running)) {
+		audio_semaphore_wait(&e->dispatcher_wakeup);
+		size_t head = atomic_load_explicit(&e->events_head, memory_order_relaxed);
+		while (atomic_load(&e->dispatcher_running) && head != atomic_load_explicit(&e->events_tail, memory_order_acquire)) {
+			MstampEvent event = e->events[head & (AUDIO_EVENTS - 1)];
+			atomic_store_explicit(&e->events_head, ++head, memory_order_release);
+			e->event_handler(&event, e->event_user);
+		}
+	}
+	return NULL;
+}
+
+bool mstamp_set_event_handler(MstampEngine *e, MstampEventHandler handler, void *user) {
+	if (atomic_exchange(&e->dispatcher_running, false)) {
+		atomic_store(&e->events_on, false);
+		audio_semaphore_post(&e->dispatcher_wakeup);
+		pthread_join(e->dispatcher_tid, NULL);
+	}
+	if (!handler) return true;
+
+	e->event_handler = handler;
+	e->event_user = user;
+	atomic_store(&e->events_head, atomic_load(&e->events_tail));		// nothing left over for a previous handler
+	atomic_store(&e->dispatcher_running, true);
+	int err = pthread_create(&e->dispatcher_tid, NULL, dispatcher_thread, e);
+	if (err != 0) {
+		atomic_store(&e->dispatcher_running, false);
+		nob_log(NOB_ERROR, "Failed to start the event dispatcher: %s", strerror(err));
+		return false;
+	}
+	atomic_store(&e->events_on, true);
+	return true;
+}
+
+void mstamp_add_marker(MstampEngine *e, size_t track, double seconds, uint32_t id) {
+	AudioMarker marker = { .track = track, .frame = (uint64_t) (seconds * e->decoder_config.sampleRate + 0.5), .id = id };
+	pthread_mutex_lock(&e->decoder_mutex);
+	nob_da_append(&e->markers, marker);
+	size_t i = e->markers.count - 1UL;
+	for (; i > 0UL; i--) {
+		AudioMarker *prev = &e->markers.items[i - 1UL];
+		if (prev->track < track || (prev->track == track && prev->frame <= marker.frame)) break;
+		e->markers.items[i] = *prev;
+	}
+	e->markers.items[i] = marker;
+	pthread_mutex_unlock(&e->decoder_mutex);
+}
+
+void mstamp_clear_markers(MstampEngine *e) {
+	pthread_mutex_lock(&e->decoder_mutex);
+	e->markers.count = 0UL;
+	pthread_mutex_unlock(&e->decoder_mutex);
+}
+
+uint64_t mstamp_events_dropped(MstampEngine *e) {
+	return atomic_load(&e->events_dropped);
+}
+
+uint64_t mstamp_tap_position(MstampEngine *e) {
+	return atomic_load_explicit(&e->tap_written, memory_order_acquire);
+}
+
+void mstamp_set_sink(MstampEngine *e, AudioSink sink, void *user) {
+	if (sink) e->output_sink_user = user;
+	atomic_store(&e->output_sink, sink);
+}
+
+// Callback: the marks on the `frames` just read from ring frame `from` become events, stamped with where
+// they went out. Marks on frames a flush dropped go with them. Never waits: a full queue drops the event.
+static inline void audio_emit_events(MstampEngine *e, uint64_t from, ma_uint32 frames, uint64_t start_ns, ma_uint32 sample_rate) {
+	size_t head = atomic_load_explicit(&e->marks_head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&e->marks_tail, memory_order_acquire);
+	size_t events = atomic_load_explicit(&e->events_tail, memory_order_relaxed);
+	bool on = atomic_load_explicit(&e->events_on, memory_order_relaxed), queued = false;
+	for (; head != tail; head++) {
+		AudioMark *mark = &e->marks[head & (AUDIO_MARKS - 1)];
+		if (mark->ring_frame >= from + frames) break;
+		if (mark->ring_frame < from || !on) continue;
+		if (events - atomic_load_explicit(&e->events_head, memory_order_acquire) >= AUDIO_EVENTS) {
+			atomic_fetch_add_explicit(&e->events_dropped, 1, memory_order_relaxed);
+			continue;
+		}
+		uint64_t offset = mark->ring_frame - from;
+		MstampEvent *event = &e->events[events++ & (AUDIO_EVENTS - 1)];
+		*event = mark->event;
+		event->output_frame = e->output_frames + offset;
+		event->time_ns = start_ns + offset * 1000000000ULL / sample_rate;
+		queued = true;
+	}
+	atomic_store_explicit(&e->marks_head, head, memory_order_release);
+	if (queued) {
+		atomic_store_explicit(&e->events_tail, events, memory_order_release);
+		audio_semaphore_post(&e->dispatcher_wakeup);
+	}
+}
 
 void play_callback(ma_device *pDevice, void *pOutput, const void *pInput, ma_uint32 frameCount) {
-    if (current_track == NULL || current_music == NULL) return;
 	NOB_UNUSED(pInput);
-	NOB_UNUSED(pDevice);
+	rtcheck_enter();
+	MstampEngine *e = pDevice->pUserData;
+	uint64_t start_ns = stats_now_ns();
+	if (atomic_exchange_explicit(&e->first_callback, false, memory_order_relaxed)) trace_instant("first callback");
+	if (atomic_exchange_explicit(&e->callback_resumed, false, memory_order_relaxed)) e->callback_stats.last_start_ns = 0;
+	ma_uint32 bytes_per_frame = ma_get_bytes_per_frame(pDevice->playback.format, pDevice->playback.channels);
 
-    ma_uint64 framesRead;
-    ma_data_source_read_pcm_frames(&current_music->decoder, pOutput, frameCount, &framesRead);
+	// Silence right after a flush, or once a track that doesn't loop has ended, is expected, not an underrun.
+	bool flushed = atomic_load(&e->playback_flush);
+	if (flushed) {
+		ma_uint32 stale = ma_pcm_rb_available_read(&e->playback_rb);
+		ma_pcm_rb_seek_read(&e->playback_rb, stale);
+		e->ring_read += stale;
+		atomic_store(&e->playback_flush, false);
+	}
+
+	ma_uint32 framesRead = 0;
+	while (framesRead < frameCount) {
+		ma_uint32 frames = frameCount - framesRead;
+		void *buffer;
+		if (ma_pcm_rb_acquire_read(&e->playback_rb, &frames, &buffer) != MA_SUCCESS || frames == 0) break;
+		memcpy((char *) pOutput + framesRead * bytes_per_frame, buffer, frames * bytes_per_frame);
+		ma_pcm_rb_commit_read(&e->playback_rb, frames);
+		framesRead += frames;
+	}
+	audio_emit_events(e, e->ring_read, framesRead, start_ns, pDevice->sampleRate);
+	e->ring_read += framesRead;
+	e->output_frames += frameCount;
+	float gain = atomic_load_explicit(&e->playback_gain, memory_order_relaxed);
+	if (gain != 1.0f) audio_apply_gain(pOutput, (size_t) framesRead * pDevice->playback.channels, gain);
+	float *tap = atomic_load_explicit(&e->tap_samples, memory_order_acquire);
+	if (tap && framesRead) audio_tap_write(e, tap, pOutput, framesRead);
+	AudioSink sink = atomic_load_explicit(&e->output_sink, memory_order_acquire);
+	e->output_sink_jump |= flushed;
+	if (sink && framesRead) {
+		const Track *track = NULL;
+		uint64_t sequence = atomic_load_explicit(&e->sink_sequence, memory_order_acquire);
+		e->output_sink_jump |= sequence != e->output_sink_sequence;
+		if (e->output_sink_jump && !(sequence & 1U)) {
+			track = atomic_load_explicit(&e->sink_track, memory_order_relaxed);
+			size_t index = atomic_load_explicit(&e->sink_index, memory_order_relaxed);
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(&e->sink_sequence, memory_order_relaxed) != sequence) track = NULL;		// its flush comes next
+			else {
+				e->output_sink_index = index;
+				e->output_sink_sequence = sequence;
+			}
+		}
+		sink(pOutput, framesRead, track, e->output_sink_index, e->output_sink_user);
+		if (track) e->output_sink_jump = false;
+	}
+	audio_semaphore_post(&e->decoder_wakeup);
+	bool silent = flushed || atomic_load_explicit(&e->playback_drained, memory_order_acquire);
+	stats_record_callback(&e->callback_stats, start_ns, frameCount, silent ? 0 : frameCount - framesRead, pDevice->sampleRate);
+	rtcheck_leave();
 
 	// total_frames += framesRead;
 	// if (total_frames >= 100000) {
@@ -165,5 +1165,111 @@ void play_callback(ma_device *pDevice, void *pOutput, const void *pInput, ma_uin
 	// }
 }
 
+
+
+#ifndef MSTAMP_LIBRARY
+static MstampEngine *audio_engine = NULL;
+static MstampEngineConfig audio_engine_config = { .realtime = REALTIME_DEFAULT };
+static pthread_t stats_tid;
+static atomic_bool stats_running = false;
+
+static void *stats_thread(void *arg) {
+	NOB_UNUSED(arg);
+	sigset_t sigusr1;
+	sigemptyset(&sigusr1);
+	sigaddset(&sigusr1, SIGUSR1);
+
+	int sig;
+	while (sigwait(&sigusr1, &sig) == 0 && atomic_load(&stats_running)) audio_log_stats();
+	return NULL;
+}
+
+void audio_set_realtime(Realtime rt) {
+	audio_engine_config.realtime = rt;
+}
+
+void audio_set_headless(bool enable) {
+	audio_engine_config.headless = enable;
+}
+
+ma_result audio_init() {
+	TRACE_SCOPE("audio_init");
+	// SIGUSR1 is only ever taken by `stats_thread`: block it before miniaudio spawns its own threads.
+	sigset_t sigusr1;
+	sigemptyset(&sigusr1);
+	sigaddset(&sigusr1, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &sigusr1, NULL);
+
+	ma_result result = mstamp_engine_create(&audio_engine_config, &audio_engine);
+	if (result != MA_SUCCESS) return result;
+
+	int err;
+	atomic_store(&stats_running, true);
+	if ((err = pthread_create(&stats_tid, NULL, stats_thread, NULL)) != 0) {
+		atomic_store(&stats_running, false);
+		nob_log(NOB_WARNING, "Failed to start stats thread, SIGUSR1 will not dump callback stats: %s", strerror(err));
+	}
+	return result;
+}
+
+// Decoding only, for rendering to files: no device, ring or decoder thread.
+ma_result audio_init_offline() {
+	MstampEngineConfig config = audio_engine_config;
+	config.offline = true;
+	return mstamp_engine_create(&config, &audio_engine);
+}
+
+void audio_deinit() {
+	if (atomic_exchange(&stats_running, false)) {
+		pthread_kill(stats_tid, SIGUSR1);
+		pthread_join(stats_tid, NULL);
+	}
+	mstamp_engine_destroy(audio_engine);
+	audio_engine = NULL;
+}
+
+ma_uint32 audio_sample_rate() { return mstamp_sample_rate(audio_engine); }
+bool audio_unpause() { return mstamp_unpause(audio_engine); }
+bool audio_pause() { return mstamp_pause(audio_engine); }
+void audio_restart() { mstamp_restart(audio_engine); }
+bool audio_is_paused() { return mstamp_is_paused(audio_engine); }
+void audio_seek(double seconds) { mstamp_seek(audio_engine, seconds); }
+void audio_set_looping(bool looping) { mstamp_set_looping(audio_engine, looping); }
+bool audio_is_looping() { return mstamp_is_looping(audio_engine); }
+size_t audio_current_index() { return mstamp_current_index(audio_engine); }
+bool audio_position(double *seconds, double *length) { return mstamp_position(audio_engine, seconds, length); }
+bool audio_track_ended() { return mstamp_track_ended(audio_engine); }
+
+CallbackStatsSnapshot audio_stats() { return mstamp_stats(audio_engine); }
+void audio_reset_stats() { mstamp_reset_stats(audio_engine); }
+void audio_log_stats() { mstamp_log_stats(audio_engine); }
+
+ma_result audio_decoder_open(const char *music_path, ma_decoder *decoder) { return mstamp_decoder_open(audio_engine, music_path, decoder); }
+ma_result audio_decoder_build_seek_table(ma_decoder *decoder) { return mstamp_decoder_build_seek_table(audio_engine, decoder); }
+bool audio_load_tracks(Arena *a, MusicCollection *music, const char *music_path, const char *timestamp_path) {
+	return mstamp_load_tracks(audio_engine, a, music, music_path, timestamp_path);
+}
+void audio_unload_tracks(MusicCollection *music) { mstamp_unload_tracks(audio_engine, music); }
+bool audio_select_track(MusicCollection *music, size_t index) { return mstamp_select_track(audio_engine, music, index); }
+bool audio_render(MusicCollection *music, size_t index, const char *output_path) { return mstamp_render(audio_engine, music, index, output_path); }
+
+ma_uint32 audio_tap_enable(size_t frames) { return mstamp_tap_enable(audio_engine, frames); }
+bool audio_tap_read(float *out, size_t frames) { return mstamp_tap_read(audio_engine, out, frames); }
+size_t audio_tap_read_next(uint64_t *position, float *out, size_t frames, uint64_t *skipped) {
+	return mstamp_tap_read_next(audio_engine, position, out, frames, skipped);
+}
+uint64_t audio_tap_position() { return mstamp_tap_position(audio_engine); }
+// Also after `audio_deinit`, as sinks are stopped once the callback is gone: nothing to unhook then.
+void audio_set_sink(AudioSink sink, void *user) { if (audio_engine) mstamp_set_sink(audio_engine, sink, user); }
+bool audio_set_event_handler(MstampEventHandler handler, void *user) { return mstamp_set_event_handler(audio_engine, handler, user); }
+#endif // MSTAMP_LIBRARY
+
+#undef AUDIO_MARKS
+#undef AUDIO_EVENTS
+#undef SELECT_PREFETCH
+#undef audio_semaphore_init
+#undef audio_semaphore_post
+#undef audio_semaphore_wait
+#undef audio_semaphore_destroy
 // #undef check_ma_result
-#endif // AUDIO_IMPLEMENTATION
\ No newline at end of file
+#endif // AUDIO_IMPLEMENTATION
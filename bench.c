@@ -0,0 +1,459 @@
+#define NOB_IMPLEMENTATION
+#include <nob.h>
+#define ARENA_IMPLEMENTATION
+#include <arena.h>
+#define MINIAUDIO_IMPLEMENTATION
+#include <miniaudio.h>
+
+#define AUDIO_IMPLEMENTATION
+#include "audio.h"
+#define SESSION_IMPLEMENTATION
+#include "session.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PARSE_MIN_NS		200000000ULL	// keep re-parsing a .time file for at least this long
+#define DECODE_CHUNK		(1<<12)
+#define IO_CHUNK			(1<<11)			// frames per read in the I/O comparison, a device period as the decoder thread reads
+#define DEFAULT_PLAY		1.0				// seconds of null-backend playback per file
+#define DEFAULT_DECODE		600.0			// seconds of audio decoded per file
+#define DEFAULT_SESSIONS	32				// concurrent sessions in the load test
+#define SESSION_SECONDS		10.0			// of audio rendered per session
+#define SESSION_BLOCK		1024			// frames per read, a device period
+#define SESSION_GROUP		8				// sessions a few blocks apart on the same track, when clustered
+
+static inline bool is_flag(const char *test, const char *flag) { return strcmp(test, flag) == 0; }
+#define FLAG_OUTPUT "-o"
+#define FLAG_PLAY "-play"
+#define FLAG_DECODE "-decode"
+#define FLAG_SESSIONS "-sessions"
+
+static inline void usage(const char *program) {
+	fprintf(stderr, "Usage: %s [OPTIONS] <music>[=<timestamps.time>]...\n", program);
+	fprintf(stderr, "	Timestamps default to the music path with its extension replaced by `.time`.\n");
+	fprintf(stderr, "	" FLAG_OUTPUT " <file.json>	write results there instead of stdout\n");
+	fprintf(stderr, "	" FLAG_PLAY " <seconds>	null-backend playback per file (default %.0f)\n", DEFAULT_PLAY);
+	fprintf(stderr, "	" FLAG_DECODE " <seconds>	audio decoded per file for throughput and the stdio/mmap comparison (default %.0f)\n", DEFAULT_DECODE);
+	fprintf(stderr, "	" FLAG_SESSIONS " <n>	sessions in the multi-session load test, 0 to skip it (default %d)\n", DEFAULT_SESSIONS);
+}
+
+static inline double ms_since(uint64_t start_ns) { return (stats_now_ns() - start_ns) / 1e6; }
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+static const char *decoder_format_name(ma_decoder *decoder) {
+	if (decoder->pBackendVTable == &g_ma_decoding_backend_vtable_mp3) return "mp3";
+	if (decoder->pBackendVTable == &g_ma_decoding_backend_vtable_flac) return "flac";
+	if (decoder->pBackendVTable == &g_ma_decoding_backend_vtable_wav) return "wav";
+	return "other";
+}
+
+// `s` as a quoted JSON string: paths and /proc fields may hold quotes, backslashes or control bytes.
+static void json_string(FILE *out, const char *s) {
+	fputc('"', out);
+	for (; *s; s++) {
+		unsigned char c = (unsigned char) *s;
+		if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+		else if (c < 0x20) fprintf(out, "\\u%04x", c);
+		else fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static void json_machine(FILE *out) {
+	struct utsname un = {0};
+	uname(&un);
+
+	char cpu[256] = "unknown";
+	Nob_StringBuilder sb = {0};
+	if (nob_read_entire_file("/proc/cpuinfo", &sb)) {
+		Nob_StringView sv = nob_sb_to_sv(sb);
+		while (sv.count) {
+			Nob_StringView line = nob_sv_chop_by_delim(&sv, '\n');
+			if (!nob_sv_starts_with(line, nob_sv_from_cstr("model name"))) continue;
+			nob_sv_chop_by_delim(&line, ':');
+			line = nob_sv_trim(line);
+			snprintf(cpu, sizeof(cpu), SV_Fmt, SV_Arg(line));
+			break;
+		}
+		nob_sb_free(&sb);
+	}
+
+	char date[32];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	fprintf(out, "\"machine\":{\"os\":");
+	json_string(out, un.sysname);
+	fprintf(out, ",\"kernel\":");
+	json_string(out, un.release);
+	fprintf(out, ",\"arch\":");
+	json_string(out, un.machine);
+	fprintf(out, ",\"cpu\":");
+	json_string(out, cpu);
+	fprintf(out, ",\"cores\":%ld,\"compiler\":", sysconf(_SC_NPROCESSORS_ONLN));
+	json_string(out, __VERSION__);
+	fprintf(out, ",\"optimized\":%s,\"miniaudio\":\"%s\",\"date\":\"%s\"}",
+#ifdef __OPTIMIZE__
+		"true",
+#else
+		"false",
+#endif
+		MA_VERSION_STRING, date);
+}
+
+static void bench_parse(FILE *out, const char *timestamp_path) {
+	Arena a = {0};
+	Tracks tracks = {0};
+	size_t iterations = 0UL, entries = 0UL, bytes = 0UL;
+	Nob_StringBuilder sb = {0};
+	if (nob_read_entire_file(timestamp_path, &sb)) bytes = sb.count;
+	nob_sb_free(&sb);
+
+	uint64_t start_ns = stats_now_ns();
+	do {
+		tracks.count = 0UL;
+		if (!tracks_read_from_file(&a, timestamp_path, &tracks)) break;
+		entries = tracks.count;
+		arena_reset(&a);
+		iterations++;
+	} while (stats_now_ns() - start_ns < PARSE_MIN_NS);
+	double seconds = (stats_now_ns() - start_ns) / 1e9;
+
+	fprintf(out, "\"parse\":{\"path\":");
+	json_string(out, timestamp_path);
+	fprintf(out, ",\"bytes\":%zu,\"entries\":%zu,\"iterations\":%zu,\"mb_per_s\":%.2f,\"entries_per_s\":%.0f}",
+		bytes, entries, iterations, bytes * iterations / seconds / 1e6, entries * iterations / seconds);
+	nob_da_free(&tracks);
+	arena_free(&a);
+}
+
+static void bench_seek(FILE *out, MusicCollection *music) {
+	static float buffer[DECODE_CHUNK * CHANNEL_COUNT];
+	ma_uint32 sample_rate;
+	ma_data_source_get_data_format(&music->decoder, NULL, NULL, &sample_rate, NULL, 0);
+
+	double *latencies = malloc(sizeof(double) * (music->tracks.count ? music->tracks.count : 1UL));
+	if (!latencies) {
+		nob_log(NOB_ERROR, "Could not allocate the seek latencies");
+		fprintf(out, "\"seek\":null");
+		return;
+	}
+	fprintf(out, "\"seek\":[");
+	for (size_t i = 0UL; i < music->tracks.count; i++) {
+		Track *t = track_get(music->tracks, i);
+		uint64_t start_ns = stats_now_ns();
+		ma_decoder_seek_to_pcm_frame(&music->decoder, track_start_frame(t, sample_rate));
+		ma_decoder_read_pcm_frames(&music->decoder, buffer, DECODE_CHUNK, NULL);	// some backends seek lazily
+		latencies[i] = ms_since(start_ns) * 1e3;
+		fprintf(out, "%s{\"track\":%zu,\"start_s\":%u,\"us\":%.1f}", i ? "," : "", i, t->start, latencies[i]);
+	}
+	fprintf(out, "]");
+
+	if (music->tracks.count) {
+		qsort(latencies, music->tracks.count, sizeof(double), compare_double);
+		fprintf(out, ",\"seek_us\":{\"min\":%.1f,\"p50\":%.1f,\"max\":%.1f}",
+			latencies[0], latencies[music->tracks.count / 2UL], latencies[music->tracks.count - 1UL]);
+	}
+	free(latencies);
+}
+
+static void bench_decode(FILE *out, const char *music_path, double decode_seconds) {
+	static float buffer[DECODE_CHUNK * CHANNEL_COUNT];
+	ma_decoder decoder;
+	if (audio_decoder_open(music_path, &decoder) != MA_SUCCESS) return;
+
+	ma_uint64 limit = (ma_uint64) (decode_seconds * decoder.outputSampleRate), frames = 0, read;
+	uint64_t start_ns = stats_now_ns();
+	while (frames < limit && ma_decoder_read_pcm_frames(&decoder, buffer, DECODE_CHUNK, &read) == MA_SUCCESS && read) frames += read;
+	double seconds = (stats_now_ns() - start_ns) / 1e9;
+
+	fprintf(out, ",\"decode\":{\"frames\":%llu,\"seconds\":%.3f,\"frames_per_s\":%.0f,\"realtime_factor\":%.1f}",
+		(unsigned long long) frames, seconds, frames / seconds, frames / (double) decoder.outputSampleRate / seconds);
+	ma_decoder_uninit(&decoder);
+}
+
+// Read syscalls of the whole process so far (`syscr`), -1 without /proc/self/io. One read(2) itself.
+static long long proc_read_syscalls(void) {
+	char buffer[512];
+	int fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -1LL;
+	ssize_t n = read(fd, buffer, sizeof(buffer) - 1UL);
+	close(fd);
+	if (n <= 0) return -1LL;
+	buffer[n] = '\0';
+	const char *syscr = strstr(buffer, "syscr:");
+	return syscr ? atoll(syscr + strlen("syscr:")) : -1LL;
+}
+
+// Opens the file with the page cache dropped for it first (best effort) and decodes from its start the
+// way the decoder thread reads, then reports what that cost per hour of playback, the open included.
+static void bench_io_run(FILE *out, const char *music_path, double decode_seconds, bool mapped) {
+	static float buffer[IO_CHUNK * CHANNEL_COUNT];
+	ma_decoder_config config = ma_decoder_config_init(ma_format_f32, CHANNEL_COUNT, audio_sample_rate());
+	ma_decoder decoder;
+	MapVfs vfs;
+	map_vfs_init(&vfs);
+
+	int fd = open(music_path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+#ifdef POSIX_FADV_DONTNEED
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+		close(fd);
+	}
+
+	long long overhead = proc_read_syscalls();
+	overhead = proc_read_syscalls() - overhead;
+	struct rusage before, after;
+	getrusage(RUSAGE_SELF, &before);
+	long long syscalls = proc_read_syscalls();
+	uint64_t start_ns = stats_now_ns();
+	if ((mapped ? ma_decoder_init_vfs(&vfs, music_path, &config, &decoder) : ma_decoder_init_file(music_path, &config, &decoder)) != MA_SUCCESS) {
+		fprintf(out, "\"%s\":null", mapped ? "mmap" : "stdio");
+		return;
+	}
+
+	ma_uint64 limit = (ma_uint64) (decode_seconds * decoder.outputSampleRate), frames = 0, read;
+	while (frames < limit && ma_decoder_read_pcm_frames(&decoder, buffer, IO_CHUNK, &read) == MA_SUCCESS && read) frames += read;
+
+	double seconds = (stats_now_ns() - start_ns) / 1e9;
+	if (syscalls >= 0) syscalls = proc_read_syscalls() - syscalls - overhead;
+	getrusage(RUSAGE_SELF, &after);
+	double cpu_ms = (after.ru_utime.tv_sec - before.ru_utime.tv_sec + after.ru_stime.tv_sec - before.ru_stime.tv_sec) * 1e3
+		+ (after.ru_utime.tv_usec - before.ru_utime.tv_usec + after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1e3;
+	double hours = frames ? frames / (double) decoder.outputSampleRate / 3600.0 : 1.0;
+
+	fprintf(out, "\"%s\":{\"frames\":%llu,\"seconds\":%.3f,\"read_syscalls_per_hour\":%.0f,\"advice_per_hour\":%.0f,\"cpu_ms_per_hour\":%.1f,\"major_faults_per_hour\":%.0f,\"minor_faults_per_hour\":%.0f}",
+		mapped ? "mmap" : "stdio", (unsigned long long) frames, seconds, syscalls >= 0 ? syscalls / hours : -1.0,
+		atomic_load(&vfs.advice) / hours, cpu_ms / hours,
+		(after.ru_majflt - before.ru_majflt) / hours, (after.ru_minflt - before.ru_minflt) / hours);
+	ma_decoder_uninit(&decoder);
+}
+
+static void bench_io(FILE *out, const char *music_path, double decode_seconds) {
+	fprintf(out, "\"io\":{\"read_frames\":%d,", IO_CHUNK);
+	bench_io_run(out, music_path, decode_seconds, false);
+	fprintf(out, ",");
+	bench_io_run(out, music_path, decode_seconds, true);
+	fprintf(out, "}");
+}
+
+static void bench_playback(FILE *out, MusicCollection *music, double play_seconds) {
+	audio_reset_stats();
+	audio_select_track(music, 0);
+	audio_unpause();
+	usleep((useconds_t) (play_seconds * 1e6));
+	audio_pause();
+
+	CallbackStatsSnapshot snap = audio_stats();
+	fprintf(out, ",\"playback\":{\"backend\":\"null\",\"callbacks\":%llu,\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,\"budget_us\":%.1f,\"underruns\":%llu,\"xruns\":%llu,\"short_reads\":%llu}",
+		(unsigned long long) snap.callbacks, snap.p50_us, snap.p99_us, snap.p999_us, snap.max_us, snap.budget_us,
+		(unsigned long long) snap.underruns, (unsigned long long) snap.xruns, (unsigned long long) snap.short_reads);
+}
+
+typedef struct {
+	SessionEngine *engine;
+	int *sessions;
+	size_t count;
+	size_t worker, workers;
+	size_t blocks;
+} SessionLoad;
+
+// Round robin over its share of the sessions, a block each, as a server feeding that many clients would.
+static void *session_load_worker(void *arg) {
+	SessionLoad *load = arg;
+	float *block = malloc(SESSION_BLOCK * CHANNEL_COUNT * sizeof(float));
+	if (!block) {
+		nob_log(NOB_ERROR, "Session load worker could not allocate its block");
+		return NULL;
+	}
+	for (size_t b = 0UL; b < load->blocks; b++)
+		for (size_t i = load->worker; i < load->count; i += load->workers)
+			session_read(load->engine, load->sessions[i], block, SESSION_BLOCK);
+	free(block);
+	return NULL;
+}
+
+// Clustered: groups of SESSION_GROUP sessions on the same track, 50ms apart, which the cache should
+// decode once per group. Spread: every session somewhere else in the file, decoded once each.
+static void bench_session_load(FILE *out, MusicCollection *music, size_t count, bool clustered) {
+	SessionEngine *engine = session_engine_create(0, 0);
+	if (!engine || session_engine_add(engine, music) < 0) {
+		session_engine_destroy(engine);
+		return;
+	}
+	ma_uint32 sample_rate = music->decoder.outputSampleRate;
+	size_t tracks = music->tracks.count;
+	size_t workers = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers > count) workers = count;
+	int *sessions = malloc(count * sizeof(int));
+	SessionLoad *loads = calloc(workers, sizeof(SessionLoad));
+	pthread_t *tids = calloc(workers, sizeof(pthread_t));
+	if (!sessions || !loads || !tids) {
+		nob_log(NOB_ERROR, "Could not allocate %zu sessions", count);
+		fprintf(out, "\"%s\":null", clustered ? "clustered" : "spread");
+		goto defer;
+	}
+	for (size_t i = 0UL; i < count; i++) {
+		size_t track = clustered ? (i / SESSION_GROUP) % tracks : i % tracks;
+		sessions[i] = session_open(engine, 0, track, true);
+		const Track *t = track_get(music->tracks, track);
+		double length = (t->stop_us - t->start_us) / 1e6, rounds = (double) (count + tracks - 1UL) / tracks;
+		session_seek(engine, sessions[i], clustered ? (i % SESSION_GROUP) * 0.05 : (i / tracks) * length / rounds);
+	}
+
+	size_t blocks = (size_t) (SESSION_SECONDS * sample_rate / SESSION_BLOCK);
+	struct timespec cpu_start, cpu_end;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+	uint64_t start_ns = stats_now_ns();
+	size_t started = 0UL;
+	for (size_t w = 0UL; w < workers; w++) {
+		loads[w] = (SessionLoad) { engine, sessions, count, w, workers, blocks };
+		if (pthread_create(&tids[w], NULL, session_load_worker, &loads[w]) == 0) started++;
+		else loads[w].workers = 0UL;
+	}
+	if (started == 0UL) {		// no threads: one pass over everything here
+		loads[0].workers = 1UL;
+		session_load_worker(&loads[0]);
+	}
+	for (size_t w = 0UL; w < workers; w++) if (loads[w].workers) pthread_join(tids[w], NULL);
+	double wall = (stats_now_ns() - start_ns) / 1e9;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+	double cpu = (cpu_end.tv_sec - cpu_start.tv_sec) + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9;
+
+	SessionStats stats = session_engine_stats(engine);
+	double audio = count * (double) blocks * SESSION_BLOCK / sample_rate;
+	fprintf(out, "\"%s\":{\"wall_s\":%.3f,\"cpu_s\":%.3f,\"sessions_per_core\":%.1f,\"hits\":%llu,\"shared\":%llu,\"misses\":%llu,\"evictions\":%llu,\"decoded_frames\":%llu,\"served_frames\":%llu,\"served_per_decoded\":%.2f}",
+		clustered ? "clustered" : "spread", wall, cpu, cpu > 0.0 ? audio / cpu : 0.0,
+		(unsigned long long) stats.hits, (unsigned long long) stats.shared, (unsigned long long) stats.misses, (unsigned long long) stats.evictions,
+		(unsigned long long) stats.decoded_frames, (unsigned long long) stats.served_frames,
+		stats.decoded_frames ? (double) stats.served_frames / stats.decoded_frames : 0.0);
+
+defer:
+	free(tids);
+	free(loads);
+	free(sessions);
+	session_engine_destroy(engine);
+}
+
+static void bench_sessions(FILE *out, MusicCollection *music, size_t count) {
+	fprintf(out, ",\"sessions\":{\"count\":%zu,\"seconds\":%.0f,\"block\":%d,", count, SESSION_SECONDS, SESSION_BLOCK);
+	bench_session_load(out, music, count, true);
+	fprintf(out, ",");
+	bench_session_load(out, music, count, false);
+	fprintf(out, "}");
+}
+
+static bool bench_file(FILE *out, Arena *a, const char *arg, double play_seconds, double decode_seconds, size_t sessions) {
+	const char *music_path = arg, *timestamp_path;
+	const char *eq = strchr(arg, '=');
+	if (eq) {
+		music_path = arena_sprintf(a, "%.*s", (int) (eq - arg), arg);
+		timestamp_path = eq + 1;
+	} else {
+		const char *dot = strrchr(arg, '.'), *slash = strrchr(arg, '/');
+		size_t stem = dot && (!slash || dot > slash) ? (size_t) (dot - arg) : strlen(arg);
+		timestamp_path = arena_sprintf(a, "%.*s.time", (int) stem, arg);
+	}
+
+	MusicCollection music;
+	uint64_t start_ns = stats_now_ns();
+	if (audio_decoder_open(music_path, &music.decoder) != MA_SUCCESS) {
+		nob_log(NOB_ERROR, "Could not open `%s`", music_path);
+		fprintf(out, "{\"path\":");
+		json_string(out, music_path);
+		fprintf(out, ",\"error\":\"could not open\"}");
+		return false;
+	}
+	double open_ms = ms_since(start_ns);
+	start_ns = stats_now_ns();
+	audio_decoder_build_seek_table(&music.decoder);
+	double seek_table_ms = ms_since(start_ns);
+	ma_uint64 frames = 0;
+	ma_decoder_get_length_in_pcm_frames(&music.decoder, &frames);
+
+	fprintf(out, "{\"path\":");
+	json_string(out, music_path);
+	fprintf(out, ",\"format\":\"%s\",\"frames\":%llu,\"sample_rate\":%u,\"open_ms\":%.3f,\"seek_table_ms\":%.3f,",
+		decoder_format_name(&music.decoder), (unsigned long long) frames, music.decoder.outputSampleRate, open_ms, seek_table_ms);
+	ma_decoder_uninit(&music.decoder);
+	bench_io(out, music_path, decode_seconds);
+	fprintf(out, ",");
+
+	bool has_tracks = nob_file_exists(timestamp_path) == 1 && audio_load_tracks(a, &music, music_path, timestamp_path);
+	if (has_tracks) {
+		bench_parse(out, timestamp_path);
+		fprintf(out, ",\"tracks\":%zu,", music.tracks.count);
+		bench_seek(out, &music);
+	} else {
+		nob_log(NOB_WARNING, "No timestamps for `%s` (looked for `%s`), skipping track benchmarks", music_path, timestamp_path);
+		fprintf(out, "\"tracks\":0");
+	}
+	bench_decode(out, music_path, decode_seconds);
+	if (has_tracks) {
+		if (play_seconds > 0.0) bench_playback(out, &music, play_seconds);
+		if (sessions) bench_sessions(out, &music, sessions);
+		audio_unload_tracks(&music);
+	}
+	fprintf(out, "}");
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	int result = 0;
+	FILE *out = stdout;
+	double play_seconds = DEFAULT_PLAY, decode_seconds = DEFAULT_DECODE;
+	size_t sessions = DEFAULT_SESSIONS;
+	Arena a = {0};
+
+	const char *program = nob_shift_args(&argc, &argv);
+	while (argc > 0 && **argv == '-') {
+		const char *flag = nob_shift_args(&argc, &argv);
+		if (is_flag(flag, FLAG_OUTPUT) && argc > 0) {
+			const char *path = nob_shift_args(&argc, &argv);
+			if (!(out = fopen(path, "w"))) {
+				nob_log(NOB_ERROR, "Could not open `%s`: %s", path, strerror(errno));
+				return 1;
+			}
+		}
+		else if (is_flag(flag, FLAG_PLAY) && argc > 0) play_seconds = atof(nob_shift_args(&argc, &argv));
+		else if (is_flag(flag, FLAG_DECODE) && argc > 0) decode_seconds = atof(nob_shift_args(&argc, &argv));
+		else if (is_flag(flag, FLAG_SESSIONS) && argc > 0) sessions = (size_t) atol(nob_shift_args(&argc, &argv));
+		else {
+			nob_log(NOB_ERROR, "Unknown option `%s`", flag);
+			usage(program);
+			return 1;
+		}
+	}
+	if (argc <= 0) {
+		nob_log(NOB_ERROR, "Missing input file");
+		usage(program);
+		return 1;
+	}
+
+	audio_set_headless(true);
+	if (audio_init() != MA_SUCCESS) nob_return_defer(2);
+
+	fprintf(out, "{");
+	json_machine(out);
+	fprintf(out, ",\"files\":[");
+	for (int i = 0; argc > 0; i++) {
+		if (i) fprintf(out, ",");
+		if (!bench_file(out, &a, nob_shift_args(&argc, &argv), play_seconds, decode_seconds, sessions)) result = 3;
+	}
+	fprintf(out, "]}\n");
+
+defer:
+	audio_deinit();
+	if (out != stdout) fclose(out);
+	arena_free(&a);
+	return result;
+}
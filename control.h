@@ -0,0 +1,407 @@
+#ifndef CONTROL_H_
+#define CONTROL_H_
+#include "audio.h"
+
+// The playback main loop. On Linux it is one epoll over raw-mode stdin, a signalfd for SIGINT/SIGTERM/
+// SIGWINCH, a timerfd ticking while something plays, and an eventfd other threads wake it with after
+// queueing a command; between events it sleeps in epoll_wait, so an idle player costs nothing.
+//
+// Other modules add their own fds to the same loop with `control_watch`; their handlers run on the loop
+// thread, so they may call `control_apply` and read the audio state directly.
+//
+// Keys: space pause, n/↓ next, p/↑ previous, ←/→ seek 5s, r restart, l loop, ^L redraw, q quit.
+typedef enum {
+	CONTROL_PAUSE,		// toggles
+	CONTROL_NEXT,		// the first queued track, or the one after
+	CONTROL_PREV,
+	CONTROL_SEEK,		// value: seconds, relative
+	CONTROL_RESTART,
+	CONTROL_LOOP,		// toggles
+	CONTROL_SELECT,		// value: track index
+	CONTROL_ENQUEUE,	// value: track index, played next after the queued ones
+	CONTROL_CLEAR,		// empties the queue
+	CONTROL_REDRAW,		// repaint the whole screen
+	CONTROL_QUIT,
+} ControlKind;
+
+typedef struct {
+	ControlKind kind;
+	double value;
+} ControlCommand;
+
+// Before `audio_init`: blocks the signals the loop takes, so every thread started afterwards inherits the mask.
+// Without `keyboard` stdin is left alone, for players driven from elsewhere.
+bool control_init(bool keyboard);
+void control_deinit();
+// From any thread; false if the queue is full.
+bool control_push(ControlCommand command);
+// On the loop thread only (from a watch handler): runs `command` before returning.
+void control_apply(ControlCommand command);
+// Tracks queued by CONTROL_ENQUEUE, next first. Loop thread only.
+const size_t *control_queued(size_t *count);
+
+// `events` are EPOLL* bits. Handlers run on the loop thread and may unwatch any fd, their own included.
+typedef void (*ControlHandler)(int fd, uint32_t events, void *user);
+bool control_watch(int fd, uint32_t events, ControlHandler handler, void *user);
+bool control_rewatch(int fd, uint32_t events);
+void control_unwatch(int fd);		// before closing `fd`
+// Called after every batch of events and on every tick while playing; `full` after a resize or ^L.
+typedef void (*ControlRedraw)(MusicCollection *music, bool full);
+
+// Plays `music` from the selected track until asked to quit. `redraw` may be NULL.
+void control_run(MusicCollection *music, ControlRedraw redraw);
+
+#endif // CONTROL_H_
+
+#ifdef CONTROL_IMPLEMENTATION
+#undef CONTROL_IMPLEMENTATION
+#include <pthread.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#define CONTROL_QUEUE		64			// commands, a power of two
+#define CONTROL_TICK_NS		250000000L	// redraws, and end of track checks without events, while playing
+#define CONTROL_SEEK_STEP	5.0
+#define CONTROL_EVENTS		64			// per epoll_wait
+
+typedef struct {
+	int fd;						// -1 once unwatched, freed after the batch of events it may still be in
+	ControlHandler handler;
+	void *user;
+} ControlWatch;
+
+static struct {
+	pthread_mutex_t mutex;
+	ControlCommand items[CONTROL_QUEUE];
+	size_t head, tail;
+	int epoll;
+	int wakeup;					// eventfd, -1 elsewhere
+	int signals;				// signalfd
+	int timer;					// timerfd
+	bool raw;					// stdin is a terminal we switched to raw mode
+	struct termios saved;
+	bool quit;
+	bool repaint;				// the next redraw is a full one
+	bool events;				// the end of a track comes as an event instead of being polled for
+	MusicCollection *music;		// while running
+	struct { size_t *items; size_t count, capacity; } queued;
+	struct { ControlWatch **items; size_t count, capacity; } watches;		// by fd
+	struct { ControlWatch **items; size_t count, capacity; } retired;
+} control = { .mutex = PTHREAD_MUTEX_INITIALIZER, .epoll = -1, .wakeup = -1, .signals = -1, .timer = -1 };
+
+bool control_push(ControlCommand command) {
+	pthread_mutex_lock(&control.mutex);
+	bool ok = control.tail - control.head < CONTROL_QUEUE;
+	if (ok) control.items[control.tail++ & (CONTROL_QUEUE - 1)] = command;
+	pthread_mutex_unlock(&control.mutex);
+#ifdef __linux__
+	uint64_t one = 1;
+	if (ok && control.wakeup >= 0 && write(control.wakeup, &one, sizeof(one)) < 0) nob_log(NOB_WARNING, "Could not wake the control loop: %s", strerror(errno));
+#endif
+	return ok;
+}
+
+static bool control_pop(ControlCommand *command) {
+	pthread_mutex_lock(&control.mutex);
+	bool ok = control.head != control.tail;
+	if (ok) *command = control.items[control.head++ & (CONTROL_QUEUE - 1)];
+	pthread_mutex_unlock(&control.mutex);
+	return ok;
+}
+
+static void control_select(MusicCollection *music, size_t index) {
+	audio_select_track(music, index);
+	if (audio_is_paused()) audio_unpause();
+}
+
+static void control_execute(MusicCollection *music, ControlCommand command) {
+	size_t count = music->tracks.count, index = audio_current_index();
+	switch (command.kind) {
+	case CONTROL_PAUSE:
+		if (audio_is_paused()) audio_unpause();
+		else audio_pause();
+		nob_log(NOB_INFO, audio_is_paused() ? "Paused" : "Playing");
+		break;
+	case CONTROL_NEXT:
+		if (control.queued.count) {
+			index = control.queued.items[0];
+			memmove(control.queued.items, control.queued.items + 1, --control.queued.count * sizeof(size_t));
+			control_select(music, index);
+		}
+		else control_select(music, (index + 1UL) % count);
+		break;
+	case CONTROL_PREV: control_select(music, (index + count - 1UL) % count); break;
+	case CONTROL_SEEK: audio_seek(command.value); break;
+	case CONTROL_RESTART: audio_restart(); break;
+	case CONTROL_LOOP:
+		audio_set_looping(!audio_is_looping());
+		nob_log(NOB_INFO, audio_is_looping() ? "Looping the track" : "Playing through");
+		break;
+	case CONTROL_SELECT:
+		if (command.value >= 0.0 && (size_t) command.value < count) control_select(music, (size_t) command.value);
+		break;
+	case CONTROL_ENQUEUE:
+		if (command.value >= 0.0 && (size_t) command.value < count) nob_da_append(&control.queued, (size_t) command.value);
+		break;
+	case CONTROL_CLEAR: control.queued.count = 0UL; break;
+	case CONTROL_REDRAW: control.repaint = true; break;
+	case CONTROL_QUIT: control.quit = true; break;
+	}
+}
+
+void control_apply(ControlCommand command) {
+	if (control.music) control_execute(control.music, command);
+}
+
+const size_t *control_queued(size_t *count) {
+	*count = control.queued.count;
+	return control.queued.items;
+}
+
+// Bytes read from stdin, escape sequences included; unknown keys are ignored.
+static void control_keys(const char *keys, size_t size) {
+	for (size_t i = 0UL; i < size; i++) {
+		ControlCommand command = { .kind = CONTROL_QUIT, .value = 0.0 };
+		if (keys[i] == '\x1b' && i + 2UL < size && keys[i + 1] == '[') {
+			switch (keys[i + 2]) {
+			case 'A': command.kind = CONTROL_PREV; break;
+			case 'B': command.kind = CONTROL_NEXT; break;
+			case 'C': command = (ControlCommand) { CONTROL_SEEK, CONTROL_SEEK_STEP }; break;
+			case 'D': command = (ControlCommand) { CONTROL_SEEK, -CONTROL_SEEK_STEP }; break;
+			default: i += 2UL; continue;
+			}
+			i += 2UL;
+		}
+		else switch (keys[i]) {
+			case ' ': command.kind = CONTROL_PAUSE; break;
+			case 'n': command.kind = CONTROL_NEXT; break;
+			case 'p': command.kind = CONTROL_PREV; break;
+			case 'r': command.kind = CONTROL_RESTART; break;
+			case 'l': command.kind = CONTROL_LOOP; break;
+			case '\x0c': command.kind = CONTROL_REDRAW; break;
+			case 'q': case '\x04': command.kind = CONTROL_QUIT; break;		// ^D too, as raw mode eats EOF
+			default: continue;
+		}
+		control_push(command);
+	}
+}
+
+#ifdef __linux__
+bool control_watch(int fd, uint32_t events, ControlHandler handler, void *user) {
+	if (fd < 0 || control.epoll < 0) return false;
+	if ((size_t) fd >= control.watches.count) {
+		size_t count = (size_t) fd + 1UL;
+		if (count > control.watches.capacity) {
+			size_t capacity = control.watches.capacity ? control.watches.capacity : 16UL;
+			while (capacity < count) capacity *= 2UL;
+			ControlWatch **items = realloc(control.watches.items, capacity * sizeof(*items));
+			if (!items) return false;
+			control.watches.items = items;
+			control.watches.capacity = capacity;
+		}
+		memset(control.watches.items + control.watches.count, 0, (count - control.watches.count) * sizeof(*control.watches.items));
+		control.watches.count = count;
+	}
+	if (control.watches.items[fd]) return false;
+
+	ControlWatch *watch = malloc(sizeof(ControlWatch));
+	if (!watch) return false;
+	*watch = (ControlWatch) { fd, handler, user };
+	struct epoll_event event = { .events = events, .data.ptr = watch };
+	if (epoll_ctl(control.epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+		free(watch);
+		return false;
+	}
+	control.watches.items[fd] = watch;
+	return true;
+}
+
+bool control_rewatch(int fd, uint32_t events) {
+	if (fd < 0 || (size_t) fd >= control.watches.count || !control.watches.items[fd]) return false;
+	struct epoll_event event = { .events = events, .data.ptr = control.watches.items[fd] };
+	return epoll_ctl(control.epoll, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+void control_unwatch(int fd) {
+	if (fd < 0 || (size_t) fd >= control.watches.count || !control.watches.items[fd]) return;
+	ControlWatch *watch = control.watches.items[fd];
+	epoll_ctl(control.epoll, EPOLL_CTL_DEL, fd, NULL);
+	control.watches.items[fd] = NULL;
+	watch->fd = -1;
+	nob_da_append(&control.retired, watch);
+}
+
+static void control_on_stdin(int fd, uint32_t events, void *user) {
+	(void) events, (void) user;
+	char keys[64];
+	ssize_t size = read(fd, keys, sizeof(keys));
+	if (size <= 0) {		// EOF: nothing more will ever come from a pipe
+		control_unwatch(fd);
+		if (!control.raw) control_push((ControlCommand) { .kind = CONTROL_QUIT });
+	}
+	else control_keys(keys, (size_t) size);
+}
+
+static void control_on_signal(int fd, uint32_t events, void *user) {
+	(void) events, (void) user;
+	struct signalfd_siginfo info;
+	while (read(fd, &info, sizeof(info)) == sizeof(info))
+		control_push((ControlCommand) { .kind = info.ssi_signo == SIGWINCH ? CONTROL_REDRAW : CONTROL_QUIT });
+}
+
+static void control_on_timer(int fd, uint32_t events, void *user) {
+	(void) events, (void) user;
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) > 0 && !control.events && audio_track_ended())
+		control_push((ControlCommand) { .kind = CONTROL_NEXT });
+}
+
+// On the dispatcher thread, the moment the last frame goes out. A select that got in first has already
+// dropped it, or at least made the track not ended any more.
+static void control_on_audio_event(const MstampEvent *event, void *user) {
+	(void) user;
+	if (event->kind == MSTAMP_EVENT_TRACK_END && audio_track_ended()) control_push((ControlCommand) { .kind = CONTROL_NEXT });
+}
+
+static void control_on_wakeup(int fd, uint32_t events, void *user) {
+	(void) events, (void) user;
+	uint64_t count;
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) nob_log(NOB_WARNING, "Could not read control wakeup: %s", strerror(errno));
+}
+#else
+bool control_watch(int fd, uint32_t events, ControlHandler handler, void *user) {
+	(void) fd, (void) events, (void) handler, (void) user;
+	return false;
+}
+
+bool control_rewatch(int fd, uint32_t events) {
+	(void) fd, (void) events;
+	return false;
+}
+
+void control_unwatch(int fd) { (void) fd; }
+#endif
+
+bool control_init(bool keyboard) {
+	if (keyboard && isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &control.saved) == 0) {
+		struct termios raw = control.saved;
+		raw.c_lflag &= (tcflag_t) ~(ICANON | ECHO);		// keep ISIG: ^C arrives as SIGINT, on the signalfd
+		raw.c_cc[VMIN] = 1;
+		raw.c_cc[VTIME] = 0;
+		control.raw = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+	}
+#ifdef __linux__
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGWINCH);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	control.epoll = epoll_create1(EPOLL_CLOEXEC);
+	control.signals = signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+	control.timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	control.wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (control.epoll < 0 || control.signals < 0 || control.timer < 0 || control.wakeup < 0
+	|| !control_watch(control.signals, EPOLLIN, control_on_signal, NULL)
+	|| !control_watch(control.timer, EPOLLIN, control_on_timer, NULL)
+	|| !control_watch(control.wakeup, EPOLLIN, control_on_wakeup, NULL)) {
+		nob_log(NOB_ERROR, "Could not set up the control loop: %s", strerror(errno));
+		control_deinit();
+		return false;
+	}
+	if (keyboard) control_watch(STDIN_FILENO, EPOLLIN, control_on_stdin, NULL);		// a regular file can't be polled
+#endif
+	return true;
+}
+
+void control_deinit() {
+	if (control.raw) tcsetattr(STDIN_FILENO, TCSANOW, &control.saved);
+	control.raw = false;
+	for (size_t fd = 0UL; fd < control.watches.count; fd++) free(control.watches.items[fd]);
+	for (size_t i = 0UL; i < control.retired.count; i++) free(control.retired.items[i]);
+	nob_da_free(&control.watches);
+	nob_da_free(&control.retired);
+	nob_da_free(&control.queued);
+	memset(&control.watches, 0, sizeof(control.watches));
+	memset(&control.retired, 0, sizeof(control.retired));
+	memset(&control.queued, 0, sizeof(control.queued));
+	if (control.epoll >= 0) close(control.epoll);
+	if (control.signals >= 0) close(control.signals);
+	if (control.timer >= 0) close(control.timer);
+	if (control.wakeup >= 0) close(control.wakeup);
+	control.epoll = control.signals = control.timer = control.wakeup = -1;
+}
+
+#ifdef __linux__
+static void control_arm_timer(bool on) {
+	struct itimerspec spec = {0};
+	if (on) spec.it_interval.tv_nsec = spec.it_value.tv_nsec = CONTROL_TICK_NS;
+	timerfd_settime(control.timer, 0, &spec, NULL);
+}
+
+void control_run(MusicCollection *music, ControlRedraw redraw) {
+	bool ticking = false;
+	control.music = music;
+	control.quit = false;
+	control.repaint = true;
+	control.events = audio_set_event_handler(control_on_audio_event, NULL);
+	while (!control.quit) {
+		if (redraw) redraw(music, control.repaint);
+		control.repaint = false;
+		// Only a clock on screen, or a track that can run out with no event to say so, needs a tick.
+		bool tick = !audio_is_paused() && (redraw || (!control.events && !audio_is_looping()));
+		if (tick != ticking) control_arm_timer(ticking = tick);
+
+		struct epoll_event events[CONTROL_EVENTS];
+		int ready = epoll_wait(control.epoll, events, NOB_ARRAY_LEN(events), -1);
+		if (ready < 0 && errno != EINTR) {
+			nob_log(NOB_ERROR, "epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+		for (int i = 0; i < ready; i++) {
+			ControlWatch *watch = events[i].data.ptr;
+			if (watch->fd >= 0) watch->handler(watch->fd, events[i].events, watch->user);
+		}
+		for (size_t i = 0UL; i < control.retired.count; i++) free(control.retired.items[i]);
+		control.retired.count = 0UL;
+
+		ControlCommand command;
+		while (!control.quit && control_pop(&command)) control_execute(music, command);
+	}
+	control_arm_timer(false);
+	if (control.events) audio_set_event_handler(NULL, NULL);
+	control.events = false;
+	control.music = NULL;
+}
+#else
+// No epoll: block on stdin alone, commands from other threads run on the next key.
+void control_run(MusicCollection *music, ControlRedraw redraw) {
+	control.music = music;
+	control.quit = false;
+	control.repaint = true;
+	while (!control.quit) {
+		if (redraw) redraw(music, control.repaint);
+		control.repaint = false;
+		char keys[64];
+		ssize_t size = read(STDIN_FILENO, keys, sizeof(keys));
+		if (size <= 0) control_push((ControlCommand) { .kind = CONTROL_QUIT });
+		else control_keys(keys, (size_t) size);
+		ControlCommand command;
+		while (!control.quit && control_pop(&command)) control_execute(music, command);
+	}
+	control.music = NULL;
+}
+#endif
+
+#undef CONTROL_QUEUE
+#undef CONTROL_TICK_NS
+#undef CONTROL_SEEK_STEP
+#undef CONTROL_EVENTS
+#endif // CONTROL_IMPLEMENTATION
@@ -0,0 +1,313 @@
+#ifndef DAEMON_H_
+#define DAEMON_H_
+#include "audio.h"
+
+// Playback driven over a Unix stream socket. The device stays open and the decoder seeked, so a command
+// costs one epoll wakeup and whatever it does to the audio, not a process start. Clients are served by
+// the control loop itself (see `control_watch`): any number of them, each line answered before the next
+// is read, in order. Replies are one line starting with `ok` or `err <reason>`; `list` follows its `ok`
+// with one line per track.
+//
+//	play [<index>|<title>]	resume, or select by 0-based index or case-insensitive title substring
+//	pause | toggle | next | prev | restart
+//	seek <seconds>			relative, negative goes back
+//	loop [on|off]			toggles without an argument
+//	queue <index>|<title>	play after the current track (and the ones queued before)
+//	clear					empties the queue
+//	state					ok <playing|paused> <index> <position> <length> <loop|once> <queued> <title>
+//	list					ok <count>, then <index>\t<start>\t<title> per track
+//	ping | close | shutdown	shutdown stops the player
+bool daemon_start(MusicCollection *music, const char *socket_path);
+void daemon_stop();
+
+#endif // DAEMON_H_
+
+#ifdef DAEMON_IMPLEMENTATION
+#undef DAEMON_IMPLEMENTATION
+#include <fcntl.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#define DAEMON_LINE		1024		// longest command
+#define DAEMON_BACKLOG	128
+
+typedef struct {
+	int fd;
+	size_t used;
+	char line[DAEMON_LINE];
+	Nob_StringBuilder out;		// replies the socket hasn't taken yet
+	size_t sent;
+} DaemonClient;
+
+static struct {
+	MusicCollection *music;
+	int listener;
+	const char *path;
+	struct { DaemonClient **items; size_t count, capacity; } clients;
+} daemon_state = { .listener = -1 };
+
+#ifdef __linux__
+static void daemon_reply(Nob_StringBuilder *out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void daemon_reply(Nob_StringBuilder *out, const char *format, ...) {
+	char buffer[256];
+	va_list args, again;
+	va_start(args, format);
+	va_copy(again, args);
+	int size = vsnprintf(buffer, sizeof(buffer), format, args);
+	if (size >= 0 && (size_t) size < sizeof(buffer)) nob_sb_append_buf(out, buffer, (size_t) size);
+	else if (size > 0) {		// a long title
+		char *line = malloc((size_t) size + 1UL);
+		if (line && vsnprintf(line, (size_t) size + 1UL, format, again) == size) nob_sb_append_buf(out, line, (size_t) size);
+		free(line);
+	}
+	va_end(again);
+	va_end(args);
+}
+
+static void daemon_drop(DaemonClient *client) {
+	control_unwatch(client->fd);
+	close(client->fd);
+	for (size_t i = 0UL; i < daemon_state.clients.count; i++) {
+		if (daemon_state.clients.items[i] != client) continue;
+		daemon_state.clients.items[i] = daemon_state.clients.items[--daemon_state.clients.count];
+		break;
+	}
+	nob_sb_free(&client->out);
+	free(client);
+}
+
+// An index, or the first title containing `arg`; false if neither.
+static bool daemon_find(Nob_StringView arg, size_t *index) {
+	Tracks tracks = daemon_state.music->tracks;
+	if (arg.count == 0) return false;
+	size_t value = 0UL, digits = 0UL;
+	while (digits < arg.count && isdigit((unsigned char) arg.items[digits])) value = value * 10UL + (size_t) (arg.items[digits++] - '0');
+	if (digits == arg.count) {
+		*index = value;
+		return value < tracks.count;
+	}
+	char needle[DAEMON_LINE];
+	snprintf(needle, sizeof(needle), SV_Fmt, SV_Arg(arg));
+	for (size_t i = 0UL; i < tracks.count; i++) {
+		if (!strcasestr(track_get(tracks, i)->title, needle)) continue;
+		*index = i;
+		return true;
+	}
+	return false;
+}
+
+static void daemon_state_line(Nob_StringBuilder *out) {
+	size_t index = audio_current_index(), queued = 0UL;
+	double position = 0.0, length = 0.0;
+	audio_position(&position, &length);
+	control_queued(&queued);
+	daemon_reply(out, "ok %s %zu %.3f %.3f %s %zu %s\n", audio_is_paused() ? "paused" : "playing", index, position, length,
+		audio_is_looping() ? "loop" : "once", queued, track_get(daemon_state.music->tracks, index)->title);
+}
+
+// Runs one command line, appending its reply. False closes the connection once the reply is out.
+static bool daemon_execute(Nob_StringView line, Nob_StringBuilder *out) {
+	line = nob_sv_trim(line);
+	Nob_StringView verb = nob_sv_chop_by_delim(&line, ' ');
+	Nob_StringView arg = nob_sv_trim(line);
+	size_t index = 0UL;
+
+	if (nob_sv_eq(verb, nob_sv_from_cstr("play"))) {
+		if (arg.count == 0) {
+			if (audio_is_paused()) control_apply((ControlCommand) { .kind = CONTROL_PAUSE });
+		}
+		else if (daemon_find(arg, &index)) control_apply((ControlCommand) { CONTROL_SELECT, (double) index });
+		else return daemon_reply(out, "err no such track\n"), true;
+	}
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("pause"))) {
+		if (!audio_is_paused()) control_apply((ControlCommand) { .kind = CONTROL_PAUSE });
+	}
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("toggle"))) control_apply((ControlCommand) { .kind = CONTROL_PAUSE });
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("next"))) control_apply((ControlCommand) { .kind = CONTROL_NEXT });
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("prev"))) control_apply((ControlCommand) { .kind = CONTROL_PREV });
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("restart"))) control_apply((ControlCommand) { .kind = CONTROL_RESTART });
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("seek"))) {
+		char number[32];
+		snprintf(number, sizeof(number), SV_Fmt, SV_Arg(arg));
+		char *end = NULL;
+		double seconds = strtod(number, &end);
+		if (arg.count == 0 || *end) return daemon_reply(out, "err seek needs seconds\n"), true;
+		control_apply((ControlCommand) { CONTROL_SEEK, seconds });
+	}
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("loop"))) {
+		bool on = !audio_is_looping();
+		if (nob_sv_eq(arg, nob_sv_from_cstr("on"))) on = true;
+		else if (nob_sv_eq(arg, nob_sv_from_cstr("off"))) on = false;
+		else if (arg.count) return daemon_reply(out, "err loop takes on or off\n"), true;
+		if (on != audio_is_looping()) control_apply((ControlCommand) { .kind = CONTROL_LOOP });
+	}
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("queue"))) {
+		if (!daemon_find(arg, &index)) return daemon_reply(out, "err no such track\n"), true;
+		control_apply((ControlCommand) { CONTROL_ENQUEUE, (double) index });
+	}
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("clear"))) control_apply((ControlCommand) { .kind = CONTROL_CLEAR });
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("state"))) return daemon_state_line(out), true;
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("list"))) {
+		Tracks tracks = daemon_state.music->tracks;
+		char start[TIME_FORMAT_MAX];
+		daemon_reply(out, "ok %zu\n", tracks.count);
+		for (size_t i = 0UL; i < tracks.count; i++) {
+			time_format(start, sizeof(start), track_get(tracks, i)->start);
+			daemon_reply(out, "%zu\t%s\t%s\n", i, start, track_get(tracks, i)->title);
+		}
+		return true;
+	}
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("ping"))) ;
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("close"))) return daemon_reply(out, "ok\n"), false;
+	else if (nob_sv_eq(verb, nob_sv_from_cstr("shutdown"))) control_apply((ControlCommand) { .kind = CONTROL_QUIT });
+	else return daemon_reply(out, "err unknown command `" SV_Fmt "`\n", SV_Arg(verb)), true;
+	daemon_reply(out, "ok\n");
+	return true;
+}
+
+// False if the client is gone. A client that doesn't read its replies stops being read from, not dropped.
+static bool daemon_flush(DaemonClient *client) {
+	while (client->sent < client->out.count) {
+		ssize_t size = send(client->fd, client->out.items + client->sent, client->out.count - client->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (size < 0 && errno == EINTR) continue;
+		if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return control_rewatch(client->fd, EPOLLOUT);
+		if (size <= 0) return false;
+		client->sent += (size_t) size;
+	}
+	client->out.count = client->sent = 0UL;
+	return true;
+}
+
+static void daemon_on_client(int fd, uint32_t events, void *user) {
+	DaemonClient *client = user;
+	if (events & EPOLLOUT) {
+		if (!daemon_flush(client)) return daemon_drop(client);
+		if (client->out.count) return;
+		if (!control_rewatch(fd, EPOLLIN)) return daemon_drop(client);
+	}
+	if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+
+	bool open = true;
+	while (open) {
+		ssize_t size = recv(fd, client->line + client->used, DAEMON_LINE - client->used, MSG_DONTWAIT);
+		if (size < 0 && errno == EINTR) continue;
+		if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		if (size <= 0) {
+			open = false;
+			break;
+		}
+		client->used += (size_t) size;
+
+		// Every complete line, then what's left of the next one moved to the front.
+		size_t done = 0UL;
+		for (char *newline; open && (newline = memchr(client->line + done, '\n', client->used - done)); ) {
+			size_t length = (size_t) (newline - client->line) - done;
+			open = daemon_execute(nob_sv_from_parts(client->line + done, length), &client->out);
+			done += length + 1UL;
+		}
+		memmove(client->line, client->line + done, client->used - done);
+		client->used -= done;
+		if (open && client->used == DAEMON_LINE) {
+			daemon_reply(&client->out, "err line too long\n");
+			open = false;
+		}
+		if (client->out.count) break;		// answer before reading on
+	}
+	if (!daemon_flush(client) || (!open && client->out.count == 0)) return daemon_drop(client);
+	if (!open) shutdown(fd, SHUT_RD);		// the rest of the reply is still owed
+}
+
+static void daemon_on_listener(int fd, uint32_t events, void *user) {
+	(void) events, (void) user;
+	for (;;) {
+		int peer = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (peer < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) nob_log(NOB_WARNING, "Could not accept a client: %s", strerror(errno));
+			if (errno != EINTR) return;
+			continue;
+		}
+		DaemonClient *client = calloc(1, sizeof(DaemonClient));
+		if (!client || !control_watch(peer, EPOLLIN, daemon_on_client, client)) {
+			nob_log(NOB_WARNING, "Could not serve client fd %d", peer);
+			free(client);
+			close(peer);
+			continue;
+		}
+		client->fd = peer;
+		nob_da_append(&daemon_state.clients, client);
+	}
+}
+
+bool daemon_start(MusicCollection *music, const char *socket_path) {
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		nob_log(NOB_ERROR, "Socket path too long: %s", socket_path);
+		return false;
+	}
+	strcpy(address.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		nob_log(NOB_ERROR, "Could not create a socket: %s", strerror(errno));
+		return false;
+	}
+	// A socket file nobody answers on is left over from a player that died; one that answers is in use.
+	if (connect(fd, (struct sockaddr *) &address, sizeof(address)) == 0 || errno == EAGAIN) {
+		nob_log(NOB_ERROR, "Another player is listening on %s", socket_path);
+		close(fd);
+		return false;
+	}
+	close(fd);
+	unlink(socket_path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || chmod(socket_path, 0600) != 0
+	|| listen(fd, DAEMON_BACKLOG) != 0) {
+		nob_log(NOB_ERROR, "Could not listen on %s: %s", socket_path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return false;
+	}
+	if (!control_watch(fd, EPOLLIN, daemon_on_listener, NULL)) {
+		nob_log(NOB_ERROR, "Could not watch %s", socket_path);
+		close(fd);
+		unlink(socket_path);
+		return false;
+	}
+	daemon_state.music = music;
+	daemon_state.listener = fd;
+	daemon_state.path = socket_path;
+	nob_log(NOB_INFO, "Listening on %s", socket_path);
+	return true;
+}
+
+void daemon_stop() {
+	while (daemon_state.clients.count) daemon_drop(daemon_state.clients.items[0]);
+	nob_da_free(&daemon_state.clients);
+	daemon_state.clients.capacity = 0UL;
+	if (daemon_state.listener >= 0) {
+		control_unwatch(daemon_state.listener);
+		close(daemon_state.listener);
+		unlink(daemon_state.path);
+	}
+	daemon_state.listener = -1;
+}
+#else
+bool daemon_start(MusicCollection *music, const char *socket_path) {
+	(void) music;
+	nob_log(NOB_ERROR, "Cannot listen on %s: daemon mode needs epoll", socket_path);
+	return false;
+}
+
+void daemon_stop() {}
+#endif
+
+#undef DAEMON_LINE
+#undef DAEMON_BACKLOG
+#endif // DAEMON_IMPLEMENTATION
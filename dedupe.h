@@ -0,0 +1,314 @@
+#ifndef DEDUPE_H_
+#define DEDUPE_H_
+#include "align.h"
+
+typedef struct {
+	const char *path;
+	Tracks tracks;
+} DedupeFile;
+
+typedef struct {
+	DedupeFile *items;
+	size_t count;
+	size_t capacity;
+} DedupeLibrary;
+
+// Finds near-duplicate tracks across a library and prints every pair as a TSV line on `out`:
+// bit error rate, coverage, offset, then path, index and title of both tracks.
+// Sub-fingerprints (see align.h) of every track go into a locality-sensitive index: several tables,
+// each keyed on a different random subset of the 32 bits, so two recordings of the same music collide
+// in at least one table even when encoding flipped some bits. A query only touches the buckets of its
+// own keys, binary searched in sorted tables, and only candidates with enough consistent hits get
+// the full bit-by-bit comparison.
+bool dedupe_library(DedupeLibrary library, FILE *out, size_t workers);
+
+#endif // DEDUPE_H_
+
+#ifdef DEDUPE_IMPLEMENTATION
+#undef DEDUPE_IMPLEMENTATION
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define DEDUPE_TABLES		4
+#define DEDUPE_KEY_BITS		20
+#define DEDUPE_STRIDE		8			// index every 8th sub-fingerprint (256ms), queries use all of them
+#define DEDUPE_MIN_BITS		4			// sub-fingerprints with fewer (or more than 32 minus this) set bits are silence/hum
+#define DEDUPE_MAX_BUCKET	256			// keys shared by more entries than this carry no information
+#define DEDUPE_MIN_VOTES	4			// hits at one offset before a candidate is compared in full
+#define DEDUPE_MAX_BER		0.25f
+#define DEDUPE_MIN_COVER	0.5f		// fraction of the shorter track that has to line up
+
+typedef struct {
+	uint32_t key;
+	uint32_t track;
+	uint32_t frame;
+} DedupeEntry;
+
+typedef struct {
+	const uint32_t *prints;		// into its file's fingerprints
+	size_t count;
+	size_t file;
+	size_t index;
+} DedupeTrack;
+
+typedef struct {
+	DedupeTrack *items;
+	size_t count;
+	size_t capacity;
+} DedupeTracks;
+
+typedef struct {
+	uint32_t track;
+	int32_t offset;				// candidate frame - query frame
+} DedupeHit;
+
+typedef struct {
+	DedupeHit *items;
+	size_t count;
+	size_t capacity;
+} DedupeHits;
+
+typedef struct {
+	uint32_t query;
+	uint32_t match;
+	int32_t offset;
+	float ber;
+	float cover;
+} DedupePair;
+
+typedef struct {
+	DedupePair *items;
+	size_t count;
+	size_t capacity;
+} DedupePairs;
+
+typedef struct {
+	DedupeTracks tracks;
+	uint32_t masks[DEDUPE_TABLES];
+	DedupeEntry *tables[DEDUPE_TABLES];
+	size_t entries;				// per table
+
+	atomic_size_t next;
+	pthread_mutex_t mutex;
+	DedupePairs pairs;
+} DedupeIndex;
+
+static inline bool dedupe_informative(uint32_t print) {
+	int bits = __builtin_popcount(print);
+	return bits >= DEDUPE_MIN_BITS && bits <= 32 - DEDUPE_MIN_BITS;
+}
+
+static int dedupe_compare_entries(const void *a, const void *b) {
+	const DedupeEntry *x = a, *y = b;
+	if (x->key != y->key) return x->key < y->key ? -1 : 1;
+	if (x->track != y->track) return x->track < y->track ? -1 : 1;
+	return (x->frame > y->frame) - (x->frame < y->frame);
+}
+
+static int dedupe_compare_hits(const void *a, const void *b) {
+	const DedupeHit *x = a, *y = b;
+	if (x->track != y->track) return x->track < y->track ? -1 : 1;
+	return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+static int dedupe_compare_pairs(const void *a, const void *b) {
+	const DedupePair *x = a, *y = b;
+	if (x->query != y->query) return x->query < y->query ? -1 : 1;
+	return (x->match > y->match) - (x->match < y->match);
+}
+
+typedef struct {
+	DedupeEntry *table;
+	size_t count;
+} DedupeSort;
+
+static void *dedupe_sort_table(void *arg) {
+	DedupeSort *sort = arg;
+	qsort(sort->table, sort->count, sizeof(DedupeEntry), dedupe_compare_entries);
+	return NULL;
+}
+
+// Random masks with DEDUPE_KEY_BITS bits each; fixed seed so results are reproducible.
+static void dedupe_masks(uint32_t *masks) {
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	for (size_t t = 0UL; t < DEDUPE_TABLES; t++) {
+		masks[t] = 0;
+		while (__builtin_popcount(masks[t]) < DEDUPE_KEY_BITS) {
+			state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+			masks[t] |= 1U << (state % 32U);
+		}
+	}
+}
+
+static void dedupe_build(DedupeIndex *index) {
+	dedupe_masks(index->masks);
+	for (size_t i = 0UL; i < index->tracks.count; i++) {
+		const DedupeTrack *track = &index->tracks.items[i];
+		for (size_t f = 0UL; f < track->count; f += DEDUPE_STRIDE) index->entries += dedupe_informative(track->prints[f]);
+	}
+
+	for (size_t t = 0UL; t < DEDUPE_TABLES; t++) index->tables[t] = malloc(sizeof(DedupeEntry) * (index->entries ? index->entries : 1UL));
+	size_t at = 0UL;
+	for (size_t i = 0UL; i < index->tracks.count; i++) {
+		const DedupeTrack *track = &index->tracks.items[i];
+		for (size_t f = 0UL; f < track->count; f += DEDUPE_STRIDE) {
+			if (!dedupe_informative(track->prints[f])) continue;
+			for (size_t t = 0UL; t < DEDUPE_TABLES; t++)
+				index->tables[t][at] = (DedupeEntry) { .key = track->prints[f] & index->masks[t], .track = (uint32_t) i, .frame = (uint32_t) f };
+			at++;
+		}
+	}
+
+	// One thread per table.
+	pthread_t threads[DEDUPE_TABLES];
+	DedupeSort sorts[DEDUPE_TABLES];
+	bool started[DEDUPE_TABLES] = {0};
+	for (size_t t = 0UL; t < DEDUPE_TABLES; t++) {
+		sorts[t] = (DedupeSort) { .table = index->tables[t], .count = index->entries };
+		started[t] = pthread_create(&threads[t], NULL, dedupe_sort_table, &sorts[t]) == 0;
+		if (!started[t]) dedupe_sort_table(&sorts[t]);
+	}
+	for (size_t t = 0UL; t < DEDUPE_TABLES; t++) if (started[t]) pthread_join(threads[t], NULL);
+}
+
+static size_t dedupe_lower_bound(const DedupeEntry *table, size_t count, uint32_t key) {
+	size_t lo = 0UL, hi = count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2UL;
+		if (table[mid].key < key) lo = mid + 1UL;
+		else hi = mid;
+	}
+	return lo;
+}
+
+static void dedupe_verify(DedupeIndex *index, uint32_t query, uint32_t match, int32_t offset) {
+	const DedupeTrack *q = &index->tracks.items[query], *m = &index->tracks.items[match];
+	long from = offset < 0 ? -offset : 0, to = (long) q->count;
+	if (to + offset > (long) m->count) to = (long) m->count - offset;
+	if (to <= from) return;
+
+	size_t shorter = q->count < m->count ? q->count : m->count;
+	float cover = (float) (to - from) / (float) shorter;
+	if (cover < DEDUPE_MIN_COVER) return;
+
+	uint64_t errors = 0;
+	for (long i = from; i < to; i++) errors += (uint64_t) __builtin_popcount(q->prints[i] ^ m->prints[i + offset]);
+	float ber = errors / (float) ((to - from) * 32L);
+	if (ber > DEDUPE_MAX_BER) return;
+
+	pthread_mutex_lock(&index->mutex);
+	nob_da_append(&index->pairs, ((DedupePair) { .query = query, .match = match, .offset = offset, .ber = ber, .cover = cover }));
+	pthread_mutex_unlock(&index->mutex);
+}
+
+// Looks a track up against every later one: hits vote for (track, offset) and the best offset of every
+// candidate with enough votes is checked bit by bit.
+static void dedupe_query(DedupeIndex *index, DedupeHits *hits, uint32_t query) {
+	const DedupeTrack *q = &index->tracks.items[query];
+	hits->count = 0UL;
+	for (size_t f = 0UL; f < q->count; f++) {
+		if (!dedupe_informative(q->prints[f])) continue;
+		for (size_t t = 0UL; t < DEDUPE_TABLES; t++) {
+			uint32_t key = q->prints[f] & index->masks[t];
+			const DedupeEntry *table = index->tables[t];
+			size_t lo = dedupe_lower_bound(table, index->entries, key), hi = lo;
+			while (hi < index->entries && table[hi].key == key && hi - lo <= DEDUPE_MAX_BUCKET) hi++;
+			if (hi - lo > DEDUPE_MAX_BUCKET) continue;
+			for (size_t e = lo; e < hi; e++)
+				if (table[e].track > query) nob_da_append(hits, ((DedupeHit) { .track = table[e].track, .offset = (int32_t) table[e].frame - (int32_t) f }));
+		}
+	}
+
+	qsort(hits->items, hits->count, sizeof(DedupeHit), dedupe_compare_hits);
+	for (size_t i = 0UL; i < hits->count; ) {
+		uint32_t track = hits->items[i].track;
+		size_t best_votes = 0UL;
+		int32_t best_offset = 0;
+		while (i < hits->count && hits->items[i].track == track) {
+			size_t run = i;
+			while (run < hits->count && hits->items[run].track == track && hits->items[run].offset == hits->items[i].offset) run++;
+			if (run - i > best_votes) best_votes = run - i, best_offset = hits->items[i].offset;
+			i = run;
+		}
+		if (best_votes >= DEDUPE_MIN_VOTES) dedupe_verify(index, query, track, best_offset);
+	}
+}
+
+static void *dedupe_worker(void *arg) {
+	DedupeIndex *index = arg;
+	DedupeHits hits = {0};
+	size_t query;
+	while ((query = atomic_fetch_add(&index->next, 1)) < index->tracks.count) dedupe_query(index, &hits, (uint32_t) query);
+	nob_da_free(&hits);
+	return NULL;
+}
+
+bool dedupe_library(DedupeLibrary library, FILE *out, size_t workers) {
+	if (workers == 0UL) workers = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+	bool result = true;
+	DedupeIndex index = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+	uint32_t **prints = calloc(library.count, sizeof(uint32_t *));
+	pthread_t *threads = NULL;
+	uint64_t start_ns = stats_now_ns();
+
+	for (size_t i = 0UL; i < library.count; i++) {
+		DedupeFile *file = &library.items[i];
+		size_t count = 0UL;
+		if (!(prints[i] = align_fingerprint_file(file->path, workers, &count))) nob_return_defer(false);
+
+		for (size_t t = 0UL; t < file->tracks.count; t++) {
+			const Track *track = track_get(file->tracks, t);
+			size_t from = (size_t) (track->start_us * ALIGN_FINGERPRINT_HZ / 1e6);
+			size_t to = t + 1UL < file->tracks.count ? (size_t) (track->stop_us * ALIGN_FINGERPRINT_HZ / 1e6) : count;
+			if (to > count) to = count;
+			if (from >= to) continue;
+			nob_da_append(&index.tracks, ((DedupeTrack) { .prints = prints[i] + from, .count = to - from, .file = i, .index = t }));
+		}
+	}
+	double fingerprint_s = (stats_now_ns() - start_ns) / 1e9;
+
+	start_ns = stats_now_ns();
+	dedupe_build(&index);
+	double build_s = (stats_now_ns() - start_ns) / 1e9;
+
+	start_ns = stats_now_ns();
+	if (workers > index.tracks.count) workers = index.tracks.count;
+	threads = malloc(sizeof(pthread_t) * (workers ? workers : 1UL));
+	size_t started = 0UL;
+	for (; started < workers; started++) if (pthread_create(&threads[started], NULL, dedupe_worker, &index) != 0) break;
+	if (started == 0UL) dedupe_worker(&index);
+	for (size_t i = 0UL; i < started; i++) pthread_join(threads[i], NULL);
+	double query_s = (stats_now_ns() - start_ns) / 1e9;
+
+	qsort(index.pairs.items, index.pairs.count, sizeof(DedupePair), dedupe_compare_pairs);
+	for (size_t i = 0UL; i < index.pairs.count; i++) {
+		const DedupePair *pair = &index.pairs.items[i];
+		const DedupeTrack *q = &index.tracks.items[pair->query], *m = &index.tracks.items[pair->match];
+		const DedupeFile *qf = &library.items[q->file], *mf = &library.items[m->file];
+		fprintf(out, "%.3f\t%.2f\t%+.2f\t%s\t%zu\t%s\t%s\t%zu\t%s\n", pair->ber, pair->cover, pair->offset / ALIGN_FINGERPRINT_HZ,
+			qf->path, q->index, track_get(qf->tracks, q->index)->title, mf->path, m->index, track_get(mf->tracks, m->index)->title);
+	}
+
+	nob_log(NOB_INFO, "Fingerprinted %zu tracks in %zu files in %.2fs, indexed %zu x %d entries in %.3fs, queried in %.3fs: %zu duplicate pairs",
+		index.tracks.count, library.count, fingerprint_s, index.entries, DEDUPE_TABLES, build_s, query_s, index.pairs.count);
+
+defer:
+	for (size_t i = 0UL; i < library.count; i++) free(prints[i]);
+	free(prints);
+	for (size_t t = 0UL; t < DEDUPE_TABLES; t++) free(index.tables[t]);
+	nob_da_free(&index.tracks);
+	free(threads);
+	nob_da_free(&index.pairs);
+	return result;
+}
+
+#undef DEDUPE_TABLES
+#undef DEDUPE_KEY_BITS
+#undef DEDUPE_STRIDE
+#undef DEDUPE_MIN_BITS
+#undef DEDUPE_MAX_BUCKET
+#undef DEDUPE_MIN_VOTES
+#undef DEDUPE_MAX_BER
+#undef DEDUPE_MIN_COVER
+#endif // DEDUPE_IMPLEMENTATION
@@ -0,0 +1,143 @@
+#ifndef EXPORT_H_
+#define EXPORT_H_
+#include "audio.h"
+
+// Splits a collection into one WAV per track, `workers` tracks at a time (0 for one per core).
+// Every worker has its own decoder and a fixed-size buffer, so memory doesn't grow with track length.
+bool export_tracks(MusicCollection *music, const char *output_dir, size_t workers);
+
+#endif // EXPORT_H_
+
+#ifdef EXPORT_IMPLEMENTATION
+#undef EXPORT_IMPLEMENTATION
+#include <pthread.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <unistd.h>
+
+#define EXPORT_CHUNK	(1<<15)		// frames per read/write, per worker
+
+typedef struct {
+	MusicCollection *music;
+	const char *output_dir;
+	int digits;
+	atomic_size_t next;
+	atomic_size_t exported;
+	atomic_uint_fast64_t frames;
+	ma_uint32 sample_rate;
+} ExportJob;
+
+static void export_file_name(char *path, size_t size, const ExportJob *job, size_t index, const char *title) {
+	int n = snprintf(path, size, "%s/%0*zu - ", job->output_dir, job->digits, index + 1UL);
+	for (const char *c = title; *c && (size_t) n + 5UL < size; c++) path[n++] = *c == '/' || *c == '\\' ? '_' : *c;
+	snprintf(path + n, size - n, ".wav");
+}
+
+static bool export_track(ExportJob *job, ma_decoder *decoder, void *buffer, size_t index) {
+	Track *track = track_get(job->music->tracks, index);
+	char path[PATH_MAX];
+	export_file_name(path, sizeof(path), job, index, track->title);
+
+	ma_format format;
+	ma_uint32 channels, sample_rate;
+	ma_data_source_get_data_format(decoder, &format, &channels, &sample_rate, NULL, 0);
+	audio_decoder_set_range(decoder, track, MA_FALSE);
+
+	ma_encoder encoder;
+	ma_encoder_config config = ma_encoder_config_init(ma_encoding_format_wav, format, channels, sample_rate);
+	ma_result result = ma_encoder_init_file(path, &config, &encoder);
+	if (result != MA_SUCCESS) {
+		nob_log(NOB_ERROR, "Could not create `%s`: %s", path, ma_result_description(result));
+		return false;
+	}
+
+	ma_uint64 read, frames = 0;
+	while ((result = ma_data_source_read_pcm_frames(decoder, buffer, EXPORT_CHUNK, &read)) == MA_SUCCESS || read > 0) {
+		if ((result = ma_encoder_write_pcm_frames(&encoder, buffer, read, NULL)) != MA_SUCCESS) break;
+		frames += read;
+		if (read < EXPORT_CHUNK) break;
+	}
+	ma_encoder_uninit(&encoder);
+	if (result != MA_SUCCESS && result != MA_AT_END) {
+		nob_log(NOB_ERROR, "Could not export `%s`: %s", path, ma_result_description(result));
+		return false;
+	}
+
+	atomic_fetch_add(&job->frames, frames);
+	atomic_fetch_add(&job->exported, 1);
+	nob_log(NOB_INFO, "Exported `%s`", path);
+	return true;
+}
+
+static void *export_worker(void *arg) {
+	ExportJob *job = arg;
+	MusicCollection *music = job->music;
+
+	// Native format, so the WAVs hold exactly what the file decodes to.
+	ma_decoder_config config = ma_decoder_config_init(ma_format_unknown, 0, 0);
+	ma_decoder decoder;
+	ma_result result = ma_decoder_init_file(music->path, &config, &decoder);
+	if (result == MA_SUCCESS) result = audio_decoder_share_seek_table(&decoder, &music->decoder);
+	if (result != MA_SUCCESS) {
+		nob_log(NOB_ERROR, "Export worker could not open `%s`: %s", music->path, ma_result_description(result));
+		return NULL;
+	}
+
+	ma_format format;
+	ma_uint32 channels;
+	ma_data_source_get_data_format(&decoder, &format, &channels, NULL, NULL, 0);
+	void *buffer = malloc(EXPORT_CHUNK * ma_get_bytes_per_frame(format, channels));
+	if (!buffer) {
+		nob_log(NOB_ERROR, "Export worker could not allocate its buffer");
+		ma_decoder_uninit(&decoder);
+		return NULL;
+	}
+
+	size_t index;
+	while ((index = atomic_fetch_add(&job->next, 1)) < music->tracks.count) export_track(job, &decoder, buffer, index);
+
+	free(buffer);
+	ma_decoder_uninit(&decoder);
+	return NULL;
+}
+
+bool export_tracks(MusicCollection *music, const char *output_dir, size_t workers) {
+	if (!nob_mkdir_if_not_exists(output_dir)) return false;
+	if (workers == 0UL) workers = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers > music->tracks.count) workers = music->tracks.count;
+	if (workers == 0UL) return true;
+
+	ExportJob job = {
+		.music = music,
+		.output_dir = output_dir,
+		.digits = snprintf(NULL, 0, "%zu", music->tracks.count),
+	};
+	// The file's own rate, as the workers decode it; `music->decoder` converts to the device's.
+	ma_data_source_get_data_format(music->decoder.pBackend, NULL, NULL, &job.sample_rate, NULL, 0);
+	pthread_t *threads = malloc(sizeof(pthread_t) * workers);
+	if (!threads) {
+		nob_log(NOB_ERROR, "Could not allocate %zu export workers", workers);
+		return false;
+	}
+
+	uint64_t start_ns = stats_now_ns();
+	size_t started = 0UL;
+	for (; started < workers; started++) if (pthread_create(&threads[started], NULL, export_worker, &job) != 0) break;
+	if (started == 0UL) export_worker(&job);
+	for (size_t i = 0UL; i < started; i++) pthread_join(threads[i], NULL);
+	double seconds = (stats_now_ns() - start_ns) / 1e9;
+	free(threads);
+
+	size_t failed = music->tracks.count - atomic_load(&job.exported);
+	uint64_t frames = atomic_load(&job.frames);
+	double audio_seconds = job.sample_rate ? frames / (double) job.sample_rate : 0.0;
+	Arena a = {0};
+	nob_log(failed ? NOB_WARNING : NOB_INFO, "Exported %zu/%zu tracks (%s of audio) with %zu workers in %.2fs = %.0fx realtime",
+		music->tracks.count - failed, music->tracks.count, time_from_seconds(&a, (uint32_t) audio_seconds), started ? started : 1UL,
+		seconds, audio_seconds / (seconds > 0.0 ? seconds : 1e-9));
+	arena_free(&a);
+	return failed == 0UL;
+}
+
+#undef EXPORT_CHUNK
+#endif // EXPORT_IMPLEMENTATION
@@ -0,0 +1,111 @@
+#ifndef FFT_H_
+#define FFT_H_
+#include <stdint.h>
+
+// Real FFT of FFT_SIZE Hann-windowed samples. The frame is packed into a complex one of half the size
+// (even samples real, odd imaginary) and transformed by an iterative radix-2 FFT on split real/imaginary
+// arrays. Each stage has its twiddles stored contiguously, so the butterflies of a block are done FFT_LANES
+// at a time with vector extensions. Bins are unpacked on demand, so callers only pay for the ones they use.
+#define FFT_SIZE	2048
+#define FFT_BINS	(FFT_SIZE / 2)
+
+typedef struct {
+	uint16_t reverse[FFT_BINS];
+	float twiddle_re[FFT_BINS];		// stage with half-size h starts at h - 1
+	float twiddle_im[FFT_BINS];
+	float unpack_re[FFT_BINS];		// e^(-2πik/N)
+	float unpack_im[FFT_BINS];
+	float window[FFT_SIZE];
+} Fft;
+
+void fft_init(Fft *fft);
+// Windows `samples` and leaves the packed transform in `re`/`im`, FFT_BINS each.
+void fft_forward(const Fft *fft, const float *samples, float *re, float *im);
+// |X[k]|² of the real transform, 0 <= k < FFT_BINS.
+static inline float fft_power(const Fft *fft, const float *re, const float *im, uint32_t k);
+
+#endif // FFT_H_
+
+#ifdef FFT_IMPLEMENTATION
+#undef FFT_IMPLEMENTATION
+#include <math.h>
+#include <string.h>
+
+#define FFT_LANES	8
+
+typedef float FftVec __attribute__((vector_size(FFT_LANES * sizeof(float))));
+
+void fft_init(Fft *fft) {
+	unsigned bits = (unsigned) __builtin_ctz(FFT_BINS);
+	for (uint32_t i = 0; i < FFT_BINS; i++) {
+		uint32_t r = 0;
+		for (unsigned b = 0; b < bits; b++) r |= ((i >> b) & 1U) << (bits - 1U - b);
+		fft->reverse[i] = (uint16_t) r;
+		fft->unpack_re[i] = cosf(2.0f * (float) M_PI * i / FFT_SIZE);
+		fft->unpack_im[i] = -sinf(2.0f * (float) M_PI * i / FFT_SIZE);
+	}
+	for (uint32_t i = 0; i < FFT_SIZE; i++) fft->window[i] = 0.5f - 0.5f * cosf(2.0f * (float) M_PI * i / FFT_SIZE);
+	for (uint32_t half = 1; half < FFT_BINS; half *= 2) {
+		for (uint32_t j = 0; j < half; j++) {
+			fft->twiddle_re[half - 1 + j] = cosf((float) M_PI * j / half);
+			fft->twiddle_im[half - 1 + j] = -sinf((float) M_PI * j / half);
+		}
+	}
+}
+
+static void fft_complex(const Fft *fft, float *re, float *im) {
+	for (uint32_t i = 0; i < FFT_BINS; i++) {
+		uint32_t r = fft->reverse[i];
+		if (r > i) {
+			float t = re[i]; re[i] = re[r]; re[r] = t;
+			t = im[i]; im[i] = im[r]; im[r] = t;
+		}
+	}
+
+	for (uint32_t half = 1; half < FFT_BINS; half *= 2) {
+		const float *wr = fft->twiddle_re + half - 1, *wi = fft->twiddle_im + half - 1;
+		for (uint32_t block = 0; block < FFT_BINS; block += 2 * half) {
+			float *ar = re + block, *ai = im + block, *br = ar + half, *bi = ai + half;
+			uint32_t j = 0;
+			for (; j + FFT_LANES <= half; j += FFT_LANES) {
+				FftVec xr, xi, yr, yi, tr, ti, cr, ci;
+				memcpy(&xr, ar + j, sizeof(xr)); memcpy(&xi, ai + j, sizeof(xi));
+				memcpy(&yr, br + j, sizeof(yr)); memcpy(&yi, bi + j, sizeof(yi));
+				memcpy(&cr, wr + j, sizeof(cr)); memcpy(&ci, wi + j, sizeof(ci));
+				tr = yr * cr - yi * ci;
+				ti = yr * ci + yi * cr;
+				yr = xr - tr; yi = xi - ti;
+				xr += tr; xi += ti;
+				memcpy(ar + j, &xr, sizeof(xr)); memcpy(ai + j, &xi, sizeof(xi));
+				memcpy(br + j, &yr, sizeof(yr)); memcpy(bi + j, &yi, sizeof(yi));
+			}
+			for (; j < half; j++) {
+				float tr = br[j] * wr[j] - bi[j] * wi[j];
+				float ti = br[j] * wi[j] + bi[j] * wr[j];
+				br[j] = ar[j] - tr; bi[j] = ai[j] - ti;
+				ar[j] += tr; ai[j] += ti;
+			}
+		}
+	}
+}
+
+void fft_forward(const Fft *fft, const float *samples, float *re, float *im) {
+	for (uint32_t i = 0; i < FFT_BINS; i++) {
+		re[i] = samples[2 * i] * fft->window[2 * i];
+		im[i] = samples[2 * i + 1] * fft->window[2 * i + 1];
+	}
+	fft_complex(fft, re, im);
+}
+
+// X[k] = (Z[k] + conj Z[M-k]) / 2 - i e^(-2πik/N) (Z[k] - conj Z[M-k]) / 2
+static inline float fft_power(const Fft *fft, const float *re, const float *im, uint32_t k) {
+	uint32_t m = (FFT_BINS - k) & (FFT_BINS - 1);
+	float even_re = 0.5f * (re[k] + re[m]), even_im = 0.5f * (im[k] - im[m]);
+	float odd_re = 0.5f * (im[k] + im[m]), odd_im = -0.5f * (re[k] - re[m]);
+	float c = fft->unpack_re[k], s = fft->unpack_im[k];
+	float x_re = even_re + odd_re * c - odd_im * s, x_im = even_im + odd_re * s + odd_im * c;
+	return x_re * x_re + x_im * x_im;
+}
+
+#undef FFT_LANES
+#endif // FFT_IMPLEMENTATION
@@ -0,0 +1,302 @@
+#define NOB_IMPLEMENTATION
+#include <nob.h>
+#define ARENA_IMPLEMENTATION
+#include <arena.h>
+#define MINIAUDIO_IMPLEMENTATION
+#include <miniaudio.h>
+
+#define TRACKS_IMPLEMENTATION
+#include "tracks.h"
+#include <math.h>
+
+// Synthetic OST corpus: one long WAV of tone/noise segments with silence right before every
+// track boundary, plus the matching `.time` file, so perf runs don't need copyrighted music.
+
+#define CHUNK_FRAMES	(1<<12)
+#define MAX_PARTIALS	3
+#define FADE_SECONDS	0.01f
+#define WAV_LIMIT		0xFFFFFF00ULL	// RIFF sizes are 32-bit
+
+static inline bool is_flag(const char *test, const char *flag) { return strcmp(test, flag) == 0; }
+#define FLAG_NAME "-name"
+#define FLAG_HOURS "-hours"
+#define FLAG_TRACKS "-tracks"
+#define FLAG_GAP "-gap"
+#define FLAG_RATE "-rate"
+#define FLAG_CHANNELS "-channels"
+#define FLAG_SEED "-seed"
+#define FLAG_HUGE "-huge"
+#define FLAG_NO_AUDIO "-no-audio"
+
+typedef struct {
+	const char *name;
+	double hours;
+	uint32_t tracks;
+	uint32_t gap;			// seconds of silence ending exactly at each track start
+	uint32_t sample_rate;
+	uint32_t channels;
+	ma_format format;
+	uint64_t seed;
+	bool audio;
+} Corpus;
+
+typedef enum {
+	SEGMENT_TONE,
+	SEGMENT_NOISE,
+	SEGMENT_SILENCE,
+} SegmentKind;
+
+typedef struct {
+	SegmentKind kind;
+	uint64_t start;			// frames
+	uint64_t stop;
+	float amplitude;
+	uint32_t partials;
+	float frequency[MAX_PARTIALS];
+} Segment;
+
+typedef struct {
+	Segment *items;
+	size_t count;
+	size_t capacity;
+} Segments;
+
+static inline void usage(const char *program) {
+	fprintf(stderr, "Usage: %s [OPTIONS] <output_dir>\n", program);
+	fprintf(stderr, "	" FLAG_NAME " <stem>		output files <stem>.wav and <stem>.time (default synthetic)\n");
+	fprintf(stderr, "	" FLAG_HOURS " <h>		total length (default 2)\n");
+	fprintf(stderr, "	" FLAG_TRACKS " <n>		number of tracks (default 40)\n");
+	fprintf(stderr, "	" FLAG_GAP " <s>		silence before every track boundary (default 2)\n");
+	fprintf(stderr, "	" FLAG_RATE " <hz>		sample rate (default 44100)\n");
+	fprintf(stderr, "	" FLAG_CHANNELS " <n>	channel count (default 2)\n");
+	fprintf(stderr, "	" FLAG_SEED " <n>		random seed (default 1)\n");
+	fprintf(stderr, "	" FLAG_HUGE "			edge case: 101 hours, 100000 tracks, 4kHz mono 8-bit (~1.4GB)\n");
+	fprintf(stderr, "	" FLAG_NO_AUDIO "		only write the .time file\n");
+}
+
+static inline uint64_t rng_next(uint64_t *state) {
+	// xorshift64*, good enough for test signals and reproducible across platforms
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static inline float rng_float(uint64_t *state) {
+	return (rng_next(state) >> 40) / (float) (1ULL << 24);
+}
+
+// Track starts in whole seconds: random lengths, each long enough for its gap plus a second of sound.
+static uint32_t *corpus_plan_starts(const Corpus *c, uint64_t *rng) {
+	uint32_t total = (uint32_t) (c->hours * 3600.0);
+	uint32_t minimum = c->gap + 1U;
+	uint32_t *starts = malloc(sizeof(uint32_t) * (c->tracks + 1UL));
+
+	double *weights = malloc(sizeof(double) * c->tracks), sum = 0.0;
+	for (uint32_t i = 0; i < c->tracks; i++) sum += weights[i] = 0.5 + rng_float(rng);
+
+	uint32_t spare = total - minimum * c->tracks, at = 0;
+	double acc = 0.0;
+	for (uint32_t i = 0; i < c->tracks; i++) {
+		starts[i] = at + (uint32_t) (acc / sum * spare);
+		acc += weights[i];
+		at += minimum;
+	}
+	starts[c->tracks] = total;
+	free(weights);
+	return starts;
+}
+
+static void corpus_plan_segments(const Corpus *c, const uint32_t *starts, uint64_t *rng, Segments *segments) {
+	for (uint32_t i = 0; i < c->tracks; i++) {
+		uint64_t from = (uint64_t) starts[i] * c->sample_rate;
+		uint64_t to = (uint64_t) (starts[i + 1] - (i + 1U < c->tracks ? c->gap : 0U)) * c->sample_rate;
+
+		while (from < to) {
+			Segment s = { .start = from, .amplitude = 0.2f + 0.3f * rng_float(rng) };
+			float r = rng_float(rng);
+			// Short rests inside a track stay well under the boundary gap, like quiet passages do.
+			if (r < 0.6f) {
+				s.kind = SEGMENT_TONE;
+				s.partials = 1U + (uint32_t) (rng_next(rng) % MAX_PARTIALS);
+				for (uint32_t p = 0; p < s.partials; p++) s.frequency[p] = 110.0f * powf(2.0f, 3.0f * rng_float(rng));
+				s.stop = from + (uint64_t) ((5.0f + 40.0f * rng_float(rng)) * c->sample_rate);
+			} else if (r < 0.9f) {
+				s.kind = SEGMENT_NOISE;
+				s.amplitude *= 0.4f;
+				s.stop = from + (uint64_t) ((2.0f + 20.0f * rng_float(rng)) * c->sample_rate);
+			} else {
+				s.kind = SEGMENT_SILENCE;
+				s.stop = from + (uint64_t) ((0.2f + 0.5f * rng_float(rng)) * (c->gap ? c->gap : 1U) * c->sample_rate);
+			}
+			if (s.stop > to || to - s.stop < c->sample_rate / 2U) s.stop = to;
+			nob_da_append(segments, s);
+			from = s.stop;
+		}
+		nob_da_append(segments, ((Segment) { .kind = SEGMENT_SILENCE, .start = to, .stop = (uint64_t) starts[i + 1] * c->sample_rate }));
+	}
+}
+
+static bool corpus_write_time(Arena *a, const Corpus *c, const char *path, const uint32_t *starts) {
+	Nob_StringBuilder sb = {0};
+	for (uint32_t i = 0; i < c->tracks; i++) {
+		nob_sb_append_cstr(&sb, time_from_seconds(a, starts[i]));
+		nob_sb_append_cstr(&sb, nob_temp_sprintf("\tSynthetic Track %u\n", i + 1U));
+		nob_temp_reset();
+	}
+	bool ok = nob_write_entire_file(path, sb.items, sb.count);
+	nob_sb_free(&sb);
+	if (!ok) return false;
+
+	// Round-trip through the real parser so the corpus can't drift from what the player reads.
+	Tracks tracks = {0};
+	ok = tracks_read_from_file(a, path, &tracks) && tracks.count == c->tracks;
+	for (size_t i = 0UL; ok && i < tracks.count; i++) ok = tracks.items[i].start == starts[i];
+	if (!ok) nob_log(NOB_ERROR, "`%s` does not parse back to the generated boundaries", path);
+	nob_da_free(&tracks);
+	return ok;
+}
+
+static bool corpus_write_audio(const Corpus *c, const char *path, const Segments *segments, uint64_t *rng) {
+	ma_encoder encoder;
+	ma_encoder_config config = ma_encoder_config_init(ma_encoding_format_wav, c->format, c->channels, c->sample_rate);
+	ma_result result = ma_encoder_init_file(path, &config, &encoder);
+	if (result != MA_SUCCESS) {
+		nob_log(NOB_ERROR, "Could not create `%s`: %s", path, ma_result_description(result));
+		return false;
+	}
+
+	float *chunk = malloc(sizeof(float) * CHUNK_FRAMES * c->channels);
+	void *encoded = malloc(ma_get_bytes_per_frame(c->format, c->channels) * CHUNK_FRAMES);
+	uint64_t fade = (uint64_t) (FADE_SECONDS * c->sample_rate) + 1U;
+
+	for (size_t i = 0UL; i < segments->count && result == MA_SUCCESS; i++) {
+		const Segment *s = &segments->items[i];
+		// Phasors instead of sinf per sample: rotate (re, im) by the per-sample angle.
+		float re[MAX_PARTIALS], im[MAX_PARTIALS], cw[MAX_PARTIALS], sw[MAX_PARTIALS];
+		for (uint32_t p = 0; p < s->partials; p++) {
+			float w = 2.0f * (float) M_PI * s->frequency[p] / c->sample_rate;
+			re[p] = 1.0f, im[p] = 0.0f, cw[p] = cosf(w), sw[p] = sinf(w);
+		}
+
+		for (uint64_t at = s->start; at < s->stop;) {
+			uint32_t frames = (uint32_t) (s->stop - at < CHUNK_FRAMES ? s->stop - at : CHUNK_FRAMES);
+			for (uint32_t f = 0; f < frames; f++) {
+				float v = 0.0f;
+				if (s->kind == SEGMENT_TONE) {
+					for (uint32_t p = 0; p < s->partials; p++) {
+						float r = re[p] * cw[p] - im[p] * sw[p];
+						im[p] = re[p] * sw[p] + im[p] * cw[p];
+						re[p] = r;
+						v += im[p];
+					}
+					v /= (float) s->partials;
+				} else if (s->kind == SEGMENT_NOISE) v = 2.0f * rng_float(rng) - 1.0f;
+
+				uint64_t from_start = at + f - s->start, to_stop = s->stop - (at + f);
+				float envelope = from_start < fade ? (float) from_start / fade : to_stop < fade ? (float) to_stop / fade : 1.0f;
+				for (uint32_t ch = 0; ch < c->channels; ch++) chunk[f * c->channels + ch] = v * s->amplitude * envelope;
+			}
+			for (uint32_t p = 0; p < s->partials; p++) {
+				float norm = 1.0f / sqrtf(re[p] * re[p] + im[p] * im[p]);
+				re[p] *= norm, im[p] *= norm;
+			}
+
+			ma_pcm_convert(encoded, c->format, chunk, ma_format_f32, (ma_uint64) frames * c->channels, ma_dither_mode_none);
+			result = ma_encoder_write_pcm_frames(&encoder, encoded, frames, NULL);
+			at += frames;
+		}
+	}
+
+	free(encoded);
+	free(chunk);
+	ma_encoder_uninit(&encoder);
+	if (result != MA_SUCCESS) nob_log(NOB_ERROR, "Could not write `%s`: %s", path, ma_result_description(result));
+	return result == MA_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+	int result = 0;
+	Arena a = {0};
+	Segments segments = {0};
+	uint32_t *starts = NULL;
+	Corpus c = {
+		.name = "synthetic",
+		.hours = 2.0,
+		.tracks = 40,
+		.gap = 2,
+		.sample_rate = 44100,
+		.channels = 2,
+		.format = ma_format_s16,
+		.seed = 1,
+		.audio = true,
+	};
+
+	const char *program = nob_shift_args(&argc, &argv);
+	while (argc > 0 && **argv == '-') {
+		const char *flag = nob_shift_args(&argc, &argv);
+		if (is_flag(flag, FLAG_HUGE)) {
+			c.name = "huge";
+			c.hours = 101.0;		// so the last starts need three-digit hours
+			c.tracks = 100000;
+			c.gap = 1;
+			c.sample_rate = 4000;
+			c.channels = 1;
+			c.format = ma_format_u8;
+		}
+		else if (is_flag(flag, FLAG_NO_AUDIO)) c.audio = false;
+		else if (argc <= 0) {
+			nob_log(NOB_ERROR, "Missing value for `%s`", flag);
+			usage(program);
+			return 1;
+		}
+		else if (is_flag(flag, FLAG_NAME)) c.name = nob_shift_args(&argc, &argv);
+		else if (is_flag(flag, FLAG_HOURS)) c.hours = atof(nob_shift_args(&argc, &argv));
+		else if (is_flag(flag, FLAG_TRACKS)) c.tracks = (uint32_t) atol(nob_shift_args(&argc, &argv));
+		else if (is_flag(flag, FLAG_GAP)) c.gap = (uint32_t) atol(nob_shift_args(&argc, &argv));
+		else if (is_flag(flag, FLAG_RATE)) c.sample_rate = (uint32_t) atol(nob_shift_args(&argc, &argv));
+		else if (is_flag(flag, FLAG_CHANNELS)) c.channels = (uint32_t) atol(nob_shift_args(&argc, &argv));
+		else if (is_flag(flag, FLAG_SEED)) c.seed = strtoull(nob_shift_args(&argc, &argv), NULL, 10);
+		else {
+			nob_log(NOB_ERROR, "Unknown option `%s`", flag);
+			usage(program);
+			return 1;
+		}
+	}
+	if (argc <= 0) {
+		nob_log(NOB_ERROR, "Missing output directory");
+		usage(program);
+		return 1;
+	}
+	const char *dir = nob_shift_args(&argc, &argv);
+
+	if (c.tracks == 0 || c.sample_rate == 0 || c.channels == 0 || c.hours * 3600.0 < (double) c.tracks * (c.gap + 1U)) {
+		nob_log(NOB_ERROR, "%u tracks with %us gaps do not fit in %.2f hours", c.tracks, c.gap, c.hours);
+		return 1;
+	}
+	uint64_t bytes = (uint64_t) (c.hours * 3600.0) * c.sample_rate * ma_get_bytes_per_frame(c.format, c.channels);
+	if (c.audio && bytes > WAV_LIMIT) {
+		nob_log(NOB_ERROR, "%.2f GB does not fit in a WAV file, lower " FLAG_HOURS ", " FLAG_RATE " or " FLAG_CHANNELS, bytes / 1e9);
+		return 1;
+	}
+	if (!nob_mkdir_if_not_exists(dir)) return 1;
+
+	uint64_t rng = c.seed * 0x9E3779B97F4A7C15ULL + 1U;
+	starts = corpus_plan_starts(&c, &rng);
+	const char *time_path = arena_sprintf(&a, "%s/%s.time", dir, c.name);
+	if (!corpus_write_time(&a, &c, time_path, starts)) nob_return_defer(2);
+	nob_log(NOB_INFO, "Wrote %u tracks to `%s`", c.tracks, time_path);
+
+	if (c.audio) {
+		const char *wav_path = arena_sprintf(&a, "%s/%s.wav", dir, c.name);
+		corpus_plan_segments(&c, starts, &rng, &segments);
+		if (!corpus_write_audio(&c, wav_path, &segments, &rng)) nob_return_defer(3);
+		nob_log(NOB_INFO, "Wrote %.2f hours (%zu segments, %.2f GB) to `%s`", c.hours, segments.count, bytes / 1e9, wav_path);
+	}
+
+defer:
+	free(starts);
+	nob_da_free(&segments);
+	arena_free(&a);
+	return result;
+}
@@ -0,0 +1,328 @@
+#ifndef LOUDNESS_H_
+#define LOUDNESS_H_
+#include "audio.h"
+
+// EBU R128 / ITU-R BS.1770-4 loudness of every track: integrated loudness (K-weighted, 400ms blocks,
+// absolute -70 LUFS and relative -10 LU gates) and true peak (4x oversampled). Tracks are measured in
+// parallel, one per worker, and the results cached in `<timestamp_path>.loudness` so it happens once.
+// Each track's `gain_db` is then set to reach `target_lufs`, lowered if that would push the true peak
+// over -1 dBTP; playback applies it in the output stage.
+bool loudness_normalize_tracks(MusicCollection *music, const char *timestamp_path, float target_lufs, size_t workers);
+
+#endif // LOUDNESS_H_
+
+#ifdef LOUDNESS_IMPLEMENTATION
+#undef LOUDNESS_IMPLEMENTATION
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOUDNESS_CHUNK			(1<<14)		// frames per read, per worker
+#define LOUDNESS_MAX_CHANNELS	8
+#define LOUDNESS_SUBBLOCKS		10			// 100ms steps per second; a 400ms block is 4 of them
+#define LOUDNESS_ABSOLUTE_GATE	-70.0
+#define LOUDNESS_RELATIVE_GATE	-10.0
+#define LOUDNESS_CEILING_DB		-1.0f		// true peak limit after gain
+#define LOUDNESS_OVERSAMPLE		4
+#define LOUDNESS_TAPS			12			// per phase
+#define LOUDNESS_CACHE_MAGIC	"mstamp-loudness 1"
+
+typedef struct {
+	float lufs;					// -INFINITY for silence
+	float true_peak_db;
+} TrackLoudness;
+
+typedef struct {
+	double b0, b1, b2, a1, a2;
+} LoudnessBiquad;
+
+typedef struct {
+	double x1, x2, y1, y2;
+} LoudnessBiquadState;
+
+typedef struct {
+	MusicCollection *music;
+	TrackLoudness *results;
+	float phases[LOUDNESS_OVERSAMPLE][LOUDNESS_TAPS];
+	atomic_size_t next;
+	atomic_size_t failed;
+} LoudnessJob;
+
+// K-weighting for any sample rate: the BS.1770 high shelf and high pass, derived the way libebur128 does.
+static void loudness_k_weighting(ma_uint32 sample_rate, LoudnessBiquad *shelf, LoudnessBiquad *high_pass) {
+	double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+	double k = tan(M_PI * f0 / sample_rate);
+	double vh = pow(10.0, gain / 20.0), vb = pow(vh, 0.4996667741545416);
+	double a0 = 1.0 + k / q + k * k;
+	*shelf = (LoudnessBiquad) {
+		.b0 = (vh + vb * k / q + k * k) / a0,
+		.b1 = 2.0 * (k * k - vh) / a0,
+		.b2 = (vh - vb * k / q + k * k) / a0,
+		.a1 = 2.0 * (k * k - 1.0) / a0,
+		.a2 = (1.0 - k / q + k * k) / a0,
+	};
+
+	f0 = 38.13547087602444, q = 0.5003270373238773;
+	k = tan(M_PI * f0 / sample_rate);
+	a0 = 1.0 + k / q + k * k;
+	*high_pass = (LoudnessBiquad) {
+		.b0 = 1.0, .b1 = -2.0, .b2 = 1.0,
+		.a1 = 2.0 * (k * k - 1.0) / a0,
+		.a2 = (1.0 - k / q + k * k) / a0,
+	};
+}
+
+static inline double loudness_biquad(const LoudnessBiquad *f, LoudnessBiquadState *s, double x) {
+	double y = f->b0 * x + f->b1 * s->x1 + f->b2 * s->x2 - f->a1 * s->y1 - f->a2 * s->y2;
+	s->x2 = s->x1, s->x1 = x;
+	s->y2 = s->y1, s->y1 = y;
+	return y;
+}
+
+// Polyphase windowed-sinc interpolator, 48 taps as in BS.1770-4 Annex 2.
+static void loudness_true_peak_filter(float phases[LOUDNESS_OVERSAMPLE][LOUDNESS_TAPS]) {
+	const int length = LOUDNESS_OVERSAMPLE * LOUDNESS_TAPS;
+	const double center = (length - 1) / 2.0;
+	for (int n = 0; n < length; n++) {
+		double t = (n - center) / LOUDNESS_OVERSAMPLE;
+		double sinc = t == 0.0 ? 1.0 : sin(M_PI * t) / (M_PI * t);
+		double window = 0.5 - 0.5 * cos(2.0 * M_PI * (n + 0.5) / length);
+		phases[n % LOUDNESS_OVERSAMPLE][n / LOUDNESS_OVERSAMPLE] = (float) (sinc * window);
+	}
+}
+
+// BS.1770 gating over 100ms sub-block energies (already summed over channels).
+static float loudness_integrated(const double *subblocks, size_t count) {
+	if (count < 4UL) return -INFINITY;
+	size_t blocks = count - 3UL;
+	double absolute = pow(10.0, (LOUDNESS_ABSOLUTE_GATE + 0.691) / 10.0);
+
+	double sum = 0.0;
+	size_t passed = 0UL;
+	for (size_t i = 0UL; i < blocks; i++) {
+		double z = (subblocks[i] + subblocks[i + 1] + subblocks[i + 2] + subblocks[i + 3]) / 4.0;
+		if (z > absolute) sum += z, passed++;
+	}
+	if (passed == 0UL) return -INFINITY;
+
+	double relative = sum / passed * pow(10.0, LOUDNESS_RELATIVE_GATE / 10.0);
+	sum = 0.0, passed = 0UL;
+	for (size_t i = 0UL; i < blocks; i++) {
+		double z = (subblocks[i] + subblocks[i + 1] + subblocks[i + 2] + subblocks[i + 3]) / 4.0;
+		if (z > absolute && z > relative) sum += z, passed++;
+	}
+	return passed ? (float) (-0.691 + 10.0 * log10(sum / passed)) : -INFINITY;
+}
+
+static bool loudness_measure(LoudnessJob *job, ma_decoder *decoder, float *buffer, size_t index) {
+	Track *track = track_get(job->music->tracks, index);
+	ma_uint32 channels, sample_rate;
+	ma_data_source_get_data_format(decoder, NULL, &channels, &sample_rate, NULL, 0);
+	if (channels > LOUDNESS_MAX_CHANNELS) return false;
+	audio_decoder_set_range(decoder, track, MA_FALSE);
+
+	LoudnessBiquad shelf, high_pass;
+	loudness_k_weighting(sample_rate, &shelf, &high_pass);
+	LoudnessBiquadState states[LOUDNESS_MAX_CHANNELS][2] = {0};
+	float history[LOUDNESS_MAX_CHANNELS][LOUDNESS_TAPS] = {0};
+	float peak = 0.0f;
+
+	struct { double *items; size_t count; size_t capacity; } subblocks = {0};
+	ma_uint32 subblock_frames = sample_rate / LOUDNESS_SUBBLOCKS, in_subblock = 0;
+	double energy = 0.0;
+
+	ma_uint64 read;
+	ma_result result;
+	while ((result = ma_data_source_read_pcm_frames(decoder, buffer, LOUDNESS_CHUNK, &read)) == MA_SUCCESS || read > 0) {
+		for (ma_uint64 f = 0; f < read; f++) {
+			for (ma_uint32 c = 0; c < channels; c++) {
+				float x = buffer[f * channels + c];
+				double y = loudness_biquad(&high_pass, &states[c][1], loudness_biquad(&shelf, &states[c][0], x));
+				energy += y * y;
+
+				float *h = history[c];
+				memmove(h + 1, h, sizeof(float) * (LOUDNESS_TAPS - 1));
+				h[0] = x;
+				for (int p = 0; p < LOUDNESS_OVERSAMPLE; p++) {
+					float v = 0.0f;
+					for (int k = 0; k < LOUDNESS_TAPS; k++) v += h[k] * job->phases[p][k];
+					v = fabsf(v);
+					if (v > peak) peak = v;
+				}
+				if (fabsf(x) > peak) peak = fabsf(x);
+			}
+			if (++in_subblock == subblock_frames) {
+				nob_da_append(&subblocks, energy / subblock_frames);
+				energy = 0.0, in_subblock = 0;
+			}
+		}
+		if (read < LOUDNESS_CHUNK) break;
+	}
+
+	job->results[index] = (TrackLoudness) {
+		.lufs = loudness_integrated(subblocks.items, subblocks.count),
+		.true_peak_db = peak > 0.0f ? 20.0f * log10f(peak) : -INFINITY,
+	};
+	nob_da_free(&subblocks);
+	return result == MA_SUCCESS || result == MA_AT_END;
+}
+
+static void *loudness_worker(void *arg) {
+	LoudnessJob *job = arg;
+	MusicCollection *music = job->music;
+
+	// Native format: loudness of what the file holds, not of the playback resampler.
+	ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 0, 0);
+	ma_decoder decoder;
+	ma_result result = ma_decoder_init_file(music->path, &config, &decoder);
+	if (result == MA_SUCCESS) result = audio_decoder_share_seek_table(&decoder, &music->decoder);
+	if (result != MA_SUCCESS) {
+		nob_log(NOB_ERROR, "Loudness worker could not open `%s`: %s", music->path, ma_result_description(result));
+		return NULL;
+	}
+
+	ma_uint32 channels;
+	ma_data_source_get_data_format(&decoder, NULL, &channels, NULL, NULL, 0);
+	float *buffer = malloc(sizeof(float) * LOUDNESS_CHUNK * channels);
+	if (!buffer) {
+		nob_log(NOB_ERROR, "Loudness worker could not allocate its buffer");
+		ma_decoder_uninit(&decoder);
+		return NULL;
+	}
+
+	size_t index;
+	while ((index = atomic_fetch_add(&job->next, 1)) < music->tracks.count)
+		if (!loudness_measure(job, &decoder, buffer, index)) atomic_fetch_add(&job->failed, 1);
+
+	free(buffer);
+	ma_decoder_uninit(&decoder);
+	return NULL;
+}
+
+// The ranges measured go into the key too: `-refine` moves them without touching either file.
+static void loudness_cache_key(const MusicCollection *music, const char *timestamp_path, char *key, size_t size) {
+	struct stat file = {0}, stamps = {0};
+	stat(music->path, &file);
+	stat(timestamp_path, &stamps);
+	uint64_t ranges = 14695981039346656037ULL;		// FNV-1a over every track's start and stop
+	for (size_t i = 0UL; i < music->tracks.count; i++) {
+		const Track *t = track_get(music->tracks, i);
+		uint64_t bounds[2] = { t->start_us, t->stop_us };
+		const unsigned char *bytes = (const unsigned char *) bounds;
+		for (size_t b = 0UL; b < sizeof(bounds); b++) ranges = (ranges ^ bytes[b]) * 1099511628211ULL;
+	}
+	snprintf(key, size, LOUDNESS_CACHE_MAGIC " %lld %lld %lld %lld %016llx", (long long) file.st_size, file_mtime_ns(&file),
+		(long long) stamps.st_size, file_mtime_ns(&stamps), (unsigned long long) ranges);
+}
+
+static bool loudness_cache_load(const char *cache_path, const char *key, TrackLoudness *results, size_t count) {
+	Nob_StringBuilder sb = {0};
+	if (!nob_file_exists(cache_path) || !nob_read_entire_file(cache_path, &sb)) return false;
+	nob_sb_append_null(&sb);
+
+	bool ok = false;
+	size_t key_size = strlen(key);
+	char *at = sb.items + key_size;
+	if (sb.count > key_size && memcmp(sb.items, key, key_size) == 0 && *at == '\n') {
+		size_t i = 0UL;
+		for (; i < count; i++) {
+			char *end;
+			float lufs = strtof(at, &end);
+			if (end == at) break;
+			float peak = strtof(at = end, &end);
+			if (end == at) break;
+			at = end;
+			results[i] = (TrackLoudness) { .lufs = lufs, .true_peak_db = peak };
+		}
+		ok = i == count;
+	}
+	nob_sb_free(&sb);
+	return ok;
+}
+
+static void loudness_cache_save(const char *cache_path, const char *key, const TrackLoudness *results, size_t count) {
+	Nob_StringBuilder sb = {0};
+	nob_sb_append_cstr(&sb, key);
+	nob_sb_append_cstr(&sb, "\n");
+	for (size_t i = 0UL; i < count; i++) {
+		char line[64];
+		snprintf(line, sizeof(line), "%.2f %.2f\n", results[i].lufs, results[i].true_peak_db);
+		nob_sb_append_cstr(&sb, line);
+	}
+	if (!nob_write_entire_file(cache_path, sb.items, sb.count)) nob_log(NOB_WARNING, "Could not cache loudness in `%s`", cache_path);
+	nob_sb_free(&sb);
+}
+
+bool loudness_normalize_tracks(MusicCollection *music, const char *timestamp_path, float target_lufs, size_t workers) {
+	size_t count = music->tracks.count;
+	if (count == 0UL) return true;
+
+	bool result = true;
+	char key[256], cache_path[PATH_MAX];
+	snprintf(cache_path, sizeof(cache_path), "%s.loudness", timestamp_path);
+	loudness_cache_key(music, timestamp_path, key, sizeof(key));
+	LoudnessJob *job = calloc(1, sizeof(LoudnessJob));
+	if (!job) {
+		nob_log(NOB_ERROR, "Could not allocate the loudness measurement");
+		return false;
+	}
+	job->music = music;
+	job->results = calloc(count, sizeof(TrackLoudness));
+	if (!job->results) {
+		nob_log(NOB_ERROR, "Could not allocate the loudness of %zu tracks", count);
+		nob_return_defer(false);
+	}
+
+	if (loudness_cache_load(cache_path, key, job->results, count)) nob_log(NOB_INFO, "Loaded loudness from `%s`", cache_path);
+	else {
+		loudness_true_peak_filter(job->phases);
+		if (workers == 0UL) workers = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+		if (workers > count) workers = count;
+		pthread_t *threads = malloc(sizeof(pthread_t) * workers);
+		if (!threads) {
+			nob_log(NOB_ERROR, "Could not allocate %zu loudness workers", workers);
+			nob_return_defer(false);
+		}
+
+		uint64_t start_ns = stats_now_ns();
+		size_t started = 0UL;
+		for (; started < workers; started++) if (pthread_create(&threads[started], NULL, loudness_worker, job) != 0) break;
+		if (started == 0UL) loudness_worker(job);
+		for (size_t i = 0UL; i < started; i++) pthread_join(threads[i], NULL);
+		free(threads);
+		if (atomic_load(&job->next) < count || atomic_load(&job->failed)) {
+			nob_log(NOB_ERROR, "Could not measure the loudness of every track in `%s`", music->path);
+			nob_return_defer(false);
+		}
+		nob_log(NOB_INFO, "Measured loudness of %zu tracks with %zu workers in %.2fs", count, started ? started : 1UL, (stats_now_ns() - start_ns) / 1e9);
+		loudness_cache_save(cache_path, key, job->results, count);
+	}
+
+	for (size_t i = 0UL; i < count; i++) {
+		const TrackLoudness *l = &job->results[i];
+		Track *track = track_get(music->tracks, i);
+		float gain = isfinite(l->lufs) ? target_lufs - l->lufs : 0.0f;
+		if (isfinite(l->true_peak_db) && l->true_peak_db + gain > LOUDNESS_CEILING_DB) gain = LOUDNESS_CEILING_DB - l->true_peak_db;
+		track->gain_db = gain;
+		nob_log(NOB_INFO, "%3zu: %6.1f LUFS %6.1f dBTP -> %+5.1f dB  `%s`", i, l->lufs, l->true_peak_db, gain, track->title);
+	}
+
+defer:
+	free(job->results);
+	free(job);
+	return result;
+}
+
+#undef LOUDNESS_CHUNK
+#undef LOUDNESS_MAX_CHANNELS
+#undef LOUDNESS_SUBBLOCKS
+#undef LOUDNESS_ABSOLUTE_GATE
+#undef LOUDNESS_RELATIVE_GATE
+#undef LOUDNESS_CEILING_DB
+#undef LOUDNESS_OVERSAMPLE
+#undef LOUDNESS_TAPS
+#undef LOUDNESS_CACHE_MAGIC
+#endif // LOUDNESS_IMPLEMENTATION
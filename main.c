@@ -57,50 +57,279 @@ const char *get_relative_path_to_music(const char *music_file) {
 	return buffer;
 }
 
+// Known OSTs use the table above; anything else (e.g. ./gen corpora) keeps `<stem>.time` next to the music.
+const char *timestamps_for_music(const char *music_file) {
+	const char *name = timestamps_from_music_name(music_file);
+	if (name) return nob_temp_sprintf("%s" TIMESTAMPS_FOLDER "%s", get_relative_path_to_music(music_file), name);
+
+	const char *dot = strrchr(music_file, '.');
+	if (!dot || dot < music_file_get_name(music_file)) dot = music_file + strlen(music_file);
+	return nob_temp_sprintf("%.*s.time", (int) (dot - music_file), music_file);
+}
+
 #define AUDIO_IMPLEMENTATION
 #include "audio.h"
+#define EXPORT_IMPLEMENTATION
+#include "export.h"
+#define MP3SPLIT_IMPLEMENTATION
+#include "mp3split.h"
+#define ANALYZE_IMPLEMENTATION
+#include "analyze.h"
+#define FFT_IMPLEMENTATION
+#include "fft.h"
+#define ALIGN_IMPLEMENTATION
+#include "align.h"
+#define DEDUPE_IMPLEMENTATION
+#include "dedupe.h"
+#define LOUDNESS_IMPLEMENTATION
+#include "loudness.h"
+#define WAVEFORM_IMPLEMENTATION
+#include "waveform.h"
+#define VISUALIZE_IMPLEMENTATION
+#include "visualize.h"
+#define CONTROL_IMPLEMENTATION
+#include "control.h"
+#define TUI_IMPLEMENTATION
+#include "tui.h"
+#define DAEMON_IMPLEMENTATION
+#include "daemon.h"
+#define STREAM_IMPLEMENTATION
+#include "stream.h"
+#define SHMOUT_IMPLEMENTATION
+#include "shmout.h"
+
 
 
+static inline bool is_flag(const char *test, const char *flag) { return strcmp(test, flag) == 0; }
+#define FLAG_REALTIME "-rt"
+#define FLAG_CPU "-cpu"
+#define FLAG_RENDER "-render"
+#define FLAG_EXPORT "-export"
+#define FLAG_JOBS "-jobs"
+#define FLAG_SPLIT "-split"
+#define FLAG_ANALYZE "-analyze"
+#define FLAG_SILENCE "-silence"
+#define FLAG_GAP "-gap"
+#define FLAG_REFINE "-refine"
+#define FLAG_ALIGN "-align"
+#define FLAG_DEDUPE "-dedupe"
+#define FLAG_NORMALIZE "-normalize"
+#define FLAG_PEAKS "-peaks"
+#define FLAG_VISUALIZE "-visualize"
+#define FLAG_TUI "-tui"
+#define FLAG_DAEMON "-daemon"
+#define FLAG_STREAM "-stream"
+#define FLAG_HEADLESS "-headless"
+#define FLAG_SHM "-shm"
 
 static inline void usage(const char *program) {
-	fprintf(stderr, "Usage: %s <input.mp3> [track_index=0]\n", program);
+	fprintf(stderr, "Usage: %s [OPTIONS] <input.mp3> [track_index=0]\n", program);
+	fprintf(stderr, "       %s " FLAG_DEDUPE " <music>...\n", program);
+	fprintf(stderr, "	" FLAG_REALTIME "		lock playback buffers and run the decoder thread at realtime priority\n");
+	fprintf(stderr, "	" FLAG_CPU " <n>	pin the decoder thread to CPU n (implies " FLAG_REALTIME ")\n");
+	fprintf(stderr, "	" FLAG_RENDER " <out>	decode the track once, as fast as possible, into a WAV file (`-` for raw f32 PCM on stdout)\n");
+	fprintf(stderr, "	" FLAG_EXPORT " <dir>	split every track into its own WAV in dir, in parallel\n");
+	fprintf(stderr, "	" FLAG_JOBS " <n>		worker threads for " FLAG_EXPORT ", " FLAG_ANALYZE ", " FLAG_ALIGN ", " FLAG_DEDUPE ", " FLAG_NORMALIZE " and " FLAG_PEAKS " (default: one per core)\n");
+	fprintf(stderr, "	" FLAG_SPLIT " <dir>	cut every track out of the MP3 into its own MP3 in dir, losslessly (no re-encode)\n");
+	fprintf(stderr, "	" FLAG_ANALYZE " <out.time>	find tracks by their silent gaps and write a candidate .time file\n");
+	fprintf(stderr, "	" FLAG_SILENCE " <dB>	RMS level below which " FLAG_ANALYZE " hears silence (default: -50)\n");
+	fprintf(stderr, "	" FLAG_GAP " <s>		shortest silence between two tracks for " FLAG_ANALYZE " (default: 1.5)\n");
+	fprintf(stderr, "	" FLAG_REFINE " <s>	snap each boundary to the silent gap within s seconds of it (cached next to the .time file)\n");
+	fprintf(stderr, "	" FLAG_ALIGN " <reference.mp3> <out.time>	match input against another rip by audio fingerprint and rewrite its .time for input\n");
+	fprintf(stderr, "	" FLAG_NORMALIZE " <LUFS>	play and render every track at this EBU R128 loudness, e.g. -18 (measured once, cached next to the .time file)\n");
+	fprintf(stderr, "	" FLAG_PEAKS " <pixels>	print the track's waveform at this width as TSV (min, max, RMS), from a peak sidecar built on first use\n");
+	fprintf(stderr, "	" FLAG_VISUALIZE "	draw spectrum bars of the playback in the terminal\n");
+	fprintf(stderr, "	" FLAG_TUI "		show the track list and position in the terminal, redrawing only what changed\n");
+	fprintf(stderr, "	" FLAG_DAEMON " <socket>	start paused and take commands (play, pause, next, queue, state, ...) on a Unix socket instead of keys\n");
+	fprintf(stderr, "	" FLAG_STREAM " <socket>	also send what plays, as raw f32 PCM, to every process connected to a Unix socket\n");
+	fprintf(stderr, "	" FLAG_SHM " <name>	also write what plays into a shared memory ring, /dev/shm/<name>, for other processes to map\n");
+	fprintf(stderr, "	" FLAG_HEADLESS "	play without a sound card, at realtime pace (for " FLAG_STREAM " or " FLAG_DAEMON " servers)\n");
+	fprintf(stderr, "	" FLAG_DEDUPE "		list near-duplicate tracks across all the music files given, as TSV on stdout\n");
 }
 
 int main(int argc, char *argv[]) {
 	int result = 0;
     size_t index = 0;
+	trace_init();
+	TraceSpan span = trace_begin("arg parsing");
 
 	Nob_StringView program_path = nob_sv_from_cstr(nob_shift_args(&argc, &argv));
 	Nob_StringView program = get_last_in_path(&program_path);
+	Realtime rt = REALTIME_DEFAULT;
+	const char *render_path = NULL;
+	const char *export_dir = NULL;
+	const char *split_dir = NULL;
+	const char *analyze_path = NULL;
+	AnalyzeConfig analyze = ANALYZE_CONFIG_DEFAULT;
+	bool refine = false;
+	const char *align_reference = NULL, *align_path = NULL;
+	bool dedupe = false;
+	bool normalize = false;
+	float target_lufs = 0.0f;
+	size_t peaks = 0;
+	bool visualize = false;
+	bool tui_enabled = false;
+	const char *daemon_path = NULL;
+	const char *stream_path = NULL;
+	const char *shm_name = NULL;
+	size_t jobs = 0;
+	while (argc > 0 && **argv == '-') {
+		const char *flag = nob_shift_args(&argc, &argv);
+		if (is_flag(flag, FLAG_REALTIME)) rt.enabled = true;
+		else if (is_flag(flag, FLAG_CPU) && argc > 0) {
+			rt.enabled = true;
+			rt.cpu = atoi(nob_shift_args(&argc, &argv));
+		}
+		else if (is_flag(flag, FLAG_RENDER) && argc > 0) render_path = nob_shift_args(&argc, &argv);
+		else if (is_flag(flag, FLAG_EXPORT) && argc > 0) export_dir = nob_shift_args(&argc, &argv);
+		else if (is_flag(flag, FLAG_SPLIT) && argc > 0) split_dir = nob_shift_args(&argc, &argv);
+		else if (is_flag(flag, FLAG_JOBS) && argc > 0) jobs = (size_t) atol(nob_shift_args(&argc, &argv));
+		else if (is_flag(flag, FLAG_ANALYZE) && argc > 0) analyze_path = nob_shift_args(&argc, &argv);
+		else if (is_flag(flag, FLAG_SILENCE) && argc > 0) analyze.silence_db = (float) atof(nob_shift_args(&argc, &argv));
+		else if (is_flag(flag, FLAG_GAP) && argc > 0) analyze.min_gap = (float) atof(nob_shift_args(&argc, &argv));
+		else if (is_flag(flag, FLAG_REFINE) && argc > 0) {
+			refine = true;
+			analyze.refine_window = (float) atof(nob_shift_args(&argc, &argv));
+		}
+		else if (is_flag(flag, FLAG_NORMALIZE) && argc > 0) {
+			normalize = true;
+			target_lufs = (float) atof(nob_shift_args(&argc, &argv));
+		}
+		else if (is_flag(flag, FLAG_PEAKS) && argc > 0) peaks = (size_t) atol(nob_shift_args(&argc, &argv));
+		else if (is_flag(flag, FLAG_VISUALIZE)) visualize = true;
+		else if (is_flag(flag, FLAG_TUI)) tui_enabled = true;
+		else if (is_flag(flag, FLAG_DAEMON) && argc > 0) daemon_path = nob_shift_args(&argc, &argv);
+		else if (is_flag(flag, FLAG_STREAM) && argc > 0) stream_path = nob_shift_args(&argc, &argv);
+		else if (is_flag(flag, FLAG_HEADLESS)) audio_set_headless(true);
+		else if (is_flag(flag, FLAG_SHM) && argc > 0) shm_name = nob_shift_args(&argc, &argv);
+		else if (is_flag(flag, FLAG_DEDUPE)) dedupe = true;
+		else if (is_flag(flag, FLAG_ALIGN) && argc > 1) {
+			align_reference = nob_shift_args(&argc, &argv);
+			align_path = nob_shift_args(&argc, &argv);
+		}
+		else {
+			nob_log(NOB_ERROR, "Unknown option `%s`", flag);
+			usage(program.items);
+			return 1;
+		}
+	}
 	if (argc <= 0) {
 		nob_log(NOB_ERROR, "Missing input file");
 		usage(program.items);
 		return 1;
 	}
+    Arena a = {0};
+	if (dedupe) {		// every remaining argument is a music file
+		trace_end(&span);
+		DedupeLibrary library = {0};
+		for (; result == 0 && argc > 0; nob_temp_reset()) {
+			const char *path = nob_shift_args(&argc, &argv);
+			DedupeFile file = { .path = path };
+			if (!tracks_read_from_file(&a, timestamps_for_music(path), &file.tracks)) result = 3;
+			else nob_da_append(&library, file);
+		}
+		if (result == 0 && !dedupe_library(library, stdout, jobs)) result = 4;
+		for (size_t i = 0UL; i < library.count; i++) nob_da_free(&library.items[i].tracks);
+		nob_da_free(&library);
+		nob_return_defer(result);
+	}
 	const char *music_file = nob_shift_args(&argc, &argv);
     if (argc > 0) index = atoi(nob_shift_args(&argc, &argv));
-	const char *timestamp_file = nob_temp_sprintf("%s" TIMESTAMPS_FOLDER "%s", get_relative_path_to_music(music_file), timestamps_from_music_name(music_file));
+	const char *timestamp_file = timestamps_for_music(music_file);
+	trace_end(&span);
+
 
 
+	timestamp_file = arena_strdup(&a, timestamp_file);		// outlives the temp resets in audio_load_tracks
+	MusicCollection music;
+	if (analyze_path) {		// makes the .time file, so it can't need one
+		analyze.workers = jobs;
+		nob_return_defer(analyze_tracks(music_file, analyze_path, analyze) ? 0 : 4);
+	}
+	if (align_reference) {		// the .time file belongs to the reference rip, the input gets a new one
+		Tracks tracks = {0};
+		if (!tracks_read_from_file(&a, timestamps_for_music(align_reference), &tracks)) nob_return_defer(3);
+		if (!align_tracks(align_reference, tracks, music_file, align_path, jobs)) result = 4;
+		nob_da_free(&tracks);
+		nob_return_defer(result);
+	}
+	if (peaks) {		// the sidecar only needs the music, the .time file just picks the range
+		Tracks tracks = {0};
+		Waveform waveform;
+		WaveformPeak *pixels = calloc(peaks, sizeof(WaveformPeak));
+		if (!pixels) {
+			nob_log(NOB_ERROR, "Could not allocate %zu peaks", peaks);
+			nob_return_defer(2);
+		}
+		if (!tracks_read_from_file(&a, timestamp_file, &tracks) || index >= tracks.count) result = 3;
+		else if (!waveform_build(music_file, jobs) || !waveform_open(&waveform, music_file)) result = 4;
+		else {
+			size_t count = waveform_fetch_track(&waveform, track_get(tracks, index), pixels, peaks);
+			for (size_t i = 0UL; i < count; i++)
+				printf("%zu\t%.4f\t%.4f\t%.4f\n", i, pixels[i].min / 32767.0f, pixels[i].max / 32767.0f, pixels[i].rms / 32767.0f);
+			waveform_close(&waveform);
+		}
+		free(pixels);
+		nob_da_free(&tracks);
+		nob_return_defer(result);
+	}
+	if (split_dir) {		// works on the bitstream, no decoder or device needed
+		Tracks tracks = {0};
+		if (!tracks_read_from_file(&a, timestamp_file, &tracks)) nob_return_defer(3);
+		if (!mp3_split(music_file, tracks, split_dir)) result = 4;
+		nob_da_free(&tracks);
+		nob_return_defer(result);
+	}
+	if (render_path || export_dir) {
+		if (audio_init_offline() != MA_SUCCESS) nob_return_defer(2);
+		if (!audio_load_tracks(&a, &music, music_file, timestamp_file)) nob_return_defer(3);
+		if (refine) analyze_refine_tracks(&music, timestamp_file, analyze);
+		if (normalize) loudness_normalize_tracks(&music, timestamp_file, target_lufs, jobs);
+		if (render_path && !audio_render(&music, index, render_path)) result = 4;
+		if (export_dir && !export_tracks(&music, export_dir, jobs)) result = 4;
+		audio_unload_tracks(&music);
+		nob_return_defer(result);
+	}
 
+	audio_set_realtime(rt);
+	if (!control_init(!daemon_path)) nob_return_defer(2);
 	if (audio_init() != MA_SUCCESS) nob_return_defer(2);
+	if (shm_name && !shm_output_start(shm_name, 2.0)) nob_return_defer(2);		// 2s: a reader may stall that long
 
-    Arena a = {0};
-	MusicCollection music = audio_load_tracks(&a, music_file, timestamp_file);
+	if (!audio_load_tracks(&a, &music, music_file, timestamp_file)) nob_return_defer(3);
+	if (refine) analyze_refine_tracks(&music, timestamp_file, analyze);
+	if (normalize) loudness_normalize_tracks(&music, timestamp_file, target_lufs, jobs);
 
     // for (size_t i = 0UL; i < tracks.count; i++) {		// list tracks and their indices
     //     Track *t = track_get(tracks, i);
     //     printf("%zu : `%s` %u-%u\n", i, t->title, t->start, t->stop);
     // }
 
-	audio_select_track(&music, index);
-	audio_unpause();
+	if (!audio_select_track(&music, index)) {
+		audio_unload_tracks(&music);
+		nob_return_defer(3);
+	}
+	if ((daemon_path && !daemon_start(&music, daemon_path)) || (stream_path && !stream_start(stream_path))) {
+		daemon_stop();
+		audio_unload_tracks(&music);
+		nob_return_defer(2);
+	}
+	if (!daemon_path) audio_unpause();		// a daemon waits for `play`
+	if (visualize) visualize_start(STDOUT_FILENO);
+	if (tui_enabled) tui_enabled = tui_start(STDOUT_FILENO, visualize ? visualize_height() : 0);
 
-	getchar();
+	control_run(&music, tui_enabled ? tui_draw : NULL);
+	stream_stop();
+	daemon_stop();
+	tui_stop();
+	visualize_stop();
 
 	audio_unload_tracks(&music);
 defer:
 	audio_deinit();
+	shm_output_stop();		// the callback wrote into it up to here
+	control_deinit();
+	trace_flush();
     arena_free(&a);
 	return result;
 }
\ No newline at end of file
@@ -0,0 +1,185 @@
+#ifndef MAPVFS_H_
+#define MAPVFS_H_
+#include <nob.h>
+#include <miniaudio.h>
+#include <stdatomic.h>
+
+// A read-only `ma_vfs` that maps the whole file instead of going through stdio, so a decoder read is a
+// memcpy out of the page cache rather than a read(2). The mapping is MADV_SEQUENTIAL, and the next
+// window from the read position is advised MADV_WILLNEED whenever the decoder gets halfway through the
+// last one, or lands outside it after a seek, so the kernel reads ahead of the decoder thread instead of
+// faulting it in page by page. A file that shrinks while mapped raises SIGBUS, as with any mapping.
+typedef struct {
+	ma_vfs_callbacks cb;			// first: miniaudio takes the vfs as its callbacks
+	atomic_uint_fast64_t advice;	// madvise and posix_fadvise calls made, for the benchmark
+} MapVfs;
+
+typedef struct MapVfsFile MapVfsFile;
+
+void map_vfs_init(MapVfs *vfs);
+// The file the calling thread last opened through a MapVfs, e.g. the one a decoder keeps right after
+// `ma_decoder_init_vfs` succeeded. It is closed when that decoder is uninitialized.
+MapVfsFile *map_vfs_opened(void);
+// Starts reading `bytes` from where the file now is, e.g. right after a select seeked its decoder to a
+// track, before the decoder thread asks for them. Nothing for NULL.
+void map_vfs_prefetch(MapVfsFile *file, size_t bytes);
+
+#endif // MAPVFS_H_
+
+#ifdef MAPVFS_IMPLEMENTATION
+#undef MAPVFS_IMPLEMENTATION
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAP_VFS_WINDOW	(1UL<<20)	// about 5 s of 16-bit stereo WAV, 26 s of 320 kbps MP3
+
+struct MapVfsFile {
+	MapVfs *vfs;
+	int fd;							// kept open for posix_fadvise
+	unsigned char *data;
+	size_t size;
+	size_t cursor;
+	size_t advised_from;			// the last window given MADV_WILLNEED
+	size_t advised_to;
+};
+
+static _Thread_local MapVfsFile *map_vfs_last_opened = NULL;
+
+static void map_vfs_advise(MapVfsFile *f) {
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	size_t from = f->cursor / page * page;
+	size_t to = f->size - from > MAP_VFS_WINDOW ? from + MAP_VFS_WINDOW : f->size;
+	madvise(f->data + from, to - from, MADV_WILLNEED);
+	f->advised_from = from;
+	f->advised_to = to;
+	atomic_fetch_add_explicit(&f->vfs->advice, 1U, memory_order_relaxed);
+}
+
+static ma_result map_vfs_open(ma_vfs *pVFS, const char *pFilePath, ma_uint32 openMode, ma_vfs_file *pFile) {
+	*pFile = NULL;
+	map_vfs_last_opened = NULL;
+	if (openMode & MA_OPEN_MODE_WRITE) return MA_INVALID_OPERATION;
+
+	struct stat st;
+	int fd = open(pFilePath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return ma_result_from_errno(errno);
+	if (fstat(fd, &st) != 0) {
+		ma_result result = ma_result_from_errno(errno);
+		close(fd);
+		return result;
+	}
+	MapVfsFile *f = calloc(1UL, sizeof(*f));
+	if (!f) {
+		close(fd);
+		return MA_OUT_OF_MEMORY;
+	}
+	f->vfs = pVFS;
+	f->fd = fd;
+	f->size = (size_t) st.st_size;
+	if (f->size) {
+		f->data = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (f->data == MAP_FAILED) {
+			ma_result result = ma_result_from_errno(errno);
+			close(fd);
+			free(f);
+			return result;
+		}
+		madvise(f->data, f->size, MADV_SEQUENTIAL);
+	}
+	*pFile = f;
+	map_vfs_last_opened = f;
+	return MA_SUCCESS;
+}
+
+static ma_result map_vfs_close(ma_vfs *pVFS, ma_vfs_file file) {
+	NOB_UNUSED(pVFS);
+	MapVfsFile *f = file;
+	if (map_vfs_last_opened == f) map_vfs_last_opened = NULL;
+	if (f->size) munmap(f->data, f->size);
+	close(f->fd);
+	free(f);
+	return MA_SUCCESS;
+}
+
+static ma_result map_vfs_read(ma_vfs *pVFS, ma_vfs_file file, void *pDst, size_t sizeInBytes, size_t *pBytesRead) {
+	NOB_UNUSED(pVFS);
+	MapVfsFile *f = file;
+	size_t count = f->cursor < f->size ? f->size - f->cursor : 0UL;
+	if (count > sizeInBytes) count = sizeInBytes;
+	if (pBytesRead) *pBytesRead = count;
+	if (count == 0UL) return sizeInBytes ? MA_AT_END : MA_SUCCESS;
+
+	if (f->cursor < f->advised_from || f->cursor >= f->advised_to
+		|| (f->advised_to < f->size && f->cursor + MAP_VFS_WINDOW / 2UL >= f->advised_to)) {
+		map_vfs_advise(f);
+	}
+	memcpy(pDst, f->data + f->cursor, count);
+	f->cursor += count;
+	return MA_SUCCESS;
+}
+
+static ma_result map_vfs_write(ma_vfs *pVFS, ma_vfs_file file, const void *pSrc, size_t sizeInBytes, size_t *pBytesWritten) {
+	NOB_UNUSED(pVFS);
+	NOB_UNUSED(file);
+	NOB_UNUSED(pSrc);
+	NOB_UNUSED(sizeInBytes);
+	if (pBytesWritten) *pBytesWritten = 0UL;
+	return MA_INVALID_OPERATION;
+}
+
+static ma_result map_vfs_seek(ma_vfs *pVFS, ma_vfs_file file, ma_int64 offset, ma_seek_origin origin) {
+	NOB_UNUSED(pVFS);
+	MapVfsFile *f = file;
+	ma_int64 base = origin == ma_seek_origin_start ? 0 : origin == ma_seek_origin_end ? (ma_int64) f->size : (ma_int64) f->cursor;
+	if (base + offset < 0) return MA_INVALID_ARGS;
+	f->cursor = (size_t) (base + offset);		// past the end is allowed, reads there are at the end
+	return MA_SUCCESS;
+}
+
+static ma_result map_vfs_tell(ma_vfs *pVFS, ma_vfs_file file, ma_int64 *pCursor) {
+	NOB_UNUSED(pVFS);
+	*pCursor = (ma_int64) ((MapVfsFile *) file)->cursor;
+	return MA_SUCCESS;
+}
+
+static ma_result map_vfs_info(ma_vfs *pVFS, ma_vfs_file file, ma_file_info *pInfo) {
+	NOB_UNUSED(pVFS);
+	pInfo->sizeInBytes = ((MapVfsFile *) file)->size;
+	return MA_SUCCESS;
+}
+
+void map_vfs_init(MapVfs *vfs) {
+	vfs->cb = (ma_vfs_callbacks) {
+		.onOpen = map_vfs_open,
+		.onClose = map_vfs_close,
+		.onRead = map_vfs_read,
+		.onWrite = map_vfs_write,
+		.onSeek = map_vfs_seek,
+		.onTell = map_vfs_tell,
+		.onInfo = map_vfs_info,
+	};
+	atomic_init(&vfs->advice, 0U);
+}
+
+MapVfsFile *map_vfs_opened(void) {
+	return map_vfs_last_opened;
+}
+
+void map_vfs_prefetch(MapVfsFile *f, size_t bytes) {
+	if (!f || f->cursor >= f->size) return;
+	if (bytes > f->size - f->cursor) bytes = f->size - f->cursor;
+#ifdef POSIX_FADV_WILLNEED
+	posix_fadvise(f->fd, (off_t) f->cursor, (off_t) bytes, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+	struct radvisory advice = { .ra_offset = (off_t) f->cursor, .ra_count = bytes > INT_MAX ? INT_MAX : (int) bytes };
+	fcntl(f->fd, F_RDADVISE, &advice);
+#endif
+	atomic_fetch_add_explicit(&f->vfs->advice, 1U, memory_order_relaxed);
+}
+#undef MAP_VFS_WINDOW
+#endif // MAPVFS_IMPLEMENTATION
@@ -0,0 +1,345 @@
+#ifndef MP3SPLIT_H_
+#define MP3SPLIT_H_
+#include "tracks.h"
+
+// Lossless MP3 splitting: every track is copied byte-for-byte from the source frames, no decoding.
+// Cuts land on the frame holding each Track.start; the frames its bit reservoir (and the IMDCT
+// overlap) reach back into are carried along, and a LAME/Info header records encoder delay and
+// padding so gapless-aware players trim to the exact sample. Track times follow the same
+// convention, i.e. they count from the first sample such a player would output for the source.
+bool mp3_split(const char *mp3_path, Tracks tracks, const char *output_dir);
+
+#endif // MP3SPLIT_H_
+
+#ifdef MP3SPLIT_IMPLEMENTATION
+#undef MP3SPLIT_IMPLEMENTATION
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MP3_DECODER_DELAY	529		// samples every Layer III decoder adds in front, part of LAME's delay convention
+#define MP3_MAX_DELAY		0xFFF	// LAME tag delay and padding are 12-bit
+#define MP3_XING_SIZE		120		// "Info", flags, frames, bytes, 100 byte TOC, quality
+#define MP3_LAME_SIZE		36
+#define MP3_LAME_CRC_OFFSET	34
+#define MP3_MAX_FRAME_SIZE	1441	// 320 kbps at 32 kHz, with padding
+
+typedef struct {
+	size_t offset;
+	uint32_t size;
+	uint16_t main_data_begin;	// reservoir bytes this frame borrows from the ones before it
+	uint16_t main_data_size;	// bytes after header, CRC and side info
+	uint16_t bitrate;
+} Mp3Frame;
+
+typedef struct {
+	Mp3Frame *items;
+	size_t count;
+	size_t capacity;
+
+	uint8_t header[4];			// of the first audio frame, template for the Info frame
+	uint32_t sample_rate;
+	uint32_t samples_per_frame;
+	uint32_t side_info_size;
+	bool mpeg1;
+	uint32_t delay;				// samples gapless players drop at the start of the source
+	uint32_t end_trim;			// ... and at its end
+} Mp3Stream;
+
+static const uint16_t mp3_bitrates[2][16] = {
+	{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },		// MPEG 2 and 2.5
+	{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 },	// MPEG 1
+};
+static const uint32_t mp3_sample_rates[3] = { 44100, 48000, 32000 };
+
+typedef struct {
+	bool mpeg1;
+	bool crc;
+	bool mono;
+	uint32_t bitrate;
+	uint32_t sample_rate;
+	uint32_t size;
+} Mp3Header;
+
+// Layer III only: it is what OSTs are shipped as, and the only layer with a bit reservoir.
+static bool mp3_parse_header(const uint8_t *p, size_t left, Mp3Header *h) {
+	if (left < 4 || p[0] != 0xFF || (p[1] & 0xE0) != 0xE0) return false;
+	uint8_t version = (p[1] >> 3) & 3, layer = (p[1] >> 1) & 3;
+	uint8_t bitrate_index = p[2] >> 4, rate_index = (p[2] >> 2) & 3;
+	if (version == 1 || layer != 1 || bitrate_index == 0 || bitrate_index == 15 || rate_index == 3) return false;
+
+	h->mpeg1 = version == 3;
+	h->crc = (p[1] & 1) == 0;
+	h->mono = (p[3] >> 6) == 3;
+	h->bitrate = mp3_bitrates[h->mpeg1][bitrate_index];
+	h->sample_rate = mp3_sample_rates[rate_index] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+	h->size = (h->mpeg1 ? 144000U : 72000U) * h->bitrate / h->sample_rate + ((p[2] >> 1) & 1);
+	return h->size <= left;
+}
+
+static uint32_t mp3_side_info_size(const Mp3Header *h) {
+	return h->mpeg1 ? (h->mono ? 17U : 32U) : (h->mono ? 9U : 17U);
+}
+
+static size_t mp3_skip_id3v2(const uint8_t *p, size_t size) {
+	if (size < 10 || memcmp(p, "ID3", 3) != 0) return 0;
+	size_t tag = ((size_t) (p[6] & 0x7F) << 21) | ((p[7] & 0x7F) << 14) | ((p[8] & 0x7F) << 7) | (p[9] & 0x7F);
+	tag += 10 + ((p[5] & 0x10) ? 10 : 0);
+	return tag < size ? tag : size;
+}
+
+// A Xing/Info (or VBRI) frame carries no audio; if it has a LAME tag, pick up delay and padding.
+static bool mp3_parse_info_frame(const uint8_t *frame, const Mp3Header *h, Mp3Stream *stream) {
+	const uint8_t *xing = frame + 4 + (h->crc ? 2 : 0) + mp3_side_info_size(h);
+	if (h->size >= 36 + 4 && memcmp(frame + 36, "VBRI", 4) == 0) return true;
+	if (xing + 8 > frame + h->size || (memcmp(xing, "Xing", 4) != 0 && memcmp(xing, "Info", 4) != 0)) return false;
+
+	uint32_t flags = ((uint32_t) xing[4] << 24) | (xing[5] << 16) | (xing[6] << 8) | xing[7];
+	const uint8_t *lame = xing + 8 + ((flags & 1) ? 4 : 0) + ((flags & 2) ? 4 : 0) + ((flags & 4) ? 100 : 0) + ((flags & 8) ? 4 : 0);
+	if (lame + 24 <= frame + h->size && (memcmp(lame, "LAME", 4) == 0 || memcmp(lame, "Lavf", 4) == 0 || memcmp(lame, "Lavc", 4) == 0)) {
+		uint32_t delay = (lame[21] << 4) | (lame[22] >> 4);
+		uint32_t padding = ((lame[22] & 0xF) << 8) | lame[23];
+		stream->delay = delay + MP3_DECODER_DELAY;
+		stream->end_trim = padding > MP3_DECODER_DELAY ? padding - MP3_DECODER_DELAY : 0;
+	}
+	return true;
+}
+
+static bool mp3_scan(const uint8_t *data, size_t size, Mp3Stream *stream) {
+	size_t at = mp3_skip_id3v2(data, size);
+	bool first = true;
+	Mp3Header h;
+
+	while (at + 4 <= size) {
+		// Resync on garbage, but only trust a header when the next frame also parses (or the data ends).
+		if (!mp3_parse_header(data + at, size - at, &h)) {
+			at++;
+			continue;
+		}
+		Mp3Header next;
+		if (at + h.size + 4 <= size && !mp3_parse_header(data + at + h.size, size - at - h.size, &next)) {
+			at++;
+			continue;
+		}
+
+		if (first) {
+			first = false;
+			if (mp3_parse_info_frame(data + at, &h, stream)) {
+				at += h.size;
+				continue;
+			}
+		}
+		if (stream->count == 0) {
+			memcpy(stream->header, data + at, 4);
+			stream->sample_rate = h.sample_rate;
+			stream->samples_per_frame = h.mpeg1 ? 1152U : 576U;
+			stream->side_info_size = mp3_side_info_size(&h);
+			stream->mpeg1 = h.mpeg1;
+		}
+
+		const uint8_t *side = data + at + 4 + (h.crc ? 2 : 0);
+		uint32_t overhead = 4 + (h.crc ? 2 : 0) + mp3_side_info_size(&h);
+		nob_da_append(stream, ((Mp3Frame) {
+			.offset = at,
+			.size = h.size,
+			.main_data_begin = h.mpeg1 ? (side[0] << 1) | (side[1] >> 7) : side[0],
+			.main_data_size = h.size > overhead ? h.size - overhead : 0,
+			.bitrate = h.bitrate,
+		}));
+		at += h.size;
+	}
+	return stream->count > 0;
+}
+
+static uint16_t mp3_crc16(uint16_t crc, const uint8_t *p, size_t size) {
+	static uint16_t table[256];
+	if (table[1] == 0) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint16_t c = (uint16_t) i;
+			for (int b = 0; b < 8; b++) c = (c & 1) ? (c >> 1) ^ 0xA001 : c >> 1;
+			table[i] = c;
+		}
+	}
+	for (size_t i = 0UL; i < size; i++) crc = (crc >> 8) ^ table[(crc ^ p[i]) & 0xFF];
+	return crc;
+}
+
+static inline void mp3_put_be32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24, p[1] = v >> 16, p[2] = v >> 8, p[3] = v;
+}
+
+static inline void mp3_put_synchsafe(uint8_t *p, uint32_t v) {
+	p[0] = (v >> 21) & 0x7F, p[1] = (v >> 14) & 0x7F, p[2] = (v >> 7) & 0x7F, p[3] = v & 0x7F;
+}
+
+static void mp3_id3v2_text_frame(Nob_StringBuilder *sb, const char *id, const char *text) {
+	uint8_t header[10] = {0};
+	memcpy(header, id, 4);
+	mp3_put_synchsafe(header + 4, (uint32_t) strlen(text) + 1U);
+	nob_da_append_many(sb, header, sizeof(header));
+	nob_da_append(sb, 0x03);	// UTF-8
+	nob_sb_append_cstr(sb, text);
+}
+
+// ID3v2.4 with title and track number, so the split files are recognisable on their own.
+static void mp3_id3v2(Nob_StringBuilder *sb, const char *title, size_t number, size_t total) {
+	char track[64];
+	snprintf(track, sizeof(track), "%zu/%zu", number, total);
+
+	nob_sb_append_buf(sb, "ID3\x04\x00\x00\x00\x00\x00\x00", 10);
+	size_t start = sb->count;
+	mp3_id3v2_text_frame(sb, "TIT2", title);
+	mp3_id3v2_text_frame(sb, "TRCK", track);
+	mp3_put_synchsafe((uint8_t *) sb->items + start - 4, (uint32_t) (sb->count - start));
+}
+
+// Info frame: same stream parameters as the audio, big enough for Xing + LAME tags.
+static void mp3_info_frame(Nob_StringBuilder *sb, const Mp3Stream *stream, const uint8_t *audio, size_t audio_size, size_t frames, uint32_t delay, uint32_t padding) {
+	uint8_t header[4];
+	memcpy(header, stream->header, 4);
+	header[1] |= 1;						// no CRC
+	header[2] &= 0x0D;					// clear bitrate and padding bits
+	header[3] &= 0xCF;					// clear mode extension
+
+	uint32_t needed = 4 + stream->side_info_size + MP3_XING_SIZE + MP3_LAME_SIZE, size = 0;
+	uint8_t index = 1;
+	for (; index < 15; index++) {
+		size = (stream->mpeg1 ? 144000U : 72000U) * mp3_bitrates[stream->mpeg1][index] / stream->sample_rate;
+		if (size >= needed) break;
+	}
+	header[2] |= index << 4;
+
+	uint8_t frame[MP3_MAX_FRAME_SIZE] = {0};
+	memcpy(frame, header, 4);
+
+	bool cbr = true;
+	const uint8_t *first = audio;
+	Mp3Header h;
+	for (const uint8_t *p = audio; cbr && p + 4 <= audio + audio_size && mp3_parse_header(p, audio + audio_size - p, &h); p += h.size)
+		cbr = ((p[2] ^ first[2]) & 0xF0) == 0;
+
+	uint8_t *xing = frame + 4 + stream->side_info_size;
+	memcpy(xing, cbr ? "Info" : "Xing", 4);
+	mp3_put_be32(xing + 4, 0x0F);
+	mp3_put_be32(xing + 8, (uint32_t) frames);
+	mp3_put_be32(xing + 12, (uint32_t) (size + audio_size));
+	for (uint32_t i = 0; i < 100; i++) xing[16 + i] = (uint8_t) (i * 256U / 100U);	// byte position ~ time without per-frame data; fine for seeking
+	mp3_put_be32(xing + 116, 0);
+
+	uint8_t *lame = xing + MP3_XING_SIZE;
+	memcpy(lame, "LAME3.100", 9);
+	lame[9] = cbr ? 1 : 0;
+	lame[21] = (uint8_t) (delay >> 4);
+	lame[22] = (uint8_t) (((delay & 0xF) << 4) | (padding >> 8));
+	lame[23] = (uint8_t) padding;
+	mp3_put_be32(lame + 28, (uint32_t) (size + audio_size));
+	uint16_t music_crc = mp3_crc16(0, audio, audio_size);
+	lame[32] = music_crc >> 8, lame[33] = music_crc & 0xFF;
+	uint16_t tag_crc = mp3_crc16(0, frame, (size_t) (lame + MP3_LAME_CRC_OFFSET - frame));
+	lame[34] = tag_crc >> 8, lame[35] = tag_crc & 0xFF;
+	nob_sb_append_buf(sb, frame, size);
+}
+
+static bool mp3_write_track(const uint8_t *data, const Mp3Stream *stream, const Track *track, size_t index, size_t total, const char *output_dir, size_t *bytes) {
+	uint64_t spf = stream->samples_per_frame;
+	uint64_t decoded = stream->count * spf, trimmed = stream->delay + stream->end_trim;
+	uint64_t valid = decoded > trimmed ? decoded - trimmed : 0U;		// a header claiming more than there is
+	uint64_t start = track_start_frame(track, stream->sample_rate);
+	uint64_t stop = index + 1UL == total || track->stop_us == 0 ? valid : track_stop_frame(track, stream->sample_rate);
+	if (stop > valid) stop = valid;
+	if (start >= stop) {
+		nob_log(NOB_WARNING, "Track %zu `%s` is past the end of the stream, skipped", index + 1UL, track->title);
+		return true;
+	}
+
+	// Source-relative raw sample positions: what a decoder outputs before any gapless trimming.
+	uint64_t raw = start + stream->delay;
+	size_t k = (size_t) (raw / spf), first = k;
+	uint32_t borrowed = 0;
+	while (first > 0 && borrowed < stream->items[k].main_data_begin) borrowed += stream->items[--first].main_data_size;
+	if (first > 0) first--;		// its granules overlap-add into the first one we keep
+
+	uint64_t trim = (k - first) * spf + raw % spf;
+	while (trim < MP3_DECODER_DELAY && first > 0) first--, trim += spf;
+	if (trim > MP3_MAX_DELAY + MP3_DECODER_DELAY) {
+		nob_log(NOB_WARNING, "Track %zu `%s`: reservoir reaches too far back for the LAME delay field, first frame may glitch", index + 1UL, track->title);
+		while (trim > MP3_MAX_DELAY + MP3_DECODER_DELAY && first < k) first++, trim -= spf;
+	}
+	size_t last = (size_t) ((stop + stream->delay - 1) / spf);
+	if (last >= stream->count) last = stream->count - 1UL;
+
+	size_t frames = last - first + 1UL;
+	uint64_t padding = frames * spf - trim - (stop - start) + MP3_DECODER_DELAY;
+	uint32_t delay = trim > MP3_DECODER_DELAY ? (uint32_t) (trim - MP3_DECODER_DELAY) : 0U;
+	if (padding > MP3_MAX_DELAY) padding = MP3_MAX_DELAY;
+
+	const uint8_t *audio = data + stream->items[first].offset;
+	size_t audio_size = stream->items[last].offset + stream->items[last].size - stream->items[first].offset;
+
+	Nob_StringBuilder head = {0};
+	mp3_id3v2(&head, track->title, index + 1UL, total);
+	mp3_info_frame(&head, stream, audio, audio_size, frames, delay, (uint32_t) padding);
+
+	char path[PATH_MAX];
+	int n = snprintf(path, sizeof(path), "%s/%0*zu - ", output_dir, snprintf(NULL, 0, "%zu", total), index + 1UL);
+	for (const char *c = track->title; *c && (size_t) n + 5UL < sizeof(path); c++) path[n++] = *c == '/' || *c == '\\' ? '_' : *c;
+	snprintf(path + n, sizeof(path) - n, ".mp3");
+
+	FILE *f = fopen(path, "wb");
+	bool ok = f && fwrite(head.items, 1, head.count, f) == head.count && fwrite(audio, 1, audio_size, f) == audio_size;
+	if (f && fclose(f) != 0) ok = false;
+	if (!ok) nob_log(NOB_ERROR, "Could not write `%s`: %s", path, strerror(errno));
+	else *bytes += head.count + audio_size;
+	nob_sb_free(&head);
+	return ok;
+}
+
+bool mp3_split(const char *mp3_path, Tracks tracks, const char *output_dir) {
+	bool result = true;
+	Mp3Stream stream = {0};
+	uint8_t *data = MAP_FAILED;
+	struct stat st = {0};
+
+	int fd = open(mp3_path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+		nob_log(NOB_ERROR, "Could not open `%s`: %s", mp3_path, strerror(errno));
+		nob_return_defer(false);
+	}
+	uint64_t start_ns = stats_now_ns();
+	data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		nob_log(NOB_ERROR, "Could not map `%s`: %s", mp3_path, strerror(errno));
+		nob_return_defer(false);
+	}
+	madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+	if (!mp3_scan(data, (size_t) st.st_size, &stream)) {
+		nob_log(NOB_ERROR, "`%s` has no MPEG Layer III frames", mp3_path);
+		nob_return_defer(false);
+	}
+	if (!nob_mkdir_if_not_exists(output_dir)) nob_return_defer(false);
+
+	size_t bytes = 0UL;
+	for (size_t i = 0UL; i < tracks.count; i++)
+		if (!mp3_write_track(data, &stream, track_get(tracks, i), i, tracks.count, output_dir, &bytes)) result = false;
+
+	double seconds = (stats_now_ns() - start_ns) / 1e9;
+	nob_log(NOB_INFO, "Split `%s` into %zu tracks (%zu frames, %.1f MB) in %.3fs = %.0f MB/s", mp3_path, tracks.count,
+		stream.count, bytes / 1e6, seconds, bytes / 1e6 / (seconds > 0.0 ? seconds : 1e-9));
+
+defer:
+	if (data != MAP_FAILED) munmap(data, (size_t) st.st_size);
+	if (fd >= 0) close(fd);
+	nob_da_free(&stream);
+	return result;
+}
+
+#undef MP3_DECODER_DELAY
+#undef MP3_MAX_DELAY
+#undef MP3_XING_SIZE
+#undef MP3_LAME_SIZE
+#undef MP3_LAME_CRC_OFFSET
+#undef MP3_MAX_FRAME_SIZE
+#endif // MP3SPLIT_IMPLEMENTATION
@@ -0,0 +1,16 @@
+// libmstamp: the engine API of audio.h (`mstamp_*`) and the session engine of session.h, without the
+// player's own default engine, so nothing in it is shared between engines. Built by `./nob -lib` into
+// libmstamp.a and libmstamp.so; include "audio.h" with MSTAMP_LIBRARY defined to use it. nob.h, arena.h
+// and miniaudio.h are compiled in, so don't link another copy of them next to it.
+#define MSTAMP_LIBRARY
+#define NOB_IMPLEMENTATION
+#include <nob.h>
+#define ARENA_IMPLEMENTATION
+#include <arena.h>
+#define MINIAUDIO_IMPLEMENTATION
+#include <miniaudio.h>
+
+#define AUDIO_IMPLEMENTATION
+#include "audio.h"
+#define SESSION_IMPLEMENTATION
+#include "session.h"
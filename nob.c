@@ -2,22 +2,59 @@
 #include <nob.h>
 
 #define nob_cc(cmd) nob_cmd_append(cmd, "gcc")
-#define nob_cc_flags(cmd) nob_cmd_append(cmd, "-Wall", "-Wextra", "-fsanitize=address")
+#define nob_cc_flags(cmd) nob_cmd_append(cmd, "-Wall", "-Wextra", "-D_GNU_SOURCE", "-fsanitize=address")
 #define nob_cc_in(cmd, files...) nob_cmd_append(cmd, ##files)
 #define nob_cc_out(cmd, file) nob_cmd_append(cmd, "-o", file)
+#define nob_cc_release_flags(cmd) nob_cmd_append(cmd, "-Wall", "-Wextra", "-D_GNU_SOURCE", "-O2", "-g")
+#define nob_cc_libs(cmd) nob_cmd_append(cmd, "-lm", "-lpthread", "-ldl")
 
 #define MAIN_BINARY "main"
 #define MAIN_SOURCE MAIN_BINARY ".c"
+#define RTCHECK_BINARY MAIN_BINARY "_rtcheck"
+#define BENCH_BINARY "bench"
+#define BENCH_SOURCE BENCH_BINARY ".c"
+#define GEN_BINARY "gen"
+#define GEN_SOURCE GEN_BINARY ".c"
+#define LIB_NAME "mstamp"
+#define LIB_SOURCE LIB_NAME ".c"
+#define LIB_OBJECT LIB_NAME ".o"
+#define LIB_STATIC "lib" LIB_NAME ".a"
+#define LIB_SHARED "lib" LIB_NAME ".so"
+#define RTCHECK_WRAP_FLAGS "-Wl" \
+	",--wrap=malloc" \
+	",--wrap=calloc" \
+	",--wrap=realloc" \
+	",--wrap=free" \
+	",--wrap=posix_memalign" \
+	",--wrap=fopen" \
+	",--wrap=fread" \
+	",--wrap=fwrite" \
+	",--wrap=vfprintf" \
+	",--wrap=read" \
+	",--wrap=write" \
+	",--wrap=pthread_mutex_lock" \
+	",--wrap=pthread_cond_wait" \
+	",--wrap=sem_wait" \
+	",--wrap=usleep" \
+	",--wrap=nanosleep"
 
 
 
 static inline bool is_flag(const char *test, const char *flag) { return strcmp(test, flag) == 0; }
 #define FLAG_CLEAN "-clean"
+#define FLAG_RTCHECK "-rtcheck"
+#define FLAG_BENCH "-bench"
+#define FLAG_GEN "-gen"
+#define FLAG_LIB "-lib"
 
 
 
 // ./nob <OPTIONS>...
 //		-clean - remove BINARY
+//		-rtcheck - also build RTCHECK_BINARY, aborting on non-realtime-safe calls inside the audio callback
+//		-bench - also build BENCH_BINARY (optimized, no sanitizers), see `./bench` for usage
+//		-gen - also build GEN_BINARY, the synthetic corpus generator, see `./gen` for usage
+//		-lib - also build LIB_STATIC and LIB_SHARED, the engine API without the player, from LIB_SOURCE
 int main(int argc, char *argv[]) {
 	NOB_GO_REBUILD_URSELF(argc, argv);
 
@@ -26,7 +63,11 @@ int main(int argc, char *argv[]) {
 
 	struct {
 		bool clean : 1;
-	} flags;
+		bool rtcheck : 1;
+		bool bench : 1;
+		bool gen : 1;
+		bool lib : 1;
+	} flags = {0};
 
 
 	
@@ -36,22 +77,88 @@ int main(int argc, char *argv[]) {
 		flag = nob_shift_args(&argc, &argv);
 
 		if (is_flag(flag, FLAG_CLEAN)) {
-			nob_cmd_append(&cmd, "rm", MAIN_BINARY);
+			nob_cmd_append(&cmd, "rm", "-f", MAIN_BINARY, RTCHECK_BINARY, BENCH_BINARY, GEN_BINARY, LIB_OBJECT, LIB_STATIC, LIB_SHARED);
 			nob_cmd_run_sync(&cmd);
 			nob_return_defer(0);
 		}
+		else if (is_flag(flag, FLAG_RTCHECK)) flags.rtcheck = true;
+		else if (is_flag(flag, FLAG_BENCH)) flags.bench = true;
+		else if (is_flag(flag, FLAG_GEN)) flags.gen = true;
+		else if (is_flag(flag, FLAG_LIB)) flags.lib = true;
 	}
 
 
 
 	Nob_Cmd paths = {0};
-	nob_cmd_append(&paths, MAIN_SOURCE, "tracks.h", "audio.h");
+	nob_cmd_append(&paths, MAIN_SOURCE, "tracks.h", "audio.h", "realtime.h", "rtcheck.h", "stats.h", "trace.h", "mapvfs.h", "export.h", "mp3split.h", "analyze.h", "align.h", "dedupe.h", "loudness.h", "waveform.h", "fft.h", "visualize.h", "control.h", "tui.h", "daemon.h", "stream.h", "shmout.h", "session.h");
 
 	nob_cc(&cmd);
 	nob_cc_flags(&cmd);
 	nob_cc_in(&cmd, MAIN_SOURCE);
 	nob_cc_out(&cmd, MAIN_BINARY);
+	nob_cc_libs(&cmd);
 	if (nob_needs_rebuild(MAIN_BINARY, paths.items, paths.count) && !nob_cmd_run_sync_and_reset(&cmd)) nob_return_defer(1);
+	cmd.count = 0;
+
+	if (flags.rtcheck) {
+		nob_cc(&cmd);
+		nob_cc_flags(&cmd);
+		nob_cmd_append(&cmd, "-g", "-rdynamic", "-DMSTAMP_RTCHECK", RTCHECK_WRAP_FLAGS);
+		nob_cc_in(&cmd, MAIN_SOURCE);
+		nob_cc_out(&cmd, RTCHECK_BINARY);
+		nob_cc_libs(&cmd);
+		if (nob_needs_rebuild(RTCHECK_BINARY, paths.items, paths.count) && !nob_cmd_run_sync_and_reset(&cmd)) nob_return_defer(1);
+		cmd.count = 0;
+	}
+
+	if (flags.bench) {
+		paths.items[0] = BENCH_SOURCE;
+		nob_cc(&cmd);
+		nob_cc_release_flags(&cmd);
+		nob_cc_in(&cmd, BENCH_SOURCE);
+		nob_cc_out(&cmd, BENCH_BINARY);
+		nob_cc_libs(&cmd);
+		if (nob_needs_rebuild(BENCH_BINARY, paths.items, paths.count) && !nob_cmd_run_sync_and_reset(&cmd)) nob_return_defer(1);
+		cmd.count = 0;
+		paths.items[0] = MAIN_SOURCE;
+	}
+
+	if (flags.gen) {
+		const char *gen_paths[] = { GEN_SOURCE, "tracks.h" };
+		nob_cc(&cmd);
+		nob_cc_release_flags(&cmd);
+		nob_cc_in(&cmd, GEN_SOURCE);
+		nob_cc_out(&cmd, GEN_BINARY);
+		nob_cc_libs(&cmd);
+		if (nob_needs_rebuild(GEN_BINARY, gen_paths, NOB_ARRAY_LEN(gen_paths)) && !nob_cmd_run_sync_and_reset(&cmd)) nob_return_defer(1);
+		cmd.count = 0;
+	}
+
+	if (flags.lib) {
+		const char *lib_paths[] = { LIB_SOURCE, "tracks.h", "audio.h", "realtime.h", "rtcheck.h", "stats.h", "trace.h", "mapvfs.h", "session.h" };
+		if (nob_needs_rebuild(LIB_OBJECT, lib_paths, NOB_ARRAY_LEN(lib_paths))) {
+			nob_cc(&cmd);
+			nob_cc_release_flags(&cmd);
+			nob_cmd_append(&cmd, "-fPIC", "-c");
+			nob_cc_in(&cmd, LIB_SOURCE);
+			nob_cc_out(&cmd, LIB_OBJECT);
+			if (!nob_cmd_run_sync_and_reset(&cmd)) nob_return_defer(1);
+		}
+		if (nob_needs_rebuild1(LIB_STATIC, LIB_OBJECT)) {
+			nob_cmd_append(&cmd, "rm", "-f", LIB_STATIC);		// ar would keep members of an older archive
+			if (!nob_cmd_run_sync_and_reset(&cmd)) nob_return_defer(1);
+			nob_cmd_append(&cmd, "ar", "rcs", LIB_STATIC, LIB_OBJECT);
+			if (!nob_cmd_run_sync_and_reset(&cmd)) nob_return_defer(1);
+		}
+		if (nob_needs_rebuild1(LIB_SHARED, LIB_OBJECT)) {
+			nob_cc(&cmd);
+			nob_cmd_append(&cmd, "-shared");
+			nob_cc_in(&cmd, LIB_OBJECT);
+			nob_cc_out(&cmd, LIB_SHARED);
+			nob_cc_libs(&cmd);
+			if (!nob_cmd_run_sync_and_reset(&cmd)) nob_return_defer(1);
+		}
+	}
 
 defer:
 	nob_cmd_free(&cmd);
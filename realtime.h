@@ -0,0 +1,125 @@
+#ifndef REALTIME_H_
+#define REALTIME_H_
+#include <nob.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+typedef struct {
+	bool enabled;
+	int cpu;		// CPU to pin the decoder thread to, -1 leaves affinity alone
+} Realtime;
+
+typedef struct {
+	atomic_size_t locked_bytes;
+	atomic_size_t unlocked_bytes;	// prefaulted, but mlock was refused (RLIMIT_MEMLOCK)
+	int policy;						// SCHED_FIFO, or SCHED_OTHER when it fell back to nice
+	int priority;					// SCHED_FIFO priority, or nice value for SCHED_OTHER
+	bool pinned;
+} RealtimeStatus;
+
+#define REALTIME_DEFAULT ((Realtime) { .enabled = false, .cpu = -1 })
+
+void realtime_prefault(void *buffer, size_t size);
+bool realtime_lock_memory(RealtimeStatus *status, void *buffer, size_t size);
+void realtime_prefault_stack(void);
+void realtime_promote_thread(const Realtime *rt, RealtimeStatus *status);
+void realtime_log_status(const Realtime *rt, RealtimeStatus *status);
+
+#endif // REALTIME_H_
+
+#ifdef REALTIME_IMPLEMENTATION
+#undef REALTIME_IMPLEMENTATION
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define REALTIME_FIFO_PRIORITY	70		// below JACK/PipeWire's own threads, above everything else
+#define REALTIME_NICE			-11		// what rtkit hands out to PulseAudio clients
+#define REALTIME_STACK_PREFAULT	(1<<16)
+
+void realtime_prefault(void *buffer, size_t size) {
+	long page = sysconf(_SC_PAGESIZE);
+	volatile char *p = buffer;
+	for (size_t i = 0UL; i < size; i += page) p[i] = p[i];
+	if (size) p[size - 1UL] = p[size - 1UL];
+}
+
+bool realtime_lock_memory(RealtimeStatus *status, void *buffer, size_t size) {
+	realtime_prefault(buffer, size);
+	if (mlock(buffer, size) != 0) {
+		atomic_fetch_add(&status->unlocked_bytes, size);
+		return false;
+	}
+	atomic_fetch_add(&status->locked_bytes, size);
+	return true;
+}
+
+void realtime_prefault_stack(void) {
+	volatile char stack[REALTIME_STACK_PREFAULT];
+	memset((char *) stack, 0, sizeof(stack));
+}
+
+void realtime_promote_thread(const Realtime *rt, RealtimeStatus *status) {
+	status->policy = SCHED_OTHER;
+	status->priority = 0;
+	status->pinned = false;
+	if (!rt->enabled) return;
+
+	realtime_prefault_stack();
+
+#ifdef __linux__
+	if (rt->cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(rt->cpu, &set);
+		status->pinned = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+	}
+#endif
+
+	// Unprivileged users may still be granted SCHED_FIFO up to RLIMIT_RTPRIO
+	// (the same grant rtkit makes over D-Bus), so clamp to it instead of failing outright.
+	struct sched_param param = { .sched_priority = REALTIME_FIFO_PRIORITY };
+	struct rlimit rl;
+	if (geteuid() != 0 && getrlimit(RLIMIT_RTPRIO, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur > 0 && rl.rlim_cur < (rlim_t) param.sched_priority)
+		param.sched_priority = (int) rl.rlim_cur;
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0) {
+		status->policy = SCHED_FIFO;
+		status->priority = param.sched_priority;
+		return;
+	}
+
+#ifdef __linux__
+	// nice is per-thread on Linux when given a thread id
+	pid_t tid = (pid_t) syscall(SYS_gettid);
+	if (setpriority(PRIO_PROCESS, tid, REALTIME_NICE) == 0) status->priority = REALTIME_NICE;
+#endif
+}
+
+void realtime_log_status(const Realtime *rt, RealtimeStatus *status) {
+	if (!rt->enabled) return;
+
+	size_t locked = atomic_load(&status->locked_bytes);
+	size_t unlocked = atomic_load(&status->unlocked_bytes);
+	if (unlocked == 0UL) nob_log(NOB_INFO, "Realtime: %zu KiB of playback buffers prefaulted and locked", locked >> 10);
+	else nob_log(NOB_WARNING, "Realtime: %zu KiB locked, %zu KiB only prefaulted (raise RLIMIT_MEMLOCK)", locked >> 10, unlocked >> 10);
+
+	if (status->policy == SCHED_FIFO) nob_log(NOB_INFO, "Realtime: decoder thread running SCHED_FIFO at priority %d", status->priority);
+	else if (status->priority != 0) nob_log(NOB_WARNING, "Realtime: SCHED_FIFO refused, decoder thread running at nice %d", status->priority);
+	else nob_log(NOB_WARNING, "Realtime: no scheduling privileges, decoder thread running at normal priority");
+
+	if (rt->cpu >= 0) {
+		if (status->pinned) nob_log(NOB_INFO, "Realtime: decoder thread pinned to CPU %d", rt->cpu);
+		else nob_log(NOB_WARNING, "Realtime: could not pin decoder thread to CPU %d", rt->cpu);
+	}
+}
+
+#undef REALTIME_FIFO_PRIORITY
+#undef REALTIME_NICE
+#undef REALTIME_STACK_PREFAULT
+#endif // REALTIME_IMPLEMENTATION
@@ -0,0 +1,79 @@
+#ifndef RTCHECK_H_
+#define RTCHECK_H_
+#include <nob.h>
+
+// Realtime-safety checker for `play_callback`, compiled in with -DMSTAMP_RTCHECK (`./nob -rtcheck`).
+// While the callback runs, the thread is flagged realtime and any allocation, logging,
+// file I/O or blocking call made from it aborts with a backtrace. Libc calls are caught
+// through `-Wl,--wrap=` (see nob.c), logging through the macro below.
+#ifdef MSTAMP_RTCHECK
+extern _Thread_local bool rtcheck_realtime;
+
+void rtcheck_violation(const char *what);
+
+#define rtcheck_enter() (rtcheck_realtime = true)
+#define rtcheck_leave() (rtcheck_realtime = false)
+#define rtcheck_assert(what) do { if (rtcheck_realtime) rtcheck_violation(what); } while (0)
+
+#define nob_log(level, ...) do { rtcheck_assert("nob_log"); nob_log(level, __VA_ARGS__); } while (0)
+#else
+#define rtcheck_enter() ((void) 0)
+#define rtcheck_leave() ((void) 0)
+#define rtcheck_assert(what) ((void) 0)
+#endif // MSTAMP_RTCHECK
+
+#endif // RTCHECK_H_
+
+#ifdef RTCHECK_IMPLEMENTATION
+#undef RTCHECK_IMPLEMENTATION
+#ifdef MSTAMP_RTCHECK
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+
+_Thread_local bool rtcheck_realtime = false;
+
+void rtcheck_violation(const char *what) {
+	// Reporting allocates (backtrace_symbols_fd, dladdr), which must not trip the check again.
+	rtcheck_realtime = false;
+
+	static const char prefix[] = "[RTCHECK] realtime violation in play_callback: ";
+	write(STDERR_FILENO, prefix, sizeof(prefix) - 1);
+	write(STDERR_FILENO, what, strlen(what));
+	write(STDERR_FILENO, "\n", 1);
+
+	void *frames[64];
+	int count = backtrace(frames, NOB_ARRAY_LEN(frames));
+	backtrace_symbols_fd(frames, count, STDERR_FILENO);
+	abort();
+}
+
+#define RTCHECK_WRAP(ret, name, params, ...) \
+	ret __real_##name params; \
+	ret __wrap_##name params { \
+		rtcheck_assert(#name); \
+		return __real_##name(__VA_ARGS__); \
+	}
+
+RTCHECK_WRAP(void *, malloc, (size_t size), size)
+RTCHECK_WRAP(void *, calloc, (size_t n, size_t size), n, size)
+RTCHECK_WRAP(void *, realloc, (void *p, size_t size), p, size)
+RTCHECK_WRAP(void, free, (void *p), p)
+RTCHECK_WRAP(int, posix_memalign, (void **p, size_t align, size_t size), p, align, size)
+RTCHECK_WRAP(FILE *, fopen, (const char *path, const char *mode), path, mode)
+RTCHECK_WRAP(size_t, fread, (void *p, size_t size, size_t n, FILE *f), p, size, n, f)
+RTCHECK_WRAP(size_t, fwrite, (const void *p, size_t size, size_t n, FILE *f), p, size, n, f)
+RTCHECK_WRAP(int, vfprintf, (FILE *f, const char *fmt, va_list args), f, fmt, args)
+RTCHECK_WRAP(ssize_t, read, (int fd, void *p, size_t n), fd, p, n)
+RTCHECK_WRAP(ssize_t, write, (int fd, const void *p, size_t n), fd, p, n)
+RTCHECK_WRAP(int, pthread_mutex_lock, (pthread_mutex_t *m), m)
+RTCHECK_WRAP(int, pthread_cond_wait, (pthread_cond_t *c, pthread_mutex_t *m), c, m)
+RTCHECK_WRAP(int, sem_wait, (sem_t *s), s)
+RTCHECK_WRAP(int, usleep, (useconds_t us), us)
+RTCHECK_WRAP(int, nanosleep, (const struct timespec *req, struct timespec *rem), req, rem)
+#undef RTCHECK_WRAP
+
+#endif // MSTAMP_RTCHECK
+#endif // RTCHECK_IMPLEMENTATION
@@ -0,0 +1,399 @@
+#ifndef SESSION_H_
+#define SESSION_H_
+#include "audio.h"
+
+// Many independent playback sessions, each on its own track and position of a few music files, for
+// servers that render or mix audio for lots of clients instead of playing one track on the device.
+// Sessions don't own decoders: every file is decoded in SESSION_CHUNK frame chunks into one LRU cache
+// shared by all of them, keyed by file and chunk, so sessions on the same stretch of a track decode it
+// once between them. A chunk missing from the cache is decoded by the session that wants it on one of
+// its file's decoders, while sessions wanting the same chunk wait for that instead of decoding it again.
+//
+// Threads: `session_read` may run concurrently for different sessions, one thread per session at a time;
+// `session_engine_mix` reads every session, so not alongside `session_read`. Add every file before
+// opening sessions.
+typedef struct SessionEngine SessionEngine;
+
+typedef struct {
+	uint64_t hits;				// chunk found decoded
+	uint64_t shared;			// chunk found while another session was decoding it, and waited for
+	uint64_t misses;			// chunk decoded
+	uint64_t evictions;
+	uint64_t decoded_frames;
+	uint64_t served_frames;
+} SessionStats;
+
+// `cache_chunks` of SESSION_CHUNK frames each (0: a default); `decoders` per file (0: one per core).
+SessionEngine *session_engine_create(size_t cache_chunks, size_t decoders);
+void session_engine_destroy(SessionEngine *engine);
+// `music` from `mstamp_load`/`audio_load_tracks`, outliving the engine; it is reopened with the decoder
+// config of the engine that loaded it. Returns its source index, -1 on failure.
+int session_engine_add(SessionEngine *engine, MusicCollection *music);
+// Returns a session id, -1 if out of sessions or arguments.
+int session_open(SessionEngine *engine, size_t source, size_t track, bool looping);
+void session_close(SessionEngine *engine, int session);
+bool session_seek(SessionEngine *engine, int session, double seconds);		// from the start of its track
+// Up to `frames` interleaved frames of the session, at its track's gain; fewer once a non-looping one ends.
+size_t session_read(SessionEngine *engine, int session, float *out, size_t frames);
+// Every open session summed into `out` (`frames` long, overwritten). Returns how many still had audio.
+size_t session_engine_mix(SessionEngine *engine, float *out, size_t frames);
+SessionStats session_engine_stats(SessionEngine *engine);
+
+#endif // SESSION_H_
+
+#ifdef SESSION_IMPLEMENTATION
+#undef SESSION_IMPLEMENTATION
+#include <pthread.h>
+#include <unistd.h>
+
+#define SESSION_CHUNK			8192		// frames per cache entry, 170ms at 48kHz
+#define SESSION_CACHE_DEFAULT	512			// chunks: 32MB of stereo f32, a minute and a half of audio
+#define SESSION_MAX				1024
+#define SESSION_MIX_FRAMES		4096
+
+enum { SESSION_CHUNK_FREE, SESSION_CHUNK_DECODING, SESSION_CHUNK_READY };
+
+typedef struct {
+	uint32_t source;
+	uint32_t frames;			// SESSION_CHUNK but at the end of the file
+	uint64_t index;				// chunk number in the file
+	uint32_t refs;				// sessions copying out of it; never evicted while set
+	uint8_t state;
+	int32_t chain;				// next in the hash bucket
+	int32_t newer, older;		// LRU
+	float *samples;
+} SessionChunk;
+
+typedef struct {
+	MusicCollection *music;
+	ma_decoder *decoders;		// all sharing `music`'s seek table
+	uint64_t *cursors;			// the frame each decoder reads next without seeking
+	bool *busy;
+	size_t count;
+	uint64_t length;
+} SessionSource;
+
+typedef struct {
+	bool open;
+	bool looping;
+	uint32_t source;
+	uint64_t start, stop;		// of the track, frames in the file
+	uint64_t position;
+	float gain;
+} Session;
+
+struct SessionEngine {
+	pthread_mutex_t mutex;		// the cache, the decoder pools, the stats and opening sessions
+	pthread_cond_t changed;		// a chunk got decoded or unpinned, or a decoder came back
+	SessionChunk *chunks;
+	size_t capacity;
+	float *samples;
+	int32_t *buckets;
+	size_t bucket_mask;
+	int32_t newest, oldest;
+	size_t decoders;
+	struct { SessionSource *items; size_t count, capacity; } sources;
+	Session sessions[SESSION_MAX];
+	float mix[SESSION_MIX_FRAMES * CHANNEL_COUNT];
+	SessionStats stats;
+};
+
+static inline size_t session_bucket(SessionEngine *e, uint32_t source, uint64_t index) {
+	uint64_t h = (index ^ ((uint64_t) source << 40)) * 0x9E3779B97F4A7C15ULL;
+	return (size_t) (h >> 32) & e->bucket_mask;
+}
+
+static void session_lru_unlink(SessionEngine *e, int32_t i) {
+	SessionChunk *c = &e->chunks[i];
+	if (c->newer >= 0) e->chunks[c->newer].older = c->older;
+	else e->newest = c->older;
+	if (c->older >= 0) e->chunks[c->older].newer = c->newer;
+	else e->oldest = c->newer;
+}
+
+static void session_lru_push(SessionEngine *e, int32_t i) {
+	SessionChunk *c = &e->chunks[i];
+	c->newer = -1;
+	c->older = e->newest;
+	if (e->newest >= 0) e->chunks[e->newest].newer = i;
+	e->newest = i;
+	if (e->oldest < 0) e->oldest = i;
+}
+
+static void session_hash_remove(SessionEngine *e, int32_t i) {
+	int32_t *link = &e->buckets[session_bucket(e, e->chunks[i].source, e->chunks[i].index)];
+	while (*link != i) link = &e->chunks[*link].chain;
+	*link = e->chunks[i].chain;
+}
+
+// Under the mutex: a free decoder of `s`, the one already at `frame` if any is. -1 if all are busy.
+static int session_take_decoder(SessionSource *s, uint64_t frame) {
+	int pick = -1;
+	for (size_t d = 0UL; d < s->count; d++) {
+		if (s->busy[d]) continue;
+		if (s->cursors[d] == frame) {
+			pick = (int) d;
+			break;
+		}
+		if (pick < 0) pick = (int) d;
+	}
+	if (pick >= 0) s->busy[pick] = true;
+	return pick;
+}
+
+// Pinned until `session_chunk_release`. NULL if its decoder failed to seek or read, in which case the
+// chunk is dropped from the cache again, for the next session wanting it to retry.
+static SessionChunk *session_chunk_acquire(SessionEngine *e, uint32_t source, uint64_t index) {
+	pthread_mutex_lock(&e->mutex);
+	int32_t i;
+	bool waited = false;
+	for (;;) {
+		for (i = e->buckets[session_bucket(e, source, index)]; i >= 0; i = e->chunks[i].chain)
+			if (e->chunks[i].source == source && e->chunks[i].index == index) break;
+		if (i >= 0) {
+			SessionChunk *c = &e->chunks[i];
+			if (c->state == SESSION_CHUNK_READY) {
+				c->refs++;
+				session_lru_unlink(e, i);
+				session_lru_push(e, i);
+				if (waited) e->stats.shared++;
+				else e->stats.hits++;
+				pthread_mutex_unlock(&e->mutex);
+				return c;
+			}
+			waited = true;		// another session is decoding it
+			pthread_cond_wait(&e->changed, &e->mutex);
+			continue;
+		}
+		// The least recently used chunk nobody is copying out of.
+		for (i = e->oldest; i >= 0 && (e->chunks[i].refs || e->chunks[i].state == SESSION_CHUNK_DECODING); i = e->chunks[i].newer);
+		if (i >= 0) break;
+		pthread_cond_wait(&e->changed, &e->mutex);		// every chunk pinned: more sessions than cache
+	}
+
+	SessionChunk *c = &e->chunks[i];
+	if (c->state == SESSION_CHUNK_READY) {
+		session_hash_remove(e, i);
+		e->stats.evictions++;
+	}
+	size_t bucket = session_bucket(e, source, index);
+	*c = (SessionChunk) { .source = source, .index = index, .refs = 1, .state = SESSION_CHUNK_DECODING, .chain = e->buckets[bucket], .newer = c->newer, .older = c->older, .samples = c->samples };
+	e->buckets[bucket] = i;
+	session_lru_unlink(e, i);
+	session_lru_push(e, i);
+	e->stats.misses++;
+
+	SessionSource *s = &e->sources.items[source];
+	uint64_t frame = index * SESSION_CHUNK;
+	int d;
+	while ((d = session_take_decoder(s, frame)) < 0) pthread_cond_wait(&e->changed, &e->mutex);
+	bool seek = s->cursors[d] != frame;
+	pthread_mutex_unlock(&e->mutex);
+
+	ma_uint64 read = 0;
+	ma_result result = seek ? ma_decoder_seek_to_pcm_frame(&s->decoders[d], frame) : MA_SUCCESS;
+	if (result == MA_SUCCESS) result = ma_decoder_read_pcm_frames(&s->decoders[d], c->samples, SESSION_CHUNK, &read);
+	bool failed = result != MA_SUCCESS && result != MA_AT_END;
+
+	pthread_mutex_lock(&e->mutex);
+	s->busy[d] = false;
+	if (failed) {
+		session_hash_remove(e, i);
+		c->state = SESSION_CHUNK_FREE;
+		c->refs = 0;
+		s->cursors[d] = UINT64_MAX;		// wherever the decoder was left, seek before trusting it
+		c = NULL;
+	} else {
+		c->frames = (uint32_t) read;
+		c->state = SESSION_CHUNK_READY;
+		s->cursors[d] = frame + read;
+		e->stats.decoded_frames += read;
+	}
+	pthread_cond_broadcast(&e->changed);
+	pthread_mutex_unlock(&e->mutex);
+	if (failed) nob_log(NOB_ERROR, "Could not decode frame %llu of `%s`: %s", (unsigned long long) frame, s->music->path, ma_result_description(result));
+	return c;
+}
+
+static void session_chunk_release(SessionEngine *e, SessionChunk *c, size_t served) {
+	pthread_mutex_lock(&e->mutex);
+	e->stats.served_frames += served;
+	if (--c->refs == 0) pthread_cond_broadcast(&e->changed);
+	pthread_mutex_unlock(&e->mutex);
+}
+
+SessionEngine *session_engine_create(size_t cache_chunks, size_t decoders) {
+	SessionEngine *e = calloc(1, sizeof(SessionEngine));
+	if (!e) return NULL;
+	e->capacity = cache_chunks ? cache_chunks : SESSION_CACHE_DEFAULT;
+	e->decoders = decoders ? decoders : (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+	size_t buckets = 1UL;
+	while (buckets < 2UL * e->capacity) buckets *= 2UL;
+	e->bucket_mask = buckets - 1UL;
+	e->chunks = calloc(e->capacity, sizeof(SessionChunk));
+	e->samples = malloc(e->capacity * SESSION_CHUNK * CHANNEL_COUNT * sizeof(float));
+	e->buckets = malloc(buckets * sizeof(int32_t));
+	if (!e->chunks || !e->samples || !e->buckets) {
+		session_engine_destroy(e);
+		return NULL;
+	}
+	pthread_mutex_init(&e->mutex, NULL);
+	pthread_cond_init(&e->changed, NULL);
+	memset(e->buckets, 0xFF, buckets * sizeof(int32_t));		// all -1
+	e->newest = e->oldest = -1;
+	for (size_t i = 0UL; i < e->capacity; i++) {
+		e->chunks[i].samples = e->samples + i * SESSION_CHUNK * CHANNEL_COUNT;
+		e->chunks[i].chain = -1;
+		session_lru_push(e, (int32_t) i);
+	}
+	return e;
+}
+
+void session_engine_destroy(SessionEngine *e) {
+	if (!e) return;
+	if (e->chunks) {
+		pthread_mutex_destroy(&e->mutex);
+		pthread_cond_destroy(&e->changed);
+	}
+	for (size_t i = 0UL; i < e->sources.count; i++) {
+		SessionSource *s = &e->sources.items[i];
+		for (size_t d = 0UL; d < s->count; d++) ma_decoder_uninit(&s->decoders[d]);
+		free(s->decoders);
+		free(s->cursors);
+		free(s->busy);
+	}
+	nob_da_free(&e->sources);
+	free(e->chunks);
+	free(e->samples);
+	free(e->buckets);
+	free(e);
+}
+
+int session_engine_add(SessionEngine *e, MusicCollection *music) {
+	SessionSource s = { .music = music };
+	s.decoders = calloc(e->decoders, sizeof(ma_decoder));
+	s.cursors = calloc(e->decoders, sizeof(uint64_t));
+	s.busy = calloc(e->decoders, sizeof(bool));
+	for (; s.decoders && s.cursors && s.busy && s.count < e->decoders; s.count++) {
+		ma_decoder *decoder = &s.decoders[s.count];
+		if (mstamp_decoder_open(music->engine, music->path, decoder) != MA_SUCCESS) break;
+		if (audio_decoder_share_seek_table(decoder, &music->decoder) != MA_SUCCESS) {
+			ma_decoder_uninit(decoder);
+			break;
+		}
+	}
+	ma_uint64 length = 0;		// of the whole file: `music->decoder` may be narrowed to the track it is playing
+	if (s.count) ma_decoder_get_length_in_pcm_frames(&s.decoders[0], &length);
+	s.length = length;
+	if (s.count == 0) {
+		nob_log(NOB_ERROR, "Could not open decoders for `%s`", music->path);
+		free(s.decoders);
+		free(s.cursors);
+		free(s.busy);
+		return -1;
+	}
+	nob_da_append(&e->sources, s);
+	return (int) e->sources.count - 1;
+}
+
+int session_open(SessionEngine *e, size_t source, size_t track, bool looping) {
+	if (source >= e->sources.count || track >= e->sources.items[source].music->tracks.count) return -1;
+	SessionSource *s = &e->sources.items[source];
+	const Track *t = track_get(s->music->tracks, track);
+	ma_uint32 sample_rate = s->decoders[0].outputSampleRate;
+	uint64_t start = track_start_frame(t, sample_rate), stop = track_stop_frame(t, sample_rate);
+	if (stop <= start || stop > s->length) stop = s->length;
+	if (start >= stop) return -1;
+
+	pthread_mutex_lock(&e->mutex);
+	int id = -1;
+	for (size_t i = 0UL; i < SESSION_MAX && id < 0; i++) if (!e->sessions[i].open) id = (int) i;
+	if (id >= 0) e->sessions[id] = (Session) {
+		.open = true,
+		.looping = looping,
+		.source = (uint32_t) source,
+		.start = start,
+		.stop = stop,
+		.position = start,
+		.gain = powf(10.0f, t->gain_db / 20.0f),
+	};
+	pthread_mutex_unlock(&e->mutex);
+	return id;
+}
+
+void session_close(SessionEngine *e, int session) {
+	if (session < 0 || session >= SESSION_MAX) return;
+	pthread_mutex_lock(&e->mutex);
+	e->sessions[session].open = false;
+	pthread_mutex_unlock(&e->mutex);
+}
+
+bool session_seek(SessionEngine *e, int session, double seconds) {
+	if (session < 0 || session >= SESSION_MAX || !e->sessions[session].open || seconds < 0.0) return false;
+	Session *s = &e->sessions[session];
+	uint64_t frame = s->start + (uint64_t) (seconds * e->sources.items[s->source].decoders[0].outputSampleRate);
+	s->position = frame < s->stop ? frame : s->stop;
+	return frame < s->stop;
+}
+
+size_t session_read(SessionEngine *e, int session, float *out, size_t frames) {
+	if (session < 0 || session >= SESSION_MAX || !e->sessions[session].open) return 0UL;
+	Session *s = &e->sessions[session];
+	size_t done = 0UL;
+	while (done < frames) {
+		if (s->position >= s->stop) {
+			if (!s->looping) break;
+			s->position = s->start;
+		}
+		uint64_t index = s->position / SESSION_CHUNK, offset = s->position % SESSION_CHUNK;
+		SessionChunk *c = session_chunk_acquire(e, s->source, index);
+		if (!c) break;		// a failed decode says nothing about where the track ends: try again next read
+		if (offset >= c->frames && c->frames < SESSION_CHUNK) {		// the file is shorter than its length said
+			session_chunk_release(e, c, 0UL);
+			s->stop = s->position;
+			if (s->stop <= s->start) break;		// nothing of the track is there to loop over
+			continue;
+		}
+		size_t count = frames - done;
+		if (count > c->frames - offset) count = c->frames - offset;
+		if (count > s->stop - s->position) count = (size_t) (s->stop - s->position);
+		memcpy(out + done * CHANNEL_COUNT, c->samples + offset * CHANNEL_COUNT, count * CHANNEL_COUNT * sizeof(float));
+		session_chunk_release(e, c, count);
+		done += count;
+		s->position += count;
+	}
+	if (s->gain != 1.0f) audio_apply_gain(out, done * CHANNEL_COUNT, s->gain);
+	return done;
+}
+
+size_t session_engine_mix(SessionEngine *e, float *out, size_t frames) {
+	memset(out, 0, frames * CHANNEL_COUNT * sizeof(float));
+	size_t playing = 0UL;
+	for (int i = 0; i < SESSION_MAX; i++) {
+		if (!e->sessions[i].open) continue;
+		size_t total = 0UL;
+		for (size_t at = 0UL; at < frames; ) {
+			size_t want = frames - at < SESSION_MIX_FRAMES ? frames - at : SESSION_MIX_FRAMES;
+			size_t got = session_read(e, i, e->mix, want);
+			for (size_t k = 0UL; k < got * CHANNEL_COUNT; k++) out[at * CHANNEL_COUNT + k] += e->mix[k];
+			at += got;
+			total += got;
+			if (got < want) break;
+		}
+		if (total) playing++;
+	}
+	return playing;
+}
+
+SessionStats session_engine_stats(SessionEngine *e) {
+	pthread_mutex_lock(&e->mutex);
+	SessionStats stats = e->stats;
+	pthread_mutex_unlock(&e->mutex);
+	return stats;
+}
+
+#undef SESSION_CHUNK
+#undef SESSION_CACHE_DEFAULT
+#undef SESSION_MAX
+#undef SESSION_MIX_FRAMES
+#endif // SESSION_IMPLEMENTATION
@@ -0,0 +1,203 @@
+#ifndef SHMOUT_H_
+#define SHMOUT_H_
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// The exact samples being played, in a POSIX shared memory ring (`/dev/shm/<name>`) that other processes
+// map read-only. The callback writes each buffer into it right after the device gets it and never looks
+// at a reader: a reader keeps its own position, and one that falls a ring behind is told so, not waited
+// for. This half of the header needs nothing else from the player, so readers can include it on its own.
+//
+// Reading, wait-free: take `written` (acquire), use the frames from your position up to it where they
+// lie (`shm_output_samples`), then `shm_output_intact` tells whether the callback lapped any of them
+// meanwhile. `shm_output_read` does that with a copy. Track fields are a seqlock: `shm_output_track`.
+#define SHM_OUTPUT_MAGIC	"MSTAMPSO"
+#define SHM_OUTPUT_VERSION	1
+#define SHM_OUTPUT_F32		1		// interleaved native-endian float
+#define SHM_OUTPUT_TITLE	256
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;			// bytes, the samples follow
+	uint32_t format;
+	uint32_t sample_rate;
+	uint32_t channels;
+	uint32_t capacity;				// frames, a power of two
+	_Atomic uint32_t open;			// 0 once the player has stopped writing for good
+	_Atomic uint32_t track_sequence;	// odd while the track fields change
+	uint32_t track_index;			// 0-based, in the .time file
+	float track_gain_db;
+	uint64_t track_frame;			// the ring position they hold from: the first frame after a select, seek or restart
+	char track_title[SHM_OUTPUT_TITLE];
+	_Alignas(64) _Atomic uint64_t claimed;	// frames the callback has started to write
+	_Atomic uint64_t written;		// frames it has finished writing, since the ring was made
+} ShmOutputHeader;
+
+typedef struct {
+	uint32_t index;
+	float gain_db;
+	uint64_t frame;
+	char title[SHM_OUTPUT_TITLE];
+} ShmOutputTrack;
+
+static inline const float *shm_output_samples(const ShmOutputHeader *h) {
+	return (const float *) ((const char *) h + h->header_size);
+}
+
+// Whether frames from `start` on were still intact after you used them.
+static inline bool shm_output_intact(const ShmOutputHeader *h, uint64_t start) {
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&((ShmOutputHeader *) h)->claimed, memory_order_relaxed) <= start + h->capacity;
+}
+
+// Up to `frames` after `*position`, which it advances; a reader that was lapped is moved up to what is
+// still there and `*skipped` says by how much. Returns the frames copied.
+static inline size_t shm_output_read(const ShmOutputHeader *h, uint64_t *position, float *out, size_t frames, uint64_t *skipped) {
+	ShmOutputHeader *shared = (ShmOutputHeader *) h;
+	const float *samples = shm_output_samples(h);
+	*skipped = 0;
+	uint64_t end = atomic_load_explicit(&shared->written, memory_order_acquire);
+	uint64_t oldest = end > h->capacity ? end - h->capacity : 0;
+	if (*position < oldest) *skipped = oldest - *position, *position = oldest;
+	uint64_t start = *position;
+	if (end - start > frames) end = start + frames;
+	for (uint64_t at = start; at < end; ) {
+		size_t offset = (size_t) (at & (h->capacity - 1U));
+		size_t count = end - at < h->capacity - offset ? (size_t) (end - at) : h->capacity - offset;
+		memcpy(out, samples + offset * h->channels, count * h->channels * sizeof(float));
+		out += count * h->channels, at += count;
+	}
+	if (!shm_output_intact(h, start)) {
+		uint64_t claimed = atomic_load_explicit(&shared->claimed, memory_order_relaxed);
+		*skipped += claimed - h->capacity - start;
+		*position = claimed - h->capacity;
+		return 0UL;
+	}
+	*position = end;
+	return (size_t) (end - start);
+}
+
+static inline void shm_output_track(const ShmOutputHeader *h, ShmOutputTrack *track) {
+	ShmOutputHeader *shared = (ShmOutputHeader *) h;
+	for (;;) {
+		uint32_t sequence = atomic_load_explicit(&shared->track_sequence, memory_order_acquire);
+		if (sequence & 1U) continue;
+		track->index = h->track_index;
+		track->gain_db = h->track_gain_db;
+		track->frame = h->track_frame;
+		memcpy(track->title, h->track_title, SHM_OUTPUT_TITLE);
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&shared->track_sequence, memory_order_relaxed) == sequence) break;
+	}
+	track->title[SHM_OUTPUT_TITLE - 1] = '\0';
+}
+
+// In the player: creates `/dev/shm/<name>` for about `seconds` of output, after `audio_init` and before
+// `audio_unpause`. Stop after `audio_deinit`, as the callback writes into it until then.
+bool shm_output_start(const char *name, double seconds);
+void shm_output_stop();
+
+#endif // SHMOUT_H_
+
+#ifdef SHMOUT_IMPLEMENTATION
+#undef SHMOUT_IMPLEMENTATION
+#include "audio.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static struct {
+	ShmOutputHeader *header;
+	float *samples;
+	size_t size;
+	char name[NAME_MAX];
+} shm_output = {0};
+
+// In the callback: one copy, two counter stores and, on a jump, the track fields.
+static void shm_output_sink(const float *frames, size_t count, const Track *track, size_t index, void *user) {
+	ShmOutputHeader *h = user;
+	uint64_t at = atomic_load_explicit(&h->written, memory_order_relaxed);
+	if (track) {
+		uint32_t sequence = atomic_load_explicit(&h->track_sequence, memory_order_relaxed);
+		atomic_store_explicit(&h->track_sequence, sequence + 1U, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+		h->track_index = (uint32_t) index;
+		h->track_gain_db = track->gain_db;
+		h->track_frame = at;
+		size_t length = strnlen(track->title, SHM_OUTPUT_TITLE - 1);
+		memcpy(h->track_title, track->title, length);
+		h->track_title[length] = '\0';
+		atomic_store_explicit(&h->track_sequence, sequence + 2U, memory_order_release);
+	}
+
+	if (count > h->capacity) frames += (count - h->capacity) * CHANNEL_COUNT, at += count - h->capacity, count = h->capacity;
+	atomic_store_explicit(&h->claimed, at + count, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	size_t offset = (size_t) (at & (h->capacity - 1U));
+	size_t first = count < h->capacity - offset ? count : h->capacity - offset;
+	memcpy(shm_output.samples + offset * CHANNEL_COUNT, frames, first * CHANNEL_COUNT * sizeof(float));
+	memcpy(shm_output.samples, frames + first * CHANNEL_COUNT, (count - first) * CHANNEL_COUNT * sizeof(float));
+	atomic_store_explicit(&h->written, at + count, memory_order_release);
+}
+
+bool shm_output_start(const char *name, double seconds) {
+	if (shm_output.header) return true;
+	bool result = true;
+	int fd = -1;
+	snprintf(shm_output.name, sizeof(shm_output.name), "/%s", name[0] == '/' ? name + 1 : name);
+
+	size_t capacity = 1UL, frames = (size_t) (seconds * audio_sample_rate());
+	while (capacity < frames) capacity *= 2UL;
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	size_t header_size = (sizeof(ShmOutputHeader) + page - 1UL) / page * page;
+	shm_output.size = header_size + capacity * CHANNEL_COUNT * sizeof(float);
+
+	shm_unlink(shm_output.name);		// left by a player that died; a reader still mapping it keeps its copy
+	fd = shm_open(shm_output.name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0 || ftruncate(fd, (off_t) shm_output.size) != 0) {
+		nob_log(NOB_ERROR, "Could not create shared memory %s: %s", shm_output.name, strerror(errno));
+		nob_return_defer(false);
+	}
+	void *map = mmap(NULL, shm_output.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		nob_log(NOB_ERROR, "Could not map shared memory %s: %s", shm_output.name, strerror(errno));
+		shm_unlink(shm_output.name);
+		nob_return_defer(false);
+	}
+	memset(map, 0, shm_output.size);		// every page backed now, not on the callback's first write to it
+
+	ShmOutputHeader *h = map;
+	memcpy(h->magic, SHM_OUTPUT_MAGIC, sizeof(h->magic));
+	h->version = SHM_OUTPUT_VERSION;
+	h->header_size = (uint32_t) header_size;
+	h->format = SHM_OUTPUT_F32;
+	h->sample_rate = audio_sample_rate();
+	h->channels = CHANNEL_COUNT;
+	h->capacity = (uint32_t) capacity;
+	atomic_store(&h->open, 1U);
+	shm_output.header = h;
+	shm_output.samples = (float *) ((char *) map + header_size);
+	audio_set_sink(shm_output_sink, h);
+	nob_log(NOB_INFO, "Sharing the output in /dev/shm%s (%zu frames)", shm_output.name, capacity);
+
+defer:
+	if (fd >= 0) close(fd);
+	return result;
+}
+
+void shm_output_stop() {
+	if (!shm_output.header) return;
+	audio_set_sink(NULL, NULL);
+	atomic_store(&shm_output.header->open, 0U);
+	munmap(shm_output.header, shm_output.size);
+	shm_unlink(shm_output.name);
+	shm_output.header = NULL;
+	shm_output.samples = NULL;
+}
+#endif // SHMOUT_IMPLEMENTATION
@@ -0,0 +1,135 @@
+#ifndef STATS_H_
+#define STATS_H_
+#include <nob.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+// HDR-style log-linear histogram of callback durations in nanoseconds:
+// exact below 32ns, then 16 linear sub-buckets per power of two (~6% precision) up to ~140s.
+#define STATS_SUB_BITS		4
+#define STATS_SUB_COUNT		(1<<STATS_SUB_BITS)
+#define STATS_LINEAR		(2*STATS_SUB_COUNT)
+#define STATS_MAX_LOG2		47
+#define STATS_BUCKETS		(STATS_LINEAR + (STATS_MAX_LOG2 - STATS_SUB_BITS) * STATS_SUB_COUNT)
+
+// Written only by the audio callback (and `short_reads` by the decoder thread), read by anyone.
+typedef struct {
+	atomic_uint_fast64_t buckets[STATS_BUCKETS];
+	atomic_uint_fast64_t callbacks;
+	atomic_uint_fast64_t underruns;		// the ring had fewer frames than the device asked for
+	atomic_uint_fast64_t xruns;			// callbacks started more than two periods apart
+	atomic_uint_fast64_t short_reads;	// the decoder returned fewer frames than requested
+	atomic_uint_fast64_t max_ns;
+	atomic_uint_fast64_t budget_ns;		// duration of the last period handed to the callback
+	uint64_t last_start_ns;				// callback-private; 0 after a device start, so that gap is no xrun
+} CallbackStats;
+
+typedef struct {
+	uint64_t callbacks;
+	uint64_t underruns;
+	uint64_t xruns;
+	uint64_t short_reads;
+	double p50_us;
+	double p99_us;
+	double p999_us;
+	double max_us;
+	double budget_us;
+	double headroom;		// fraction of the period left over at p99.9
+} CallbackStatsSnapshot;
+
+static inline uint64_t stats_now_ns();
+static inline void stats_record_callback(CallbackStats *stats, uint64_t start_ns, uint32_t frames, uint32_t frames_missing, uint32_t sample_rate);
+static inline void stats_record_short_read(CallbackStats *stats);
+
+CallbackStatsSnapshot stats_snapshot(CallbackStats *stats);
+void stats_log(const char *what, CallbackStats *stats);
+
+#endif // STATS_H_
+
+#ifdef STATS_IMPLEMENTATION
+#undef STATS_IMPLEMENTATION
+
+static inline uint64_t stats_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static inline size_t stats_bucket_from_ns(uint64_t ns) {
+	if (ns < STATS_LINEAR) return (size_t) ns;
+	unsigned log2 = 63U - (unsigned) __builtin_clzll(ns);
+	if (log2 >= STATS_MAX_LOG2) return STATS_BUCKETS - 1UL;
+	unsigned shift = log2 - STATS_SUB_BITS;
+	return STATS_LINEAR + (log2 - STATS_SUB_BITS - 1U) * STATS_SUB_COUNT + (size_t) ((ns >> shift) - STATS_SUB_COUNT);
+}
+
+// Upper edge of the bucket, so percentiles never under-report.
+static inline uint64_t stats_ns_from_bucket(size_t bucket) {
+	if (bucket < STATS_LINEAR) return bucket;
+	size_t j = bucket - STATS_LINEAR;
+	unsigned shift = (unsigned) (j / STATS_SUB_COUNT) + 1U;
+	uint64_t mantissa = STATS_SUB_COUNT + j % STATS_SUB_COUNT;
+	return ((mantissa + 1U) << shift) - 1U;
+}
+
+static inline void stats_bump(atomic_uint_fast64_t *counter) {
+	atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static inline void stats_record_callback(CallbackStats *stats, uint64_t start_ns, uint32_t frames, uint32_t frames_missing, uint32_t sample_rate) {
+	uint64_t end_ns = stats_now_ns();
+	uint64_t ns = end_ns - start_ns;
+	uint64_t budget_ns = (uint64_t) frames * 1000000000ULL / sample_rate;
+
+	stats_bump(&stats->buckets[stats_bucket_from_ns(ns)]);
+	stats_bump(&stats->callbacks);
+	if (frames_missing) stats_bump(&stats->underruns);
+	if (stats->last_start_ns && start_ns - stats->last_start_ns > 2 * budget_ns) stats_bump(&stats->xruns);
+	if (ns > atomic_load_explicit(&stats->max_ns, memory_order_relaxed)) atomic_store_explicit(&stats->max_ns, ns, memory_order_relaxed);
+	atomic_store_explicit(&stats->budget_ns, budget_ns, memory_order_relaxed);
+	stats->last_start_ns = start_ns;
+}
+
+static inline void stats_record_short_read(CallbackStats *stats) {
+	stats_bump(&stats->short_reads);
+}
+
+CallbackStatsSnapshot stats_snapshot(CallbackStats *stats) {
+	CallbackStatsSnapshot snap = {0};
+	uint64_t counts[STATS_BUCKETS];
+	uint64_t total = 0;
+
+	for (size_t i = 0UL; i < STATS_BUCKETS; i++) total += counts[i] = atomic_load_explicit(&stats->buckets[i], memory_order_relaxed);
+	snap.callbacks = atomic_load(&stats->callbacks);
+	snap.underruns = atomic_load(&stats->underruns);
+	snap.xruns = atomic_load(&stats->xruns);
+	snap.short_reads = atomic_load(&stats->short_reads);
+	snap.max_us = atomic_load(&stats->max_ns) / 1e3;
+	snap.budget_us = atomic_load(&stats->budget_ns) / 1e3;
+	if (total == 0) return snap;
+
+	const double quantiles[] = { 0.5, 0.99, 0.999 };
+	double *results[] = { &snap.p50_us, &snap.p99_us, &snap.p999_us };
+	uint64_t seen = 0;
+	size_t q = 0UL;
+	for (size_t i = 0UL; i < STATS_BUCKETS && q < NOB_ARRAY_LEN(quantiles); i++) {
+		seen += counts[i];
+		while (q < NOB_ARRAY_LEN(quantiles) && seen >= quantiles[q] * total) {
+			double us = stats_ns_from_bucket(i) / 1e3;
+			*results[q++] = us < snap.max_us ? us : snap.max_us;
+		}
+	}
+	if (snap.budget_us > 0.0) snap.headroom = 1.0 - snap.p999_us / snap.budget_us;
+	return snap;
+}
+
+void stats_log(const char *what, CallbackStats *stats) {
+	CallbackStatsSnapshot snap = stats_snapshot(stats);
+	nob_log(NOB_INFO, "%s: %llu callbacks, p50 %.1fus p99 %.1fus p99.9 %.1fus max %.1fus of %.1fus budget (%.1f%% headroom at p99.9)",
+		what, (unsigned long long) snap.callbacks, snap.p50_us, snap.p99_us, snap.p999_us, snap.max_us, snap.budget_us, snap.headroom * 100.0);
+	nob_log(snap.underruns || snap.xruns || snap.short_reads ? NOB_WARNING : NOB_INFO, "%s: %llu underruns, %llu xruns, %llu short reads",
+		what, (unsigned long long) snap.underruns, (unsigned long long) snap.xruns, (unsigned long long) snap.short_reads);
+}
+
+#endif // STATS_IMPLEMENTATION
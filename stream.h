@@ -0,0 +1,309 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+#include "audio.h"
+
+// Fans what is playing out to local listeners over a Unix stream socket: the track is decoded once, for
+// the device, and every listener gets a copy of the device's output (see `audio_tap_read_next`). Each
+// listener is first sent one line, `mstamp-pcm 1 f32le <rate> <channels>`, then interleaved PCM from the
+// moment it connected, for as long as something plays.
+//
+// All listeners read from one shared history; what a listener has not taken yet is its window into it,
+// so a listener costs a cursor and a socket, not a copy. One that falls further behind than its buffer
+// (default STREAM_BUFFER_MS, at most the history) gets its drop policy:
+//	skip	jump to the live position, losing what it missed (default)
+//	close	be disconnected
+// A listener may change both at any time by sending `buffer <ms>` or `policy <skip|close>` lines.
+// Runs on the control loop (see `control_watch`).
+bool stream_start(const char *socket_path);
+void stream_stop();
+
+#endif // STREAM_H_
+
+#ifdef STREAM_IMPLEMENTATION
+#undef STREAM_IMPLEMENTATION
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+#define STREAM_HISTORY		(1UL << 17)		// frames, a power of two: 2.7s at 48kHz
+#define STREAM_BUFFER_MS	500
+#define STREAM_TICK_NS		10000000L
+#define STREAM_TAP_FRAMES	8192			// what the tap holds between two ticks, with room to spare
+#define STREAM_LINE			64
+#define STREAM_FRAME		(CHANNEL_COUNT * sizeof(float))
+
+typedef enum {
+	STREAM_SKIP,
+	STREAM_CLOSE,
+} StreamPolicy;
+
+typedef struct {
+	int fd;
+	uint64_t sent;				// bytes of the stream, from the start of the history
+	uint64_t buffer;			// bytes it may fall behind
+	StreamPolicy policy;
+	bool blocked;				// waiting for EPOLLOUT
+	char header[STREAM_LINE];
+	size_t header_size, header_sent;
+	char line[STREAM_LINE];
+	size_t used;
+	uint64_t skipped;			// frames
+} StreamClient;
+
+static struct {
+	int listener;
+	int timer;
+	const char *path;
+	ma_uint32 sample_rate;
+	float *history;
+	uint64_t written;			// frames since the start
+	uint64_t tap;				// tap position of the next frame
+	uint64_t lost;				// frames the tap lapped us on
+	struct { StreamClient **items; size_t count, capacity; } clients;
+} stream = { .listener = -1, .timer = -1 };
+
+#ifdef __linux__
+static void stream_arm(bool on) {
+	struct itimerspec spec = {0};
+	if (on) spec.it_interval.tv_nsec = spec.it_value.tv_nsec = STREAM_TICK_NS;
+	timerfd_settime(stream.timer, 0, &spec, NULL);
+}
+
+static void stream_drop(StreamClient *client, const char *why) {
+	if (client->skipped || why) nob_log(NOB_INFO, "Listener %d left%s%s, %llu frames skipped", client->fd, why ? ": " : "", why ? why : "", (unsigned long long) client->skipped);
+	control_unwatch(client->fd);
+	close(client->fd);
+	for (size_t i = 0UL; i < stream.clients.count; i++) {
+		if (stream.clients.items[i] != client) continue;
+		stream.clients.items[i] = stream.clients.items[--stream.clients.count];
+		break;
+	}
+	free(client);
+	if (stream.clients.count == 0) stream_arm(false);
+}
+
+static bool stream_block(StreamClient *client) {
+	client->blocked = true;
+	if (control_rewatch(client->fd, EPOLLIN | EPOLLOUT)) return true;
+	stream_drop(client, "cannot wait for it");
+	return false;
+}
+
+// Applies the drop policy, then sends what the socket takes unless it's still full. False once the client is gone.
+static bool stream_send(StreamClient *client) {
+	uint64_t end = stream.written * STREAM_FRAME;
+	uint64_t behind = end - client->sent;
+	if (behind > client->buffer) {
+		if (client->policy == STREAM_CLOSE) return stream_drop(client, "too slow"), false;
+		uint64_t frames = behind / STREAM_FRAME;		// whole frames, so a half sent one still gets finished
+		client->sent += frames * STREAM_FRAME;
+		client->skipped += frames;
+	}
+	if (client->blocked) return true;
+
+	while (client->header_sent < client->header_size) {
+		ssize_t size = send(client->fd, client->header + client->header_sent, client->header_size - client->header_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (size < 0 && errno == EINTR) continue;
+		if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return stream_block(client);
+		if (size <= 0) return stream_drop(client, NULL), false;
+		client->header_sent += (size_t) size;
+	}
+	while (client->sent < end) {
+		const char *base = (const char *) stream.history;
+		size_t offset = (size_t) (client->sent % (STREAM_HISTORY * STREAM_FRAME));
+		size_t count = (size_t) (end - client->sent);
+		struct iovec parts[2] = { { (void *) (base + offset), count }, { (void *) base, 0 } };
+		if (offset + count > STREAM_HISTORY * STREAM_FRAME) {
+			parts[0].iov_len = STREAM_HISTORY * STREAM_FRAME - offset;
+			parts[1].iov_len = count - parts[0].iov_len;
+		}
+		struct msghdr message = { .msg_iov = parts, .msg_iovlen = parts[1].iov_len ? 2 : 1 };
+		ssize_t size = sendmsg(client->fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (size < 0 && errno == EINTR) continue;
+		if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return stream_block(client);
+		if (size <= 0) return stream_drop(client, NULL), false;
+		client->sent += (uint64_t) size;
+	}
+	return true;
+}
+
+// How far behind a listener may fall for `ms` of buffer, within what the history can hold.
+static uint64_t stream_buffer_bytes(uint64_t ms) {
+	uint64_t frames = ms * stream.sample_rate / 1000U;
+	if (frames < STREAM_TAP_FRAMES) frames = STREAM_TAP_FRAMES;		// a tick's worth is always behind
+	if (frames > STREAM_HISTORY - STREAM_TAP_FRAMES) frames = STREAM_HISTORY - STREAM_TAP_FRAMES;		// what a tick can't overwrite
+	return frames * STREAM_FRAME;
+}
+
+// Settings lines; anything else is ignored, the stream has no replies.
+static void stream_setting(StreamClient *client, Nob_StringView line) {
+	line = nob_sv_trim(line);
+	Nob_StringView key = nob_sv_chop_by_delim(&line, ' ');
+	Nob_StringView value = nob_sv_trim(line);
+	if (nob_sv_eq(key, nob_sv_from_cstr("policy"))) {
+		if (nob_sv_eq(value, nob_sv_from_cstr("skip"))) client->policy = STREAM_SKIP;
+		else if (nob_sv_eq(value, nob_sv_from_cstr("close"))) client->policy = STREAM_CLOSE;
+	}
+	else if (nob_sv_eq(key, nob_sv_from_cstr("buffer"))) {
+		uint64_t ms = 0;
+		for (size_t i = 0UL; i < value.count && isdigit((unsigned char) value.items[i]); i++) ms = ms * 10U + (uint64_t) (value.items[i] - '0');
+		client->buffer = stream_buffer_bytes(ms);
+	}
+}
+
+static void stream_on_client(int fd, uint32_t events, void *user) {
+	StreamClient *client = user;
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		for (;;) {
+			ssize_t size = recv(fd, client->line + client->used, STREAM_LINE - client->used, MSG_DONTWAIT);
+			if (size < 0 && errno == EINTR) continue;
+			if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+			if (size <= 0) return stream_drop(client, NULL);
+			client->used += (size_t) size;
+			size_t done = 0UL;
+			for (char *newline; (newline = memchr(client->line + done, '\n', client->used - done)); ) {
+				size_t length = (size_t) (newline - client->line) - done;
+				stream_setting(client, nob_sv_from_parts(client->line + done, length));
+				done += length + 1UL;
+			}
+			if (done == 0 && client->used == STREAM_LINE) done = client->used;		// no line is that long
+			memmove(client->line, client->line + done, client->used - done);
+			client->used -= done;
+		}
+	}
+	if ((events & EPOLLOUT) && client->blocked) {
+		client->blocked = false;
+		if (stream_send(client) && !client->blocked) control_rewatch(fd, EPOLLIN);
+	}
+}
+
+// Everything new from the tap into the history, then out to every listener whose socket has room.
+static void stream_on_tick(int fd, uint32_t events, void *user) {
+	(void) events, (void) user;
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) < 0) return;
+	for (;;) {
+		size_t offset = (size_t) (stream.written & (STREAM_HISTORY - 1UL));
+		uint64_t skipped = 0;
+		size_t count = audio_tap_read_next(&stream.tap, stream.history + offset * CHANNEL_COUNT, STREAM_HISTORY - offset, &skipped);
+		stream.lost += skipped;
+		stream.written += count;
+		if (count == 0 && skipped == 0) break;
+	}
+	for (size_t i = stream.clients.count; i-- > 0; ) stream_send(stream.clients.items[i]);		// backwards: a dropped client swaps the last one in
+}
+
+static void stream_on_listener(int fd, uint32_t events, void *user) {
+	(void) events, (void) user;
+	for (;;) {
+		int peer = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (peer < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) nob_log(NOB_WARNING, "Could not accept a listener: %s", strerror(errno));
+			if (errno != EINTR) return;
+			continue;
+		}
+		StreamClient *client = calloc(1, sizeof(StreamClient));
+		if (!client || !control_watch(peer, EPOLLIN, stream_on_client, client)) {
+			nob_log(NOB_WARNING, "Could not serve listener fd %d", peer);
+			free(client);
+			close(peer);
+			continue;
+		}
+		client->fd = peer;
+		client->sent = stream.written * STREAM_FRAME;		// live, not the history
+		client->buffer = stream_buffer_bytes(STREAM_BUFFER_MS);
+		client->header_size = (size_t) snprintf(client->header, sizeof(client->header), "mstamp-pcm 1 f32le %u %u\n", stream.sample_rate, CHANNEL_COUNT);
+		if (stream.clients.count == 0) {		// nothing was read while nobody listened
+			stream.tap = audio_tap_position();
+			stream_arm(true);
+		}
+		nob_da_append(&stream.clients, client);
+	}
+}
+
+bool stream_start(const char *socket_path) {
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		nob_log(NOB_ERROR, "Socket path too long: %s", socket_path);
+		return false;
+	}
+	strcpy(address.sun_path, socket_path);
+	stream.sample_rate = audio_tap_enable(STREAM_TAP_FRAMES);
+	if (stream.sample_rate == 0) {
+		nob_log(NOB_ERROR, "Could not tap the audio output for streaming");
+		return false;
+	}
+	stream.tap = audio_tap_position();
+
+	// Same as the daemon's: a socket file nobody answers on is stale, one that answers is in use.
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd >= 0 && (connect(fd, (struct sockaddr *) &address, sizeof(address)) == 0 || errno == EAGAIN)) {
+		nob_log(NOB_ERROR, "Another player is streaming on %s", socket_path);
+		close(fd);
+		return false;
+	}
+	if (fd >= 0) close(fd);
+	unlink(socket_path);
+
+	stream.history = malloc(STREAM_HISTORY * STREAM_FRAME);
+	stream.timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (!stream.history || stream.timer < 0 || fd < 0 || bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0
+	|| chmod(socket_path, 0600) != 0 || listen(fd, SOMAXCONN) != 0) {
+		nob_log(NOB_ERROR, "Could not stream on %s: %s", socket_path, strerror(errno));
+		if (fd >= 0) close(fd);
+		stream_stop();
+		return false;
+	}
+	stream.listener = fd;
+	stream.path = socket_path;
+	if (!control_watch(stream.timer, EPOLLIN, stream_on_tick, NULL) || !control_watch(fd, EPOLLIN, stream_on_listener, NULL)) {
+		nob_log(NOB_ERROR, "Could not watch %s", socket_path);
+		stream_stop();
+		return false;
+	}
+	nob_log(NOB_INFO, "Streaming on %s", socket_path);
+	return true;
+}
+
+void stream_stop() {
+	while (stream.clients.count) stream_drop(stream.clients.items[0], NULL);
+	nob_da_free(&stream.clients);
+	stream.clients.capacity = 0UL;
+	if (stream.lost) nob_log(NOB_WARNING, "Streaming fell behind the tap by %llu frames", (unsigned long long) stream.lost);
+	if (stream.listener >= 0) {
+		control_unwatch(stream.listener);
+		close(stream.listener);
+		unlink(stream.path);
+	}
+	if (stream.timer >= 0) {
+		control_unwatch(stream.timer);
+		close(stream.timer);
+	}
+	free(stream.history);
+	stream.history = NULL;
+	stream.listener = stream.timer = -1;
+	stream.written = stream.lost = 0;
+}
+#else
+bool stream_start(const char *socket_path) {
+	nob_log(NOB_ERROR, "Cannot stream on %s: streaming needs epoll", socket_path);
+	return false;
+}
+
+void stream_stop() {}
+#endif
+
+#undef STREAM_HISTORY
+#undef STREAM_BUFFER_MS
+#undef STREAM_TICK_NS
+#undef STREAM_TAP_FRAMES
+#undef STREAM_LINE
+#undef STREAM_FRAME
+#endif // STREAM_IMPLEMENTATION
@@ -0,0 +1,133 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+#include <nob.h>
+#include <stdint.h>
+
+// Startup timeline, written as Chrome `trace_event` JSON (chrome://tracing, ui.perfetto.dev)
+// to the path in MSTAMP_TRACE. Without it every call below is a single branch.
+// Events go into a fixed buffer, so recording is allocation-free and safe from the audio callback.
+typedef struct {
+	const char *name;		// must outlive `trace_flush`, string literals in practice
+	uint64_t start_ns;
+} TraceSpan;
+
+void trace_init();
+bool trace_flush();
+
+TraceSpan trace_begin(const char *name);
+void trace_end(TraceSpan *span);
+void trace_instant(const char *name);
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Span lasting until the end of the enclosing block.
+#define TRACE_SCOPE(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__) __attribute__((cleanup(trace_end))) = trace_begin(name)
+
+#endif // TRACE_H_
+
+#ifdef TRACE_IMPLEMENTATION
+#undef TRACE_IMPLEMENTATION
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define TRACE_ENV			"MSTAMP_TRACE"
+#define TRACE_MAX_EVENTS	(1<<12)
+
+typedef struct {
+	const char *name;
+	uint64_t start_ns;
+	uint64_t duration_ns;
+	uint32_t tid;
+	char phase;
+} TraceEvent;
+
+static const char *trace_path = NULL;
+static TraceEvent trace_events[TRACE_MAX_EVENTS];
+static atomic_size_t trace_count = 0;
+
+static inline uint64_t trace_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static inline uint32_t trace_tid() {
+#ifdef __linux__
+	static _Thread_local uint32_t tid = 0;
+	if (!tid) tid = (uint32_t) syscall(SYS_gettid);
+	return tid;
+#else
+	return (uint32_t) (uintptr_t) pthread_self();
+#endif
+}
+
+static void trace_record(const char *name, char phase, uint64_t start_ns, uint64_t duration_ns) {
+	size_t i = atomic_fetch_add_explicit(&trace_count, 1, memory_order_relaxed);
+	if (i >= TRACE_MAX_EVENTS) return;
+	trace_events[i] = (TraceEvent) {
+		.name = name,
+		.start_ns = start_ns,
+		.duration_ns = duration_ns,
+		.tid = trace_tid(),
+		.phase = phase,
+	};
+}
+
+void trace_init() {
+	trace_path = getenv(TRACE_ENV);
+	if (trace_path && *trace_path == '\0') trace_path = NULL;
+}
+
+TraceSpan trace_begin(const char *name) {
+	return (TraceSpan) { .name = name, .start_ns = trace_path ? trace_now_ns() : 0 };
+}
+
+void trace_end(TraceSpan *span) {
+	if (!trace_path) return;
+	trace_record(span->name, 'X', span->start_ns, trace_now_ns() - span->start_ns);
+}
+
+void trace_instant(const char *name) {
+	if (!trace_path) return;
+	trace_record(name, 'i', trace_now_ns(), 0);
+}
+
+bool trace_flush() {
+	if (!trace_path) return true;
+
+	FILE *f = fopen(trace_path, "w");
+	if (!f) {
+		nob_log(NOB_ERROR, "Could not open trace file `%s`: %s", trace_path, strerror(errno));
+		return false;
+	}
+
+	size_t count = atomic_load(&trace_count);
+	if (count > TRACE_MAX_EVENTS) count = TRACE_MAX_EVENTS;
+	uint64_t origin_ns = count ? trace_events[0].start_ns : 0;
+	for (size_t i = 1UL; i < count; i++) if (trace_events[i].start_ns < origin_ns) origin_ns = trace_events[i].start_ns;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (size_t i = 0UL; i < count; i++) {
+		TraceEvent *e = &trace_events[i];
+		fprintf(f, "{\"name\":\"%s\",\"cat\":\"mstamp\",\"ph\":\"%c\",\"ts\":%.3f,", e->name, e->phase, (e->start_ns - origin_ns) / 1e3);
+		if (e->phase == 'X') fprintf(f, "\"dur\":%.3f,", e->duration_ns / 1e3);
+		else fprintf(f, "\"s\":\"g\",");
+		fprintf(f, "\"pid\":%d,\"tid\":%u}%s\n", (int) getpid(), e->tid, i + 1UL < count ? "," : "");
+	}
+	fprintf(f, "]}\n");
+
+	bool ok = !ferror(f);
+	fclose(f);
+	if (ok) nob_log(NOB_INFO, "Wrote %zu trace events to `%s`", count, trace_path);
+	else nob_log(NOB_ERROR, "Could not write trace file `%s`", trace_path);
+	return ok;
+}
+
+#undef TRACE_ENV
+#undef TRACE_MAX_EVENTS
+#endif // TRACE_IMPLEMENTATION
@@ -3,11 +3,15 @@
 #include <nob.h>
 #include <arena.h>
 #include <stdint.h>
+#include <sys/stat.h>
 
 typedef struct {
 	const char *title;
 	uint32_t start;
 	uint32_t stop;
+	uint64_t start_us;		// exact boundaries: the whole seconds above unless refined against the audio
+	uint64_t stop_us;
+	float gain_db;			// playback gain from loudness normalization, 0 for unity
 } Track;
 
 typedef struct {
@@ -20,9 +24,15 @@ static inline Track *track_get(Tracks tracks, size_t i);
 static inline Track *track_get_inbound(Tracks tracks, size_t i);
 static inline Track *track_get_first(Tracks tracks);
 static inline Track *track_get_last(Tracks tracks);
+static inline uint64_t track_start_frame(const Track *track, uint32_t sample_rate);
+static inline uint64_t track_stop_frame(const Track *track, uint32_t sample_rate);
+// For cache keys next to the music and `.time` files: whole seconds miss an edit within the same one.
+static inline long long file_mtime_ns(const struct stat *st);
 
 static inline void moddiv(unsigned a, unsigned b, unsigned *mod, unsigned *div);
+#define TIME_FORMAT_MAX 16		// fits UINT32_MAX seconds, "1193046:28:15", and the terminator
 const char *time_from_seconds(Arena *a, uint32_t seconds);
+static inline size_t time_format(char *buffer, size_t size, uint32_t seconds);
 static uint32_t seconds_from_time(Nob_StringView time);
 
 bool tracks_read_from_file(Arena *a, const char *timestamp_file, Tracks *tracks);
@@ -39,15 +49,24 @@ static inline void moddiv(unsigned a, unsigned b, unsigned *mod, unsigned *div)
 }
 
 #define SEC60 60
-const char *time_from_seconds(Arena *a, uint32_t seconds) {
+// Into the caller's buffer, no allocation: for anything redrawn on every tick. Returns the length.
+static inline size_t time_format(char *buffer, size_t size, uint32_t seconds) {
 	uint32_t value[3] = {0};
 
 	moddiv(seconds, SEC60, &value[0], &value[1]);
+	int length;
 	if (value[1] >= SEC60) {
 		moddiv(value[1], SEC60, &value[1], &value[2]);
-		return arena_sprintf(a, "%u:%02u:%02u", value[2], value[1], value[0]);
+		length = snprintf(buffer, size, "%u:%02u:%02u", value[2], value[1], value[0]);
 	}
-	return arena_sprintf(a, "%01u:%02u", value[1], value[0]);
+	else length = snprintf(buffer, size, "%01u:%02u", value[1], value[0]);
+	return length < 0 ? 0UL : (size_t) length < size ? (size_t) length : size - 1UL;
+}
+
+const char *time_from_seconds(Arena *a, uint32_t seconds) {
+	char buffer[TIME_FORMAT_MAX];
+	time_format(buffer, sizeof(buffer), seconds);
+	return arena_strdup(a, buffer);
 }
 
 static uint32_t seconds_from_time(Nob_StringView time) {
@@ -55,9 +74,10 @@ static uint32_t seconds_from_time(Nob_StringView time) {
 	uint8_t i = 0;
 
 	for (; i < 3 && time.count; i++) {
-		Nob_StringView sv_value = nob_sv_chop_by_delim(&time, ':');
-		const char *cstr_value = nob_temp_sv_to_cstr(sv_value);
-		value[i] = atoi(cstr_value);
+		// parsed in place: a temp cstr per field overflows the temp allocator on long `.time` files
+		Nob_StringView sv_value = nob_sv_trim_left(nob_sv_chop_by_delim(&time, ':'));
+		for (size_t j = 0UL; j < sv_value.count && isdigit((unsigned char) sv_value.items[j]); j++)
+			value[i] = value[i] * 10U + (uint32_t) (sv_value.items[j] - '0');
 	}
 
 	uint32_t res = 0;
@@ -88,6 +108,22 @@ static inline Track *track_get_last(Tracks tracks) {
 	return tracks.count != 0UL ? &tracks.items[tracks.count - 1UL] : NULL;
 }
 
+static inline uint64_t track_start_frame(const Track *track, uint32_t sample_rate) {
+	return (track->start_us * sample_rate + 500000U) / 1000000U;
+}
+
+static inline uint64_t track_stop_frame(const Track *track, uint32_t sample_rate) {
+	return (track->stop_us * sample_rate + 500000U) / 1000000U;
+}
+
+static inline long long file_mtime_ns(const struct stat *st) {
+#ifdef __APPLE__
+	return (long long) st->st_mtimespec.tv_sec * 1000000000LL + st->st_mtimespec.tv_nsec;
+#else
+	return (long long) st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+#endif
+}
+
 
 
 char *arena_sv_to_cstr(Arena *a, Nob_StringView sv) {
@@ -107,9 +143,11 @@ bool tracks_read_from_file(Arena *a, const char *timestamp_file, Tracks *tracks)
 
 	while ((line = nob_sv_chop_by_delim(&sv, '\n'), line.count)) {
 		time = nob_sv_chop_by_delim(&line, '\t');
+		uint32_t start = seconds_from_time(time);
 		nob_da_append(tracks, ((Track) {
 			.title = arena_sv_to_cstr(a, line),
-			.start = seconds_from_time(time),
+			.start = start,
+			.start_us = start * 1000000ULL,
 		}));
 	}
 
@@ -117,17 +155,18 @@ bool tracks_read_from_file(Arena *a, const char *timestamp_file, Tracks *tracks)
 		Track *prev = &tracks->items[i - 1UL];
 		Track *next = &tracks->items[i];
 		prev->stop = next->start;
+		prev->stop_us = next->start_us;
 	}
 
-	nob_temp_reset();
 	nob_sb_free(&sb);
 	return true;
 }
 
 static inline bool tracks_set_end_time(Tracks tracks, uint32_t seconds) {
 	Track *t = track_get_last(tracks);
-	if (t) return (t->stop = seconds);
-	return false;
+	if (!t) return false;
+	t->stop_us = seconds * 1000000ULL;
+	return (t->stop = seconds);
 }
 
 #endif // TRACKS_IMPLEMENTATION
\ No newline at end of file
@@ -0,0 +1,186 @@
+#ifndef TUI_H_
+#define TUI_H_
+#include "audio.h"
+
+// Playback screen: now playing, position, and the track list around the current track. Each frame is
+// composed into a back buffer of cells and only the cells that differ from the front buffer (what the
+// terminal shows) are sent, so a tick that only moves the clock costs a few bytes. Buffers are sized
+// once in `tui_start`; drawing allocates nothing, times go through `time_format`.
+// Logs share the terminal, so run with stderr redirected, or redraw with ^L after one.
+bool tui_start(int fd, int top);		// draws from row `top` (0-based) down
+void tui_draw(MusicCollection *music, bool full);		// full: re-read the size and repaint everything
+void tui_stop();
+
+#endif // TUI_H_
+
+#ifdef TUI_IMPLEMENTATION
+#undef TUI_IMPLEMENTATION
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define TUI_MAX_ROWS	128
+#define TUI_MAX_COLS	320
+#define TUI_LIST_TOP	3		// rows above the track list: now playing, position, blank
+
+enum { TUI_PLAIN, TUI_REVERSE, TUI_DIM };
+
+typedef struct {
+	uint32_t glyph;			// one UTF-8 sequence, up to 4 bytes, low byte first; 0 is never drawn yet
+	uint8_t style;
+} TuiCell;
+
+static struct {
+	int fd;
+	int top;
+	size_t rows, cols;
+	TuiCell *front, *back;
+	char *out;
+	size_t out_size;
+	bool active;
+} tui = { .fd = -1 };
+
+static void tui_size() {
+	struct winsize ws = {0};
+	bool ok = ioctl(tui.fd, TIOCGWINSZ, &ws) == 0 && ws.ws_row && ws.ws_col;
+	size_t rows = ok ? ws.ws_row : 24, cols = ok ? ws.ws_col : 80;
+	rows = rows > (size_t) tui.top ? rows - (size_t) tui.top : 1UL;
+	tui.rows = rows < TUI_MAX_ROWS ? rows : TUI_MAX_ROWS;
+	tui.cols = cols < TUI_MAX_COLS ? cols : TUI_MAX_COLS;
+}
+
+// Puts UTF-8 `text` at (row, col) in the back buffer, one cell per code point, clipped at `last` columns.
+static size_t tui_put(size_t row, size_t col, size_t last, const char *text, uint8_t style) {
+	if (row >= tui.rows) return col;
+	if (last > tui.cols) last = tui.cols;
+	const unsigned char *at = (const unsigned char *) text;
+	while (*at && col < last) {
+		size_t length = *at < 0x80 ? 1 : *at < 0xE0 ? 2 : *at < 0xF0 ? 3 : 4;
+		uint32_t glyph = 0;
+		for (size_t i = 0UL; i < length && at[i]; i++) glyph |= (uint32_t) at[i] << (8 * i);
+		for (size_t i = 0UL; i < length && *at; i++) at++;
+		if (glyph < 0x20) glyph = ' ';		// control characters would move the cursor under us
+		tui.back[row * TUI_MAX_COLS + col++] = (TuiCell) { glyph, style };
+	}
+	return col;
+}
+
+static void tui_fill(size_t row, size_t from, size_t to, uint32_t glyph, uint8_t style) {
+	if (row >= tui.rows) return;
+	for (size_t col = from; col < to && col < tui.cols; col++) tui.back[row * TUI_MAX_COLS + col] = (TuiCell) { glyph, style };
+}
+
+static void tui_compose(MusicCollection *music) {
+	for (size_t row = 0UL; row < tui.rows; row++) tui_fill(row, 0, tui.cols, ' ', TUI_PLAIN);
+	size_t count = music->tracks.count, index = audio_current_index();
+	const Track *track = track_get(music->tracks, index);
+	char line[64], position[TIME_FORMAT_MAX], length[TIME_FORMAT_MAX];
+
+	snprintf(line, sizeof(line), "%s %zu/%zu  ", audio_is_paused() ? "||" : "|>", index + 1UL, count);
+	size_t col = tui_put(0, 0, tui.cols, line, TUI_PLAIN);
+	tui_put(0, col, tui.cols, track->title, TUI_PLAIN);
+
+	double seconds = 0.0, total = 0.0;
+	audio_position(&seconds, &total);
+	time_format(position, sizeof(position), (uint32_t) seconds);
+	time_format(length, sizeof(length), (uint32_t) total);
+	snprintf(line, sizeof(line), " %s / %s%s", position, length, audio_is_looping() ? "  loop" : "");
+	size_t tail = strlen(line), bar = tui.cols > tail + 2UL ? tui.cols - tail - 2UL : 0UL;
+	size_t filled = total > 0.0 ? (size_t) (bar * (seconds / total)) : 0UL;
+	if (filled > bar) filled = bar;
+	tui_put(1, 0, tui.cols, "[", TUI_PLAIN);
+	tui_fill(1, 1, 1 + filled, '#', TUI_PLAIN);
+	tui_fill(1, 1 + filled, 1 + bar, '-', TUI_DIM);
+	tui_put(1, 1 + bar, tui.cols, "]", TUI_PLAIN);
+	tui_put(1, 2 + bar, tui.cols, line, TUI_PLAIN);
+
+	// As many tracks as fit, the current one kept in the middle.
+	size_t visible = tui.rows > TUI_LIST_TOP ? tui.rows - TUI_LIST_TOP : 0UL;
+	size_t first = index > visible / 2 ? index - visible / 2 : 0UL;
+	if (count > visible && first > count - visible) first = count - visible;
+	for (size_t i = first, row = TUI_LIST_TOP; i < count && row < tui.rows; i++, row++) {
+		const Track *t = track_get(music->tracks, i);
+		uint8_t style = i == index ? TUI_REVERSE : TUI_PLAIN;
+		time_format(position, sizeof(position), t->start);
+		snprintf(line, sizeof(line), " %3zu %8s  ", i + 1UL, position);
+		col = tui_put(row, 0, tui.cols, line, style);
+		col = tui_put(row, col, tui.cols, t->title, style);
+		if (style != TUI_PLAIN) tui_fill(row, col, tui.cols, ' ', style);
+	}
+}
+
+// Cursor moves and style changes only where a run of changed cells starts.
+static size_t tui_flush() {
+	static const char *styles[] = { "\x1b[0m", "\x1b[0;7m", "\x1b[0;2m" };
+	char *at = tui.out;
+	uint8_t style = 0xFF;
+	for (size_t row = 0UL; row < tui.rows; row++) {
+		bool placed = false;
+		for (size_t col = 0UL; col < tui.cols; col++) {
+			TuiCell *back = &tui.back[row * TUI_MAX_COLS + col], *front = &tui.front[row * TUI_MAX_COLS + col];
+			if (back->glyph == front->glyph && back->style == front->style) {
+				placed = false;
+				continue;
+			}
+			if (!placed) at += sprintf(at, "\x1b[%zu;%zuH", (size_t) tui.top + row + 1UL, col + 1UL);
+			if (back->style != style) at += sprintf(at, "%s", styles[style = back->style]);
+			for (uint32_t g = back->glyph; g; g >>= 8) *at++ = (char) (g & 0xFF);
+			*front = *back;
+			placed = true;
+		}
+	}
+	if (style != 0xFF) at += sprintf(at, "%s", styles[TUI_PLAIN]);
+	size_t size = (size_t) (at - tui.out);
+	if (size && write(tui.fd, tui.out, size) < 0) nob_log(NOB_WARNING, "Could not draw: %s", strerror(errno));
+	return size;
+}
+
+bool tui_start(int fd, int top) {
+	if (tui.active) return true;
+	tui.fd = fd;
+	tui.top = top;
+	tui.front = calloc(TUI_MAX_ROWS * TUI_MAX_COLS, sizeof(TuiCell));
+	tui.back = calloc(TUI_MAX_ROWS * TUI_MAX_COLS, sizeof(TuiCell));
+	tui.out_size = TUI_MAX_ROWS * (TUI_MAX_COLS * 16 + 16) + 64;		// every cell moved to, restyled and 4 bytes long
+	tui.out = malloc(tui.out_size);
+	if (!tui.front || !tui.back || !tui.out) {
+		tui_stop();
+		return false;
+	}
+	static const char hide[] = "\x1b[?25l";
+	if (write(fd, hide, sizeof(hide) - 1) < 0) nob_log(NOB_WARNING, "Could not hide the cursor: %s", strerror(errno));
+	tui.active = true;
+	return true;
+}
+
+void tui_draw(MusicCollection *music, bool full) {
+	if (!tui.active) return;
+	if (full || tui.rows == 0) {
+		tui_size();
+		memset(tui.front, 0, TUI_MAX_ROWS * TUI_MAX_COLS * sizeof(TuiCell));		// matches nothing, all repainted
+		char clear[32];
+		int size = snprintf(clear, sizeof(clear), "\x1b[%d;1H\x1b[J", tui.top + 1);		// from the top row down
+		if (write(tui.fd, clear, (size_t) size) < 0) return;
+	}
+	tui_compose(music);
+	tui_flush();
+}
+
+void tui_stop() {
+	if (tui.active) {
+		char restore[32];
+		int size = snprintf(restore, sizeof(restore), "\x1b[0m\x1b[%zu;1H\x1b[?25h\n", (size_t) tui.top + tui.rows);
+		if (write(tui.fd, restore, (size_t) size) < 0) nob_log(NOB_WARNING, "Could not restore the cursor: %s", strerror(errno));
+	}
+	free(tui.front);
+	free(tui.back);
+	free(tui.out);
+	tui.front = tui.back = NULL;
+	tui.out = NULL;
+	tui.rows = tui.cols = 0UL;
+	tui.active = false;
+}
+
+#undef TUI_MAX_ROWS
+#undef TUI_MAX_COLS
+#undef TUI_LIST_TOP
+#endif // TUI_IMPLEMENTATION
@@ -0,0 +1,202 @@
+#ifndef VISUALIZE_H_
+#define VISUALIZE_H_
+#include "audio.h"
+#include "fft.h"
+
+// Terminal spectrum bars of what is playing, redrawn at 60 fps by a thread of its own. It only reads the
+// audio tap (see `audio_tap_enable`), so it can fall behind or stall without the callback noticing. Frame
+// times and the thread's CPU use are logged when it stops.
+bool visualize_start(int fd);
+void visualize_stop();
+int visualize_height();		// rows the bars take at the top of the terminal
+
+#endif // VISUALIZE_H_
+
+#ifdef VISUALIZE_IMPLEMENTATION
+#undef VISUALIZE_IMPLEMENTATION
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define VISUALIZE_FPS			60
+#define VISUALIZE_ROWS			16
+#define VISUALIZE_MAX_BARS		128
+#define VISUALIZE_LOW_HZ		40.0f
+#define VISUALIZE_HIGH_HZ		16000.0f
+#define VISUALIZE_FLOOR_DB		-60.0f
+#define VISUALIZE_ATTACK		30.0f		// per second, towards a louder bar
+#define VISUALIZE_DECAY			6.0f		// per second, towards a quieter one
+
+typedef struct {
+	Fft fft;
+	int fd;
+	size_t bars;
+	uint16_t edges[VISUALIZE_MAX_BARS + 1];		// FFT bins
+	float frames[FFT_SIZE * CHANNEL_COUNT];
+	float mono[FFT_SIZE];
+	float re[FFT_BINS], im[FFT_BINS];		// packed transform
+	float levels[VISUALIZE_MAX_BARS];			// smoothed, 0..1
+	char *screen;
+	size_t screen_size;
+	CallbackStats stats;			// per frame; underruns are tap reads torn by the callback, short reads failed writes
+} Visualizer;
+
+static Visualizer *visualizer = NULL;
+static pthread_t visualize_tid;
+static atomic_bool visualize_running = false;
+
+static bool visualize_layout(Visualizer *v, ma_uint32 sample_rate) {
+	struct winsize ws = {0};
+	size_t columns = ioctl(v->fd, TIOCGWINSZ, &ws) == 0 && ws.ws_col ? ws.ws_col : 80;
+	v->bars = columns / 2 < VISUALIZE_MAX_BARS ? columns / 2 : VISUALIZE_MAX_BARS;
+
+	float high = VISUALIZE_HIGH_HZ < sample_rate / 2.0f ? VISUALIZE_HIGH_HZ : sample_rate / 2.0f;
+	for (size_t b = 0UL; b <= v->bars; b++) {
+		float hz = VISUALIZE_LOW_HZ * powf(high / VISUALIZE_LOW_HZ, (float) b / v->bars);
+		size_t bin = (size_t) (hz * FFT_SIZE / sample_rate);
+		v->edges[b] = (uint16_t) (bin < FFT_BINS ? bin : FFT_BINS - 1);
+	}
+
+	v->screen_size = VISUALIZE_ROWS * (v->bars * 4 + 8) + 16;		// a bar cell is up to 3 bytes of UTF-8, then a gap
+	v->screen = malloc(v->screen_size);
+	return v->screen != NULL;
+}
+
+// Loudest bin of every bar, in 0..1 over VISUALIZE_FLOOR_DB..0 dBFS.
+static void visualize_spectrum(Visualizer *v, float *targets) {
+	for (size_t i = 0UL; i < FFT_SIZE; i++) v->mono[i] = 0.5f * (v->frames[2 * i] + v->frames[2 * i + 1]);
+	fft_forward(&v->fft, v->mono, v->re, v->im);
+
+	const float scale = 2.0f / (FFT_SIZE / 2);		// Hann sums to N/2; one sided
+	for (size_t b = 0UL; b < v->bars; b++) {
+		float peak = 0.0f;
+		uint32_t last = v->edges[b + 1] > v->edges[b] ? v->edges[b + 1] : v->edges[b] + 1U;
+		for (uint32_t k = v->edges[b]; k < last; k++) {
+			float power = fft_power(&v->fft, v->re, v->im, k);
+			if (power > peak) peak = power;
+		}
+		float db = peak > 0.0f ? 10.0f * log10f(peak * scale * scale) : VISUALIZE_FLOOR_DB;
+		float level = 1.0f - db / VISUALIZE_FLOOR_DB;
+		targets[b] = level < 0.0f ? 0.0f : level > 1.0f ? 1.0f : level;
+	}
+}
+
+static void visualize_draw(Visualizer *v) {
+	static const char *eighths[] = { " ", "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█" };
+	char *at = v->screen;
+	at += sprintf(at, "\x1b[H");
+	for (int row = VISUALIZE_ROWS - 1; row >= 0; row--) {
+		for (size_t b = 0UL; b < v->bars; b++) {
+			int fill = (int) (v->levels[b] * VISUALIZE_ROWS * 8.0f) - row * 8;
+			const char *cell = eighths[fill < 0 ? 0 : fill > 8 ? 8 : fill];
+			size_t size = strlen(cell);
+			memcpy(at, cell, size);
+			at += size;
+			*at++ = ' ';
+		}
+		at += sprintf(at, "\x1b[K\r\n");
+	}
+	// Only this thread waits on a slow terminal, never the audio.
+	if (write(v->fd, v->screen, (size_t) (at - v->screen)) < 0) atomic_fetch_add_explicit(&v->stats.short_reads, 1, memory_order_relaxed);
+}
+
+static void *visualize_thread(void *arg) {
+	Visualizer *v = arg;
+	float targets[VISUALIZE_MAX_BARS];
+	const uint64_t period_ns = 1000000000ULL / VISUALIZE_FPS;
+	const float dt = 1.0f / VISUALIZE_FPS;
+	struct timespec next, cpu_start, cpu_end;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+	uint64_t wall_start = stats_now_ns();
+
+	while (atomic_load_explicit(&visualize_running, memory_order_relaxed)) {
+		uint64_t start_ns = stats_now_ns();
+		bool intact = audio_tap_read(v->frames, FFT_SIZE);
+		if (intact) {
+			visualize_spectrum(v, targets);
+			for (size_t b = 0UL; b < v->bars; b++) {
+				float rate = targets[b] > v->levels[b] ? VISUALIZE_ATTACK : VISUALIZE_DECAY;
+				float step = rate * dt < 1.0f ? rate * dt : 1.0f;
+				v->levels[b] += (targets[b] - v->levels[b]) * step;
+			}
+			visualize_draw(v);
+		}
+		stats_record_callback(&v->stats, start_ns, 1, intact ? 0 : 1, VISUALIZE_FPS);
+
+		next.tv_nsec += (long) period_ns;
+		if (next.tv_nsec >= 1000000000L) next.tv_sec++, next.tv_nsec -= 1000000000L;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+	}
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+	double cpu = (cpu_end.tv_sec - cpu_start.tv_sec) + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9;
+	double wall = (stats_now_ns() - wall_start) / 1e9;
+	stats_log("Visualizer", &v->stats);
+	nob_log(NOB_INFO, "Visualizer: %.3fs of CPU over %.1fs = %.2f%% of a core", cpu, wall, wall > 0.0 ? cpu / wall * 100.0 : 0.0);
+	return NULL;
+}
+
+bool visualize_start(int fd) {
+	if (visualizer) return true;
+	ma_uint32 sample_rate = audio_tap_enable(FFT_SIZE);
+	if (sample_rate == 0) {
+		nob_log(NOB_ERROR, "Could not tap the audio output for the visualizer");
+		return false;
+	}
+
+	Visualizer *v = calloc(1, sizeof(Visualizer));
+	if (!v) {
+		nob_log(NOB_ERROR, "Could not allocate the visualizer");
+		return false;
+	}
+	v->fd = fd;
+	fft_init(&v->fft);
+	if (!visualize_layout(v, sample_rate)) {
+		nob_log(NOB_ERROR, "Could not allocate the visualizer screen");
+		free(v);
+		return false;
+	}
+	static const char clear[] = "\x1b[?25l\x1b[2J";		// hide the cursor, clear the screen
+	if (write(fd, clear, sizeof(clear) - 1) < 0) nob_log(NOB_WARNING, "Could not clear the terminal: %s", strerror(errno));
+
+	atomic_store(&visualize_running, true);
+	int err = pthread_create(&visualize_tid, NULL, visualize_thread, v);
+	if (err != 0) {
+		atomic_store(&visualize_running, false);
+		nob_log(NOB_ERROR, "Failed to start visualizer thread: %s", strerror(err));
+		free(v->screen);
+		free(v);
+		return false;
+	}
+	visualizer = v;
+	return true;
+}
+
+void visualize_stop() {
+	if (!visualizer) return;
+	atomic_store(&visualize_running, false);
+	pthread_join(visualize_tid, NULL);
+	static const char restore[] = "\x1b[?25h";
+	if (write(visualizer->fd, restore, sizeof(restore) - 1) < 0) nob_log(NOB_WARNING, "Could not restore the cursor: %s", strerror(errno));
+	free(visualizer->screen);
+	free(visualizer);
+	visualizer = NULL;
+}
+
+int visualize_height() {
+	return VISUALIZE_ROWS + 1;		// and a blank one under them
+}
+
+#undef VISUALIZE_FPS
+#undef VISUALIZE_ROWS
+#undef VISUALIZE_MAX_BARS
+#undef VISUALIZE_LOW_HZ
+#undef VISUALIZE_HIGH_HZ
+#undef VISUALIZE_FLOOR_DB
+#undef VISUALIZE_ATTACK
+#undef VISUALIZE_DECAY
+#endif // VISUALIZE_IMPLEMENTATION
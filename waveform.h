@@ -0,0 +1,372 @@
+#ifndef WAVEFORM_H_
+#define WAVEFORM_H_
+#include "audio.h"
+
+// Waveform overviews without decoding: a pyramid of min/max/RMS peaks over the whole file, kept in a
+// `<music_path>.peaks` sidecar that is mmapped as is. Level 0 has one peak per WAVEFORM_BASE frames and
+// every level above halves the one below, up to a single peak. The decode is cut into chunks built in
+// parallel, each worker reducing its own chunk up the levels it fully covers.
+//
+// Layout: a WaveformHeader, then the levels back to back, each an array of WaveformPeak. Frames are at
+// the file's native sample rate, stored in the header.
+#define WAVEFORM_BASE			512
+#define WAVEFORM_MAX_LEVELS		32
+
+typedef struct {
+	int16_t min, max;		// over all channels, full scale 32767
+	uint16_t rms;			// same scale, may exceed it for square-ish full scale signals
+} WaveformPeak;
+
+typedef struct {
+	char magic[8];
+	int64_t music_size;
+	int64_t music_mtime;		// in nanoseconds
+	uint64_t frames;
+	uint32_t sample_rate;
+	uint32_t levels;
+	uint64_t offsets[WAVEFORM_MAX_LEVELS];		// in peaks from the end of the header
+	uint64_t counts[WAVEFORM_MAX_LEVELS];
+} WaveformHeader;
+
+typedef struct {
+	const WaveformHeader *header;
+	const WaveformPeak *peaks;
+	size_t size;
+} Waveform;
+
+// Writes the sidecar unless an up to date one is already there.
+bool waveform_build(const char *music_path, size_t workers);
+bool waveform_open(Waveform *waveform, const char *music_path);
+void waveform_close(Waveform *waveform);
+// Fills `pixels` peaks covering [start_frame, stop_frame), from the level with the fewest peaks that still
+// has one per pixel, so the cost is O(pixels) at any zoom. Returns the number filled (0 for an empty range).
+size_t waveform_fetch(const Waveform *waveform, uint64_t start_frame, uint64_t stop_frame, WaveformPeak *out, size_t pixels);
+size_t waveform_fetch_track(const Waveform *waveform, const Track *track, WaveformPeak *out, size_t pixels);
+
+#endif // WAVEFORM_H_
+
+#ifdef WAVEFORM_IMPLEMENTATION
+#undef WAVEFORM_IMPLEMENTATION
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WAVEFORM_MAGIC			"MSPEAKS1"
+#define WAVEFORM_CHUNK_LEVELS	12							// a chunk covers whole peaks of levels 0..12
+#define WAVEFORM_CHUNK_PEAKS	(1<<WAVEFORM_CHUNK_LEVELS)	// level 0 peaks per job, ~44s at 48kHz
+#define WAVEFORM_READ_PEAKS		64							// level 0 peaks decoded per read
+#define WAVEFORM_SEEK_POINTS	(1<<12)
+#define WAVEFORM_LANES			8
+#define WAVEFORM_SCALE			32767.0f
+
+typedef float WaveformVec __attribute__((vector_size(WAVEFORM_LANES * sizeof(float))));
+typedef int32_t WaveformMask __attribute__((vector_size(WAVEFORM_LANES * sizeof(int32_t))));
+
+typedef struct {
+	const char *music_path;
+	ma_decoder *source;			// owns the seek table
+	ma_uint32 channels;
+	WaveformHeader *header;
+	WaveformPeak *peaks;
+	size_t chunks;
+	atomic_size_t next;
+	atomic_size_t failed;
+} WaveformJob;
+
+static inline int16_t waveform_quantize(float x) {
+	x = roundf(x * WAVEFORM_SCALE);
+	return (int16_t) (x > 32767.0f ? 32767.0f : x < -32768.0f ? -32768.0f : x);
+}
+
+static inline uint16_t waveform_quantize_rms(float x) {
+	x = roundf(x * WAVEFORM_SCALE);
+	return (uint16_t) (x > 65535.0f ? 65535.0f : x);
+}
+
+// Min, max and RMS of `count` interleaved samples, 8 lanes at a time.
+static WaveformPeak waveform_peak(const float *samples, size_t count) {
+	WaveformVec lo = {0}, hi = {0}, acc = {0};
+	size_t i = 0UL;
+	for (; i + WAVEFORM_LANES <= count; i += WAVEFORM_LANES) {
+		WaveformVec v;
+		memcpy(&v, samples + i, sizeof(v));
+		acc += v * v;
+		WaveformMask less = v < lo, greater = v > hi;
+		lo = (WaveformVec) (((WaveformMask) v & less) | ((WaveformMask) lo & ~less));
+		hi = (WaveformVec) (((WaveformMask) v & greater) | ((WaveformMask) hi & ~greater));
+	}
+
+	float mn = 0.0f, mx = 0.0f, sum = 0.0f;
+	for (int lane = 0; lane < WAVEFORM_LANES; lane++) {
+		if (lo[lane] < mn) mn = lo[lane];
+		if (hi[lane] > mx) mx = hi[lane];
+		sum += acc[lane];
+	}
+	for (; i < count; i++) {
+		if (samples[i] < mn) mn = samples[i];
+		if (samples[i] > mx) mx = samples[i];
+		sum += samples[i] * samples[i];
+	}
+	return (WaveformPeak) {
+		.min = waveform_quantize(mn),
+		.max = waveform_quantize(mx),
+		.rms = waveform_quantize_rms(count ? sqrtf(sum / (float) count) : 0.0f),
+	};
+}
+
+static inline WaveformPeak waveform_merge(WaveformPeak a, WaveformPeak b) {
+	float ra = a.rms, rb = b.rms;
+	return (WaveformPeak) {
+		.min = a.min < b.min ? a.min : b.min,
+		.max = a.max > b.max ? a.max : b.max,
+		.rms = (uint16_t) (sqrtf((ra * ra + rb * rb) / 2.0f) + 0.5f),
+	};
+}
+
+// Peaks [first, last) of `level` from the level below.
+static void waveform_reduce(const WaveformHeader *header, WaveformPeak *peaks, uint32_t level, uint64_t first, uint64_t last) {
+	const WaveformPeak *below = peaks + header->offsets[level - 1];
+	WaveformPeak *at = peaks + header->offsets[level];
+	uint64_t below_count = header->counts[level - 1];
+	for (uint64_t i = first; i < last; i++)
+		at[i] = 2 * i + 1 < below_count ? waveform_merge(below[2 * i], below[2 * i + 1]) : below[2 * i];
+}
+
+static bool waveform_chunk(WaveformJob *job, ma_decoder *decoder, float *buffer, size_t chunk) {
+	const WaveformHeader *header = job->header;
+	uint64_t first = (uint64_t) chunk * WAVEFORM_CHUNK_PEAKS;
+	uint64_t last = first + WAVEFORM_CHUNK_PEAKS < header->counts[0] ? first + WAVEFORM_CHUNK_PEAKS : header->counts[0];
+	ma_result result = ma_decoder_seek_to_pcm_frame(decoder, first * WAVEFORM_BASE);
+	if (result != MA_SUCCESS) return false;
+
+	for (uint64_t p = first; p < last; ) {
+		uint64_t batch = last - p < WAVEFORM_READ_PEAKS ? last - p : WAVEFORM_READ_PEAKS;
+		ma_uint64 read = 0;
+		result = ma_decoder_read_pcm_frames(decoder, buffer, batch * WAVEFORM_BASE, &read);
+		if (read == 0) return result == MA_AT_END;
+
+		for (uint64_t i = 0UL; i < batch && i * WAVEFORM_BASE < read; i++, p++) {
+			ma_uint64 frames = read - i * WAVEFORM_BASE < WAVEFORM_BASE ? read - i * WAVEFORM_BASE : WAVEFORM_BASE;
+			job->peaks[p] = waveform_peak(buffer + i * WAVEFORM_BASE * job->channels, frames * job->channels);
+		}
+		if (read < batch * WAVEFORM_BASE) break;
+	}
+
+	for (uint32_t level = 1; level < header->levels && level <= WAVEFORM_CHUNK_LEVELS; level++) {
+		uint64_t from = first >> level, to = ((first + WAVEFORM_CHUNK_PEAKS) >> level);
+		if (to > header->counts[level]) to = header->counts[level];
+		waveform_reduce(header, job->peaks, level, from, to);
+	}
+	return true;
+}
+
+static void *waveform_worker(void *arg) {
+	WaveformJob *job = arg;
+
+	ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 0, 0);
+	ma_decoder decoder;
+	ma_result result = ma_decoder_init_file(job->music_path, &config, &decoder);
+	if (result == MA_SUCCESS) result = audio_decoder_share_seek_table(&decoder, job->source);
+	if (result != MA_SUCCESS) {
+		nob_log(NOB_ERROR, "Waveform worker could not open `%s`: %s", job->music_path, ma_result_description(result));
+		return NULL;
+	}
+
+	float *buffer = malloc(sizeof(float) * WAVEFORM_READ_PEAKS * WAVEFORM_BASE * job->channels);
+	size_t chunk;
+	while ((chunk = atomic_fetch_add(&job->next, 1)) < job->chunks)
+		if (!waveform_chunk(job, &decoder, buffer, chunk)) atomic_fetch_add(&job->failed, 1);
+
+	free(buffer);
+	ma_decoder_uninit(&decoder);
+	return NULL;
+}
+
+// Also that the levels are the pyramid `waveform_build` lays out and fit in the file, so nothing read
+// through the header can land outside the mapping.
+static bool waveform_is_current(const WaveformHeader *header, size_t size, const struct stat *music) {
+	if (size < sizeof(*header) || memcmp(header->magic, WAVEFORM_MAGIC, sizeof(header->magic)) != 0) return false;
+	if (header->music_size != (int64_t) music->st_size || header->music_mtime != file_mtime_ns(music)) return false;
+	if (header->levels == 0 || header->levels > WAVEFORM_MAX_LEVELS) return false;
+	if ((size - sizeof(*header)) % sizeof(WaveformPeak) != 0) return false;
+	uint64_t total = (size - sizeof(*header)) / sizeof(WaveformPeak);
+	if (header->offsets[0] != 0 || header->counts[0] != (header->frames + WAVEFORM_BASE - 1) / WAVEFORM_BASE) return false;
+	for (uint32_t l = 0; l < header->levels; l++) {
+		if (header->counts[l] == 0 || header->counts[l] > total || header->offsets[l] > total - header->counts[l]) return false;
+		if (l && (header->offsets[l] != header->offsets[l - 1] + header->counts[l - 1] || header->counts[l] != (header->counts[l - 1] + 1) / 2)) return false;
+	}
+	uint64_t last = header->levels - 1;
+	return header->offsets[last] + header->counts[last] == total;
+}
+
+bool waveform_open(Waveform *waveform, const char *music_path) {
+	*waveform = (Waveform) {0};
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s.peaks", music_path);
+	struct stat music, st;
+	if (stat(music_path, &music) != 0) return false;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	void *data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(WaveformHeader))
+		data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return false;
+
+	if (!waveform_is_current(data, (size_t) st.st_size, &music)) {
+		munmap(data, (size_t) st.st_size);
+		return false;
+	}
+	waveform->header = data;
+	waveform->peaks = (const WaveformPeak *) ((const char *) data + sizeof(WaveformHeader));
+	waveform->size = (size_t) st.st_size;
+	return true;
+}
+
+void waveform_close(Waveform *waveform) {
+	if (waveform->header) munmap((void *) waveform->header, waveform->size);
+	*waveform = (Waveform) {0};
+}
+
+bool waveform_build(const char *music_path, size_t workers) {
+	Waveform existing;
+	if (waveform_open(&existing, music_path)) {
+		waveform_close(&existing);
+		return true;
+	}
+
+	bool result = true;
+	char path[PATH_MAX], temp_path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s.peaks", music_path);
+	snprintf(temp_path, sizeof(temp_path), "%s.peaks.tmp", music_path);
+	ma_decoder source;
+	WaveformJob job = { .music_path = music_path, .source = &source };
+	WaveformHeader header = {0};
+	pthread_t *threads = NULL;
+	void *data = MAP_FAILED;
+	size_t size = 0UL;
+	int fd = -1;
+
+	uint64_t start_ns = stats_now_ns();
+	struct stat music;
+	if (stat(music_path, &music) != 0) {
+		nob_log(NOB_ERROR, "Could not stat `%s`: %s", music_path, strerror(errno));
+		return false;
+	}
+	ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_f32, 0, 0);
+	decoder_config.seekPointCount = WAVEFORM_SEEK_POINTS;
+	ma_result ma = ma_decoder_init_file(music_path, &decoder_config, &source);
+	if (ma != MA_SUCCESS) {
+		nob_log(NOB_ERROR, "Could not open `%s`: %s", music_path, ma_result_description(ma));
+		return false;
+	}
+
+	ma_uint64 length = 0;
+	ma_data_source_get_data_format(&source, NULL, &job.channels, &header.sample_rate, NULL, 0);
+	if ((ma = ma_decoder_get_length_in_pcm_frames(&source, &length)) != MA_SUCCESS || length == 0) {
+		nob_log(NOB_ERROR, "Could not get the length of `%s`: %s", music_path, ma_result_description(ma));
+		nob_return_defer(false);
+	}
+	memcpy(header.magic, WAVEFORM_MAGIC, sizeof(header.magic));
+	header.frames = length;
+	header.music_size = (int64_t) music.st_size;
+	header.music_mtime = file_mtime_ns(&music);
+	uint64_t count = (header.frames + WAVEFORM_BASE - 1) / WAVEFORM_BASE, offset = 0;
+	for (;;) {
+		header.offsets[header.levels] = offset;
+		header.counts[header.levels++] = count;
+		offset += count;
+		if (count == 1 || header.levels == WAVEFORM_MAX_LEVELS) break;
+		count = (count + 1) / 2;
+	}
+
+	size = sizeof(header) + offset * sizeof(WaveformPeak);
+	fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, (off_t) size) != 0 || (data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		nob_log(NOB_ERROR, "Could not create `%s`: %s", temp_path, strerror(errno));
+		nob_return_defer(false);
+	}
+	memcpy(data, &header, sizeof(header));
+	job.header = data;
+	job.peaks = (WaveformPeak *) ((char *) data + sizeof(header));
+	job.chunks = (size_t) ((header.counts[0] + WAVEFORM_CHUNK_PEAKS - 1) / WAVEFORM_CHUNK_PEAKS);
+
+	if (workers == 0UL) workers = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers > job.chunks) workers = job.chunks;
+	threads = malloc(sizeof(pthread_t) * workers);
+	size_t started = 0UL;
+	for (; started < workers; started++) if (pthread_create(&threads[started], NULL, waveform_worker, &job) != 0) break;
+	if (started == 0UL) waveform_worker(&job);
+	for (size_t i = 0UL; i < started; i++) pthread_join(threads[i], NULL);
+	if (atomic_load(&job.next) < job.chunks || atomic_load(&job.failed)) {
+		nob_log(NOB_ERROR, "Could not build the waveform of `%s`", music_path);
+		nob_return_defer(false);
+	}
+	for (uint32_t level = WAVEFORM_CHUNK_LEVELS + 1; level < header.levels; level++)		// what spans several chunks
+		waveform_reduce(&header, job.peaks, level, 0, header.counts[level]);
+
+	if (rename(temp_path, path) != 0) {
+		nob_log(NOB_ERROR, "Could not write `%s`: %s", path, strerror(errno));
+		nob_return_defer(false);
+	}
+	nob_log(NOB_INFO, "Built %u waveform levels of `%s` (%zu KiB) with %zu workers in %.2fs", header.levels, music_path,
+		size / 1024, started ? started : 1UL, (stats_now_ns() - start_ns) / 1e9);
+
+defer:
+	if (data != MAP_FAILED) munmap(data, size);
+	if (fd >= 0) close(fd);
+	if (!result && fd >= 0) unlink(temp_path);
+	free(threads);
+	ma_decoder_uninit(&source);
+	return result;
+}
+
+size_t waveform_fetch(const Waveform *waveform, uint64_t start_frame, uint64_t stop_frame, WaveformPeak *out, size_t pixels) {
+	const WaveformHeader *header = waveform->header;
+	if (stop_frame > header->frames) stop_frame = header->frames;
+	if (pixels == 0UL || start_frame >= stop_frame) return 0UL;
+
+	uint64_t span = stop_frame - start_frame;
+	uint32_t level = 0;
+	while (level + 1 < header->levels && ((uint64_t) WAVEFORM_BASE << (level + 1)) * pixels <= span) level++;
+
+	const WaveformPeak *peaks = waveform->peaks + header->offsets[level];
+	uint64_t size = (uint64_t) WAVEFORM_BASE << level, count = header->counts[level];
+	for (size_t p = 0UL; p < pixels; p++) {
+		uint64_t from = start_frame + span * p / pixels, to = start_frame + span * (p + 1) / pixels;
+		uint64_t first = from / size, last = (to + size - 1) / size;
+		if (last > count) last = count;
+		if (last <= first) last = first + 1;		// zoomed in past level 0: pixels share a peak
+		WaveformPeak peak = peaks[first];
+		float sum = (float) peak.rms * peak.rms;
+		for (uint64_t i = first + 1; i < last; i++) {
+			if (peaks[i].min < peak.min) peak.min = peaks[i].min;
+			if (peaks[i].max > peak.max) peak.max = peaks[i].max;
+			sum += (float) peaks[i].rms * peaks[i].rms;
+		}
+		peak.rms = (uint16_t) (sqrtf(sum / (float) (last - first)) + 0.5f);
+		out[p] = peak;
+	}
+	return pixels;
+}
+
+size_t waveform_fetch_track(const Waveform *waveform, const Track *track, WaveformPeak *out, size_t pixels) {
+	uint32_t rate = waveform->header->sample_rate;
+	uint64_t stop = track->stop_us ? track_stop_frame(track, rate) : waveform->header->frames;		// last track, length not set yet
+	return waveform_fetch(waveform, track_start_frame(track, rate), stop, out, pixels);
+}
+
+#undef WAVEFORM_MAGIC
+#undef WAVEFORM_CHUNK_LEVELS
+#undef WAVEFORM_CHUNK_PEAKS
+#undef WAVEFORM_READ_PEAKS
+#undef WAVEFORM_SEEK_POINTS
+#undef WAVEFORM_LANES
+#undef WAVEFORM_SCALE
+#endif // WAVEFORM_IMPLEMENTATION